@@ -1,7 +1,16 @@
 #ifndef INC_TIMER_H
 #define INC_TIMER_H
+#include "common-defines.h"
+
+#define TIMER_PWM_PERIOD (1000)     // Timer counts per PWM period, so duty cycles go from 0 to this in 0.1% steps. The Makefile reads it from here
+
+// The waveform streamed by timer_pwm_start_waveform(), one step per PWM period. Generated at build time by scripts/gen-pwm-waveform.py
+extern const uint32_t timer_pwm_waveform[];    // Whole words, the size of TIM2's compare register
+extern const uint16_t timer_pwm_waveform_length;
 
 void timer_setup(void);
-void timer_pwm_set_duty_cycle(float duty_cycle);
+void timer_pwm_set_duty(const uint16_t duty);  // 0 to TIMER_PWM_PERIOD. Stops the waveform, if it's running
+void timer_pwm_start_waveform(void);            // Doxygen style comment block in timer.c
+void timer_pwm_stop_waveform(void);
 
-#endif // INC_TIMER_H
\ No newline at end of file
+#endif // INC_TIMER_H
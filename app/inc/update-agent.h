@@ -0,0 +1,10 @@
+#ifndef INC_UPDATE_AGENT_H
+#define INC_UPDATE_AGENT_H
+#include "common-defines.h"
+
+void update_agent_setup(void);     // Start listening for the host over uart
+void update_agent_update(void);    // Update related workload in the main while(1) loop
+bool update_agent_can_sleep(void);  // Nothing for the update agent to do until the next interrupt
+void update_agent_request_bootloader_update(void);   // Reset into the bootloader, and have it wait for the host. Doesn't return
+
+#endif // INC_UPDATE_AGENT_H
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+
+# Generates the PWM waveform table that the DMA streams into TIM2's compare register, one entry per PWM period.
+# The default is a breathing curve: a raised cosine (smoothly from off, to fully on, and back), gamma corrected since our eyes
+# don't see brightness linearly. Without the correction, the LED would look fully on for most of the breath.
+# The math is all done here, at build time, so the firmware only ever sees integer compare values.
+# 4 bytes per step (TIM2's compare register is 32 bits, and the DMA writes it whole), in ram (the startup code copies it from flash along with the initialized variables).
+#
+# usage: gen-pwm-waveform.py <steps> <gamma> <pwm period> > generated.pwm-waveform.c
+
+import sys
+import math
+
+if len(sys.argv) < 4:
+    print("usage: gen-pwm-waveform.py <steps> <gamma> <pwm period>", file = sys.stderr)
+    exit(1)
+
+steps      = int(sys.argv[1])
+gamma      = float(sys.argv[2])
+pwm_period = int(sys.argv[3]) # Timer counts per PWM period (TIMER_PWM_PERIOD). A compare value of this much is fully on
+
+if steps < 1 or steps > 0xFFFF: # The DMA's transfer count is 16 bits
+    print("steps has to be between 1 and 65535", file = sys.stderr)
+    exit(1)
+
+values = []
+for step in range(steps):
+    brightness = (1.0 - math.cos(2.0 * math.pi * step / steps)) / 2.0 # 0 to 1 and back, over the whole table
+    values.append(round(pwm_period * (brightness ** gamma)))
+
+VALUES_PER_LINE = 16
+
+print("// Generated by scripts/gen-pwm-waveform.py (%d steps, gamma %.2f). Don't edit, it's rewritten by make" % (steps, gamma))
+print("#include \"timer.h\"")
+print("")
+print("#if TIMER_PWM_PERIOD != %d" % pwm_period)
+print("#error \"The waveform was generated for another PWM period. Run make again to regenerate it\"")
+print("#endif")
+print("")
+print("RAMDATA const uint32_t timer_pwm_waveform[] = {    // In ram, so a flash erase doesn't stall the DMA")
+for i in range(0, steps, VALUES_PER_LINE):
+    print("    " + ", ".join("%4d" % value for value in values[i:i + VALUES_PER_LINE]) + ",")
+print("};")
+print("const uint16_t timer_pwm_waveform_length = %d;" % steps)
@@ -5,12 +5,19 @@
 #include "core/system.h"
 #include "timer.h"
 #include "core/uart.h"
-
-#define BOOTLOADER_SIZE (0x8000U)
+#include "update-agent.h"
+#include "core/scheduler.h"
+#include "generated.protocol.h"
 
 #define LED_PORT     (GPIOA)
 #define LED_PIN      (GPIO5)
 
+#define BUTTON_PORT  (GPIOC)
+#define BUTTON_PIN   (GPIO13)       // The blue user button on the Nucleo board. Pulled up externally, reads low while pressed
+
+#define BUTTON_PERIOD   (20)     // msec between looks at the button
+#define UPDATE_DEADLINE (10000)  // usec. The uart ring buffer holds ~11ms of data at 115200 baud, so we have to read it by then
+
 #define UART_PORT    (GPIOA)
 #define RX_PIN       (GPIO3)        // UART RX
 #define TX_PIN       (GPIO2)        // UART TX
@@ -41,9 +48,39 @@ static void gpio_setup(void) {
     gpio_mode_setup(UART_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, TX_PIN | RX_PIN);  // We need to use the alternate function mode, to have the GPIO pin serve an alternate purpose (UART)
     gpio_set_af(UART_PORT, GPIO_AF7, TX_PIN | RX_PIN);                          // According to the Alternate Function table (chapter 4 table 11 in the datasheet) 
 
+    rcc_periph_clock_enable(RCC_GPIOC);
+    gpio_mode_setup(BUTTON_PORT, GPIO_MODE_INPUT, GPIO_PUPD_NONE, BUTTON_PIN);
 }
 
 
+/**
+ * @brief The uart belongs to the update agent. It receives new firmware into the staging slot while we keep running.
+ *        Runs on every received byte, and on every tick for its timeouts.
+ *        Before there was a ring buffer, with everything done in one busy loop, two keys pressed in quick succession on the host would
+ *        only see the first one echoed: the second one came in while we were busy elsewhere, and overwrote the first one. The deadline
+ *        tells us when we're getting close to that again
+ */
+static bool update_task(void) {
+    update_agent_update();
+    return !update_agent_can_sleep();   // More bytes or packets waiting
+}
+
+/**
+ * @brief Holding the user button hands updating over to the bootloader
+ */
+static bool button_task(void) {
+    if(gpio_get(BUTTON_PORT, BUTTON_PIN) == 0) {
+        update_agent_request_bootloader_update();
+    }
+    return false;
+}
+
+// In order of priority. A task that's ready runs before the ones below it
+static scheduler_task_t tasks[] = {
+    { .name = "update",   .function = update_task,   .events = SYSTEM_EVENT_UART_RX | SYSTEM_EVENT_TICK, .deadline = UPDATE_DEADLINE },
+    { .name = "button",   .function = button_task,   .period = BUTTON_PERIOD },
+};
+
 /**
  * @brief Bad timing mechanism. The CPU doesn't do anything while it's waiting. Ended up not using it
  */
@@ -68,39 +105,15 @@ int main(void) {
 
     timer_setup();
     uart_setup();
+    update_agent_setup();
 
-    float duty_cycle =  0.0f;
-    timer_pwm_set_duty_cycle(duty_cycle);
-
-    uint64_t start_time = system_get_ticks();
-    while(1) {
-        if(system_get_ticks() - start_time >= 1*10) {
-            // gpio_toggle(LED_PORT, LED_PIN);          // Used when toggling the GPIO
-            duty_cycle += 1.0f;
-            if(duty_cycle > 100.0f) {
-                duty_cycle = 0.0f;
-            }
-            timer_pwm_set_duty_cycle(duty_cycle);
-            
-            start_time = system_get_ticks();
-        }
-
-        // Do useful work
-        
-        // Check if we received any bytes on the UART and send something back in response
-        if(uart_data_available()) {
-            uint8_t data = uart_read_byte();
-            uart_write_byte(data + 1);
-        }
-
-        // Simulating high workload (to justify our ring buffer)
-        // Before implementing the ring buffer, working with the preliminary poor solution, if we pressed two
-        // keyboard buttons in quick succession, we would only see the first one appear in the terminal. We wrote the first one,
-        // we were still busy spinning, we wrote the second one, and only then did we get back around to check if the UART had
-        // any bytes available. We missed input under high workload
-        
-        //system_delay(1000);
+    // The LED breathes with no help from the CPU: the DMA feeds the timer the next step of the waveform every PWM period.
+    // timer_pwm_set_duty() takes over manually, for a fixed brightness
+    timer_pwm_start_waveform();
+
+    // New work goes in the task table, rather than in a loop of our own. Each task's stats show how much of the CPU it takes up
+    scheduler_setup(tasks, sizeof(tasks) / sizeof(tasks[0]));
+    scheduler_run();    // Sleeps whenever no task is ready. The PWM waveform keeps going meanwhile
 
-    }
     return 0;
 }
\ No newline at end of file
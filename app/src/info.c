@@ -13,6 +13,9 @@ firmware_info_t firmware_info = {
 __attribute__ ((section(".firmware_signature")))    // Same as the attribute above. Make sure to KEEP in the linkerscript
 uint8_t firmware_signature[16] = {0};   // 16 for AES key size
 
+__attribute__ ((section(".firmware_sector_macs")))  // Filled in by the signer, along with the signature
+uint8_t firmware_sector_macs[SECTOR_MAC_COUNT][IMAGE_MAC_SIZE] = {0};
+
 // In the linkerscrpit, line: . = ALIGN(16);
 // Noramlly, when the linker is putting everything into memory, it'll take a section, for example of 100 bytes, and place
 // it somewhere. Then would place another section directly after the last one. We're telling it to instead of placing it
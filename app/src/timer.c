@@ -1,9 +1,17 @@
 #include "timer.h"
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dma.h>
 
 #define PRESCALER (84)
-#define ARR_VALUE (1000)
+#define ARR_VALUE (TIMER_PWM_PERIOD)
+
+// TIM2's update event is wired to DMA1 stream 1, channel 3 (the DMA1 request mapping table in the reference manual)
+#define WAVEFORM_DMA        (DMA1)
+#define WAVEFORM_DMA_STREAM (DMA_STREAM1)
+#define WAVEFORM_DMA_CHANNEL (DMA_SxCR_CHSEL_3)
+
+static bool is_waveform_running = false;
 
 void timer_setup(void) {
     rcc_periph_clock_enable(RCC_TIM2);  // Enable the clock to this peripheral. According to the Alternate function mapping table in the datasheet, 
@@ -32,10 +40,59 @@ void timer_setup(void) {
     // freq = system_freq / ( (prescaler - 1) * (arr - 1) )    where arr is the auto reload register value (ARR)
     timer_set_prescaler(TIM2, PRESCALER - 1);
     timer_set_period(TIM2, ARR_VALUE - 1);
+
+    // A new compare value only takes effect at the next update event, so a period is never cut short by a value written in the middle of it
+    timer_enable_oc_preload(TIM2, TIM_OC1);
+
+    rcc_periph_clock_enable(RCC_DMA1);
 }
 
-void timer_pwm_set_duty_cycle(float duty_cycle) {
-    // duty cycle = (Capture Compare Register / Auto Reload Register) * 100
-    const float raw_value = (float)ARR_VALUE * (duty_cycle / 100.0f);
-    timer_set_oc_value(TIM2, TIM_OC1, (uint32_t)raw_value);             // Knocking off any decimal places that we may have
+/**
+ * @brief duty cycle = (Capture Compare Register / Auto Reload Register) * 100, so with ARR_VALUE at TIMER_PWM_PERIOD, the duty is
+ *        the compare value itself. No float math
+ */
+void timer_pwm_set_duty(const uint16_t duty) {
+    timer_pwm_stop_waveform();
+    timer_set_oc_value(TIM2, TIM_OC1, duty > ARR_VALUE ? ARR_VALUE : duty);
+}
+
+/**
+ * @brief Have the DMA copy the next entry of timer_pwm_waveform into the compare register on every update event, going around the
+ *        table forever (circular mode). At 1 kHz, each entry lasts a millisecond. The CPU isn't involved at all, so the waveform keeps
+ *        going however busy the main loop is.
+ *        The table is RAMDATA: were it read from flash, a sector erase (which can take a second or two) would stall the DMA just like
+ *        it stalls the CPU, and freeze the LED while an update is being received
+ */
+void timer_pwm_start_waveform(void) {
+    if(is_waveform_running) { return; }
+
+    dma_stream_reset(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+    dma_channel_select(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, WAVEFORM_DMA_CHANNEL);
+    dma_set_priority(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, DMA_SxCR_PL_LOW);
+    dma_set_transfer_mode(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, DMA_SxCR_DIR_MEM_TO_PERIPHERAL);
+
+    // Words on both sides. TIM2 is a 32-bit timer, and a half-word written to its compare register over the bus lands in both
+    // halves of it (the value ends up as v | v << 16), so the table holds whole words. Direct mode (no FIFO) needs both sizes to be
+    // the same anyways
+    dma_set_memory_size(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, DMA_SxCR_MSIZE_32BIT);
+    dma_set_peripheral_size(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, DMA_SxCR_PSIZE_32BIT);
+    dma_enable_memory_increment_mode(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+    dma_disable_peripheral_increment_mode(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+    dma_enable_circular_mode(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+
+    dma_set_peripheral_address(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, (uint32_t)&TIM_CCR1(TIM2));
+    dma_set_memory_address(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, (uint32_t)timer_pwm_waveform);
+    dma_set_number_of_data(WAVEFORM_DMA, WAVEFORM_DMA_STREAM, timer_pwm_waveform_length);
+    dma_enable_stream(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+
+    timer_enable_irq(TIM2, TIM_DIER_UDE);  // Not an interrupt: a DMA request on every update event
+    is_waveform_running = true;
+}
+
+void timer_pwm_stop_waveform(void) {
+    if(!is_waveform_running) { return; }
+
+    timer_disable_irq(TIM2, TIM_DIER_UDE);
+    dma_disable_stream(WAVEFORM_DMA, WAVEFORM_DMA_STREAM);
+    is_waveform_running = false;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include <libopencm3/cm3/scb.h>
+#include "update-agent.h"
+#include "core/bl-update.h"
+#include "core/firmware-info.h"
+#include "core/system.h"
+#include "core/boot-mailbox.h"
+
+#define RESET_DELAY (150)   // msec. Lets the last packet of the update make it out over uart before we reset, and the host ask for our stats
+
+// The application keeps running while the host sends it a new image. The image goes into the staging slot, so the code we're
+// running from the active slot is never touched. The bootloader verifies the staged image and installs it on the next reset.
+// Note that the STM32F446 has a single flash bank: while a sector of the staging slot is being erased, any code fetch from flash
+// stalls until the erase is done. Peripherals such as the PWM timer keep running meanwhile.
+
+void update_agent_setup(void) {
+    bl_update_setup(STAGING_SLOT_ADDRESS, BL_UPDATE_WAIT_FOREVER);  // The host may show up at any time, so wait for it for as long as we run
+}
+
+void update_agent_update(void) {
+    const bl_update_result_t result = bl_update_run();
+
+    if(result == BL_Update_Succeeded) {
+        bl_update_linger(RESET_DELAY);
+        scb_reset_system();     // The bootloader takes it from here
+    } else if(result == BL_Update_Failed) {
+        update_agent_setup();   // Go back to waiting for the host
+    }
+}
+
+/**
+ * @brief Whether the main loop may sleep until the next interrupt, as far as updating goes
+ */
+bool update_agent_can_sleep(void) {
+    return bl_update_can_sleep();
+}
+
+/**
+ * @brief For when the host can't be served from here (e.g. we're about to stop servicing the uart). The bootloader normally boots
+ *        us straight away, without listening for the host. The request in the mailbox has it listen for as long as an update takes
+ */
+void update_agent_request_bootloader_update(void) {
+    boot_mailbox_request_update();
+    scb_reset_system();
+}
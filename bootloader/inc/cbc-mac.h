@@ -0,0 +1,22 @@
+#ifndef INC_CBC_MAC_H
+#define INC_CBC_MAC_H
+
+#include "common-defines.h"
+#include "aes.h"
+
+// AES-128 CBC-MAC with a zeroed IV, fed a piece at a time. The message is padded the way openssl pads (PKCS#7), and the MAC is the
+// last block of the ciphertext. The bootloader checks images with it, and the native signer (fw-signer/) is built from this same
+// file and aes.c, so both sides compute MACs with the very same code. Nothing here depends on the target
+
+typedef struct cbc_mac_t {
+    AES_Block_t state;                  // The last ciphertext block. Starts out as the zeroed IV
+    const AES_Block_t* key_schedule;
+    uint8_t pending[AES_BLOCK_SIZE];    // Data that doesn't fill a whole block yet
+    uint32_t pending_length;
+} cbc_mac_t;
+
+void cbc_mac_init(cbc_mac_t* mac, const AES_Block_t* key_schedule);
+void cbc_mac_update(cbc_mac_t* mac, const uint8_t* data, uint32_t length);
+void cbc_mac_finish(cbc_mac_t* mac, uint8_t out[AES_BLOCK_SIZE]);
+
+#endif // INC_CBC_MAC_H
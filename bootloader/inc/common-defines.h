@@ -4,4 +4,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#endif  //  INC_COMMON_DEFINS_H
\ No newline at end of file
+// Hot code, and the tables it reads, can be placed in ram. The linkerscript puts these sections in .data, so the startup code copies
+// them in from flash along with the initialized variables. Code in ram doesn't pay flash wait states or miss in the ART accelerator.
+// That's all it's for: the flash driver (bl-flash.c) and whatever calls it stay in flash, so the cpu still stalls on instruction
+// fetches while the flash is erasing or programming. Ram is too far away from flash for a regular branch, thus long_call. It has to
+// be on the declaration in the header too, since that's what the caller sees.
+// Building with RAMFUNC_IN_FLASH (make RAMFUNC_IN_FLASH=1) leaves everything in flash, for comparison
+#ifdef RAMFUNC_IN_FLASH
+#define RAMFUNC
+#define RAMDATA
+#else
+#define RAMFUNC     __attribute__ ((section(".ramfunc"), long_call, noinline))
+#define RAMDATA     __attribute__ ((section(".ramdata")))
+#endif
+
+// Halts at a breakpoint, for conditions that should never happen, so a debugger stops right where it did. Host tools that build
+// target code (comms-bench) define HOST_BREAKPOINT and supply host_breakpoint(), which records the hit instead
+#ifdef HOST_BREAKPOINT
+void host_breakpoint(void);
+#define BREAKPOINT()    host_breakpoint()
+#else
+#define BREAKPOINT()    __asm__("BKPT #0")
+#endif
+
+#endif  //  INC_COMMON_DEFINS_H
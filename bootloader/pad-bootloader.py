@@ -1,9 +1,10 @@
-BOOTLOADER_SIZE = 0x8000
+from generated_protocol import BOOTLOADER_SIZE   # Generated by make, from shared/protocol.json
 BOOTLOADER_FILE = "bootloader.bin"
 with open(BOOTLOADER_FILE, "rb") as f:
     raw_file=f.read()
 
-bytes_to_pad = BOOTLOADER_SIZE - len(raw_file)  # If the booloader binary was larger than 32 KiB it wouldn't link because we modified the Makefile
+bytes_to_pad = BOOTLOADER_SIZE - len(raw_file)  # If the booloader binary was larger than 16 KiB it wouldn't link because of the linkerscript
+                                                # Padding with 0xff also leaves sector 1, the update progress log, erased
 padding = bytes([0xff for _ in range(bytes_to_pad)])
 
 with open(BOOTLOADER_FILE, "wb") as f:
@@ -17,7 +17,7 @@ On some platforms there would be a processor instruction that will do many of th
 // For memcpy
 #include "string.h"
 
-uint8_t GF_Mult(uint8_t a, uint8_t b) {
+RAMFUNC uint8_t GF_Mult(uint8_t a, uint8_t b) {
   uint8_t result = 0;
   uint8_t shiftEscapesField = 0;
 
@@ -57,7 +57,8 @@ void GF_WordAdd(AES_Column_t a, AES_Column_t b, AES_Column_t dest) {
 }
 
 // Spec page 16
-const uint8_t sbox_encrypt[] = {
+// The functions used for encryption (marked RAMFUNC in aes.h) and this table run from ram. They're the hot path of validating an image
+RAMDATA const uint8_t sbox_encrypt[] = {
 /*          0     1     2     3     4     5     6     7     8     9     a     b     c     d     e     f */
 /* 0 */  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
 /* 1 */  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
@@ -155,7 +156,7 @@ void AES_RotWord(AES_Column_t word) {
   word[3] = temp;
 }
 
-void AES_SubBytes(AES_Block_t state, const uint8_t table[]) {
+RAMFUNC void AES_SubBytes(AES_Block_t state, const uint8_t table[]) {
   uint8_t index;
   for (size_t col = 0; col < 4; col++) {
     for  (size_t row = 0; row < 4; row++) {
@@ -173,7 +174,7 @@ void AES_SubWord(AES_Column_t word, const uint8_t table[]) {
   }
 }
 
-void AES_ShiftRows(AES_Block_t state) {
+RAMFUNC void AES_ShiftRows(AES_Block_t state) {
   uint8_t temp0;
   uint8_t temp1;
 
@@ -236,7 +237,7 @@ void AES_InvShiftRows(AES_Block_t state) {
   state[3][3] = temp0;
 }
 
-void AES_MixColumns(AES_Block_t state) {
+RAMFUNC void AES_MixColumns(AES_Block_t state) {
   AES_Column_t temp = { 0 };
 
   for (size_t i = 0; i < 4; i++) {
@@ -262,7 +263,7 @@ void AES_InvMixColumns(AES_Block_t state) {
   }
 }
 
-void AES_AddRoundKey(AES_Block_t state, const AES_Block_t roundKey) {
+RAMFUNC void AES_AddRoundKey(AES_Block_t state, const AES_Block_t roundKey) {
   for (size_t col = 0; col < 4; col++) {
     for  (size_t row = 0; row < 4; row++) {
       state[col][row] ^= roundKey[col][row];
@@ -270,7 +271,7 @@ void AES_AddRoundKey(AES_Block_t state, const AES_Block_t roundKey) {
   }
 }
 
-void AES_EncryptBlock(AES_Block_t state, const AES_Block_t* keySchedule) {
+RAMFUNC void AES_EncryptBlock(AES_Block_t state, const AES_Block_t* keySchedule) {
   AES_Block_t* roundKey = (AES_Block_t*)keySchedule;
 
   // Initial round key addition
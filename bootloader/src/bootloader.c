@@ -2,50 +2,36 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/dwt.h>
 #include <string.h>
 #include <stdio.h>
 #include "common-defines.h"
 #include "core/uart.h"
 #include "core/system.h"
-#include "comms.h"
-#include "bl-flash.h"
-#include "core/simple-timer.h"
+#include "core/bl-update.h"
+#include "core/bl-flash.h"
 #include "core/firmware-info.h"
+#include "core/boot-mailbox.h"
+#include "core/progress-log.h"
 #include "core/crc.h"
+#include "core/comms.h"
 #include "aes.h"
+#include "cbc-mac.h"
 
 #define UART_PORT     (GPIOA)
 #define RX_PIN       (GPIO3)        // UART RX
 #define TX_PIN       (GPIO2)        // UART TX
 
-// Safety check that we get link error when we are overrunning the 32 KiB we specified for the bootloader
-// const uint8_t data[0x8000] = {0};
-
-#define SYNQ_SEQ_0 (0xc4)      // First byte in synchronization sequence. Chosen arbitrarily. These are just bytes that we expect to
-#define SYNQ_SEQ_1 (0x55)      // get in a row
-#define SYNQ_SEQ_2 (0x7e)
-#define SYNQ_SEQ_3 (0x10)
-
-#define DEFAULT_TIMEOUT (60000)  // 60 secs
-
-typedef enum bl_state_t {
-    BL_State_Sync,
-    BL_State_WaitForUpdateReq, // Req for request
-    BL_State_DevideIDReq,       // Req for request
-    BL_State_DevideIDRes,       // Res for response
-    BL_State_FWLengthReq,       // Req for request
-    BL_State_FWLengthRes,       // Res for response
-    BL_State_EraseApplication,
-    BL_State_ReceiveFirmware,
-    BL_State_Done,
-} bl_state_t;
-
-static bl_state_t state = BL_State_Sync;
-static uint32_t fw_length = 0;
-static uint32_t bytes_written = 0; // Number of firmware update bytes the had been written to flash. To know where our next write goes
-static uint8_t sync_seq[4] = {0};  // 4 bytes, initiated at 0
-static simple_timer_t timer;
-static comms_packet_t temp_packet;  // Will be used both to send and receive. We only do 1 of them at a time
+// msec. How long we listen for the host on a regular boot. Zero goes straight to the application. The host side updater keeps
+// sending its sync sequence until we answer, so it can catch even a short window if it's started before the reset.
+// Can be set from the command line: make BOOT_SYNC_WINDOW=500
+#ifndef BOOT_SYNC_WINDOW
+#define BOOT_SYNC_WINDOW    (0)
+#endif
+#define UPDATE_SYNC_WINDOW  (60000)     // msec. When an update was asked for, or there's no valid image
+
+// Safety check that we get link error when we are overrunning the 16 KiB we specified for the bootloader
+// const uint8_t data[0x4000] = {0};
 
 static const uint8_t secret_key[AES_BLOCK_SIZE] = {
     0x00, 0x01, 0x02, 0x03,
@@ -53,6 +39,7 @@ static const uint8_t secret_key[AES_BLOCK_SIZE] = {
     0x08, 0x09, 0x0a, 0x0b,
     0x0c, 0x0d, 0x0e, 0x0f
 };  // Right here in text in the firmware! very vulnerable
+static AES_Block_t round_keys[NUM_ROUND_KEYS_128];  // A block that represents our set of round keys. Scheduled once, before we validate anything
 
 static void gpio_setup(void) {
     rcc_periph_clock_enable(RCC_GPIOA);
@@ -82,131 +69,251 @@ static void jump_to_main(void) {
     jump_fn();
 }
 
+// The sector MACs follow the active slot's sectors. Offsets are relative to the start of a slot, so they apply to the staging slot too
+static uint32_t sector_mac_start_offset(const uint8_t index) {
+    uint8_t first_sector = 0;
+    bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS, &first_sector);
+    return bl_flash_sector_start_address(first_sector + index) - ACTIVE_SLOT_ADDRESS;
+}
+
+static uint32_t sector_mac_end_offset(const uint8_t index) {
+    uint8_t first_sector = 0;
+    bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS, &first_sector);
+    return bl_flash_sector_end_address(first_sector + index) - ACTIVE_SLOT_ADDRESS;
+}
+
 /**
- * @brief The CBC chaining operation. Take our current state (plaintext block), XOR it with the previous state (first: IV={0}, then CipherText[i]),
- * run through AES, get back out an encrypted block
+ * @brief A bitmap of the sector MAC entries an image of the given length has data in
  */
-static void aes_cbc_mac_step(AES_Block_t aes_state, AES_Block_t prev_state, const AES_Block_t *key_schedule) {
-    // XOR them together
-    for(uint8_t i =0; i < AES_BLOCK_SIZE; i++) {
-        ((uint8_t*)aes_state)[i] ^= ((uint8_t*)prev_state)[i];
+static uint8_t image_sectors(const uint32_t length) {
+    uint8_t sectors = 0;
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        if(sector_mac_start_offset(i) < length) {
+            sectors |= (1 << i);
+        }
     }
+    return sectors;
+}
 
-    AES_EncryptBlock(aes_state, key_schedule);
-    
-    // Copy whatever comes out of state into prev_state
-    memcpy(prev_state, aes_state, AES_BLOCK_SIZE);
+static void compute_sector_mac(const uint32_t slot_address, const uint8_t index, const uint32_t image_length, uint8_t out[AES_BLOCK_SIZE]) {
+    const uint32_t start = sector_mac_start_offset(index);
+    uint32_t end = sector_mac_end_offset(index);
+    if(end > image_length) { end = image_length; }
+
+    const sector_mac_header_t header = {
+        .sentinel = FWINFO_SENTINEL,
+        .index    = index,
+        .offset   = start,
+        .length   = end - start,
+    };
+    cbc_mac_t mac;
+    cbc_mac_init(&mac, round_keys);
+    cbc_mac_update(&mac, (const uint8_t*)&header, sizeof(header));
+
+    // The firmware info, the signature and the sector MAC table aren't part of the MAC of the sector they're in
+    uint32_t from = start;
+    if(from < FWINFO_OFFSET) {
+        cbc_mac_update(&mac, (const uint8_t*)(slot_address + from), FWINFO_OFFSET - from);
+        from = IMAGE_HEADER_END_OFFSET;
+    }
+    cbc_mac_update(&mac, (const uint8_t*)(slot_address + from), end - from);
+    cbc_mac_finish(&mac, out);
 }
 
-static bool validate_firmware_image(void) {
-    firmware_info_t* firmware_info_ptr = (firmware_info_t*)FWINFO_ADDRESS;
-    const uint8_t* signature = (const uint8_t*)SIGNATURE_ADDRESS;
+/**
+ * @brief Check the firmware info of the image in the slot starting at slot_address, and its signature against the sector MAC table.
+ *        Only reads the first few hundred bytes of the slot. The sectors themselves are checked by find_corrupt_sectors()
+ */
+static bool is_image_header_valid(const uint32_t slot_address) {
+    const firmware_info_t* firmware_info_ptr = (const firmware_info_t*)(slot_address + FWINFO_OFFSET);
+    const uint8_t* signature = (const uint8_t*)(slot_address + SIGNATURE_OFFSET);
 
     if(firmware_info_ptr->sentinel != FWINFO_SENTINEL) { return false; }
     if(firmware_info_ptr->device_id != DEVICE_ID) { return false; }
+    if(firmware_info_ptr->length > MAX_FW_LENGTH) { return false; }                 // Don't read past the end of the slot
+    if(firmware_info_ptr->length < IMAGE_HEADER_END_OFFSET) { return false; }       // Can't even hold the sector MAC table
+
+    // The signature is the MAC of the firmware info followed by the sector MAC table
+    cbc_mac_t mac;
+    uint8_t expected_signature[AES_BLOCK_SIZE];
+    cbc_mac_init(&mac, round_keys);
+    cbc_mac_update(&mac, (const uint8_t*)firmware_info_ptr, sizeof(firmware_info_t));
+    cbc_mac_update(&mac, (const uint8_t*)(slot_address + SECTOR_MACS_OFFSET), SECTOR_MAC_COUNT * IMAGE_MAC_SIZE);
+    cbc_mac_finish(&mac, expected_signature);
+    return memcmp(signature, expected_signature, AES_BLOCK_SIZE) == 0; // If these two match, the table can be trusted
+}
+
+/**
+ * @brief Check the sectors set in the sectors bitmap against the image's (already validated) sector MAC table
+ * @return A bitmap of the sectors that don't match. Zero if they're all fine
+ */
+static uint8_t find_corrupt_sectors(const uint32_t slot_address, const uint8_t sectors) {
+    const firmware_info_t* firmware_info_ptr = (const firmware_info_t*)(slot_address + FWINFO_OFFSET);
+    const uint8_t* sector_macs = (const uint8_t*)(slot_address + SECTOR_MACS_OFFSET);
+    uint8_t corrupt_sectors = 0;
+
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        if((sectors & (1 << i)) == 0) { continue; }
+
+        uint8_t mac[AES_BLOCK_SIZE];
+        compute_sector_mac(slot_address, i, firmware_info_ptr->length, mac);
+        if(memcmp(&sector_macs[i * IMAGE_MAC_SIZE], mac, AES_BLOCK_SIZE) != 0) {
+            corrupt_sectors |= (1 << i);
+        }
+    }
+    return corrupt_sectors;
+}
+
+/**
+ * @brief Check the whole image in the slot starting at slot_address. Both slots hold images linked to run from the active slot,
+ *        so everything is relative to the start of the slot. The time it takes goes into the stats the host can ask for
+ */
+static bool validate_firmware_image(const uint32_t slot_address) {
+    const uint64_t start_time = system_get_micros();
 
-    // // This part got redundant when AES encryption was introduced
-    // // At this point this part is valid
-    // const uint8_t* start_address = (const uint8_t*)FWINFO_VALIDATE_FROM; // A pointer to where we want to start validating from
-    // const uint32_t computed_crc = crc32(start_address, FWINFO_VALIDATE_LENGTH(firmware_info->length));
-    // return computed_crc == firmware_info->crc32;
+    bool is_valid = is_image_header_valid(slot_address);
+    if(is_valid) {
+        const firmware_info_t* firmware_info_ptr = (const firmware_info_t*)(slot_address + FWINFO_OFFSET);
+        is_valid = find_corrupt_sectors(slot_address, image_sectors(firmware_info_ptr->length)) == 0;
+    }
+
+    bl_update_add_mac_micros((uint32_t)(system_get_micros() - start_time));
+    return is_valid;
+}
 
-    AES_Block_t round_keys[NUM_ROUND_KEYS_128]; // A block that represents our set of round keys
-    AES_KeySchedule128(secret_key, round_keys); // round_keys degrades to a pointer
-    // We should have our round keys at this point
+#ifdef RAMFUNC_BENCHMARK
+// Cycle counts of the hot paths, handed to bl-update.c's stats (BL_STATS_PAGE_BENCHMARK), which fw-updater prints after an update.
+// Build with `make RAMFUNC_BENCHMARK=1` for the numbers with the hot paths in ram, and again adding RAMFUNC_IN_FLASH=1 for the same
+// numbers with everything run from flash. Flash has the ART accelerator in front of it, and ram is reached over the system bus, so
+// which one wins isn't a given. Only the AES and CRC paths are measured; the flash driver runs from flash in both builds
+#define BENCHMARK_ROUNDS    (64)
 
+static void run_benchmark(void) {
+    static uint8_t data[1024];  // In ram, so only where the code runs from differs between the two builds
     AES_Block_t aes_state = {0};
-    AES_Block_t prev_state = {0};   // IV is zeroed, and it's the first "prev_state"
-    uint8_t bytes_to_pad = 16 - (firmware_info_ptr->length % 16);
-    if(bytes_to_pad == 0) { bytes_to_pad = 16; } // Will add an extra block full of 0x10 if the last block was 16-aligned. That's standard. openssl does it
-
-    // Encoding firmware_info with 0 as the previous state
-    memcpy(aes_state, firmware_info_ptr, AES_BLOCK_SIZE);    // Copying that block (firmware_info) into state
-    aes_cbc_mac_step(aes_state, prev_state, round_keys); // Currently, prev_state is the zeroed IV
-
-    uint32_t offset = 0;
-    while(offset < firmware_info_ptr->length) {
-        // Go through the whole length of the firmware
-
-        // Are we at the point where we need to skip the info and the signature sections?
-        if( offset == (FWINFO_ADDRESS - MAIN_APP_START_ADDRESS)) {
-            // Gets us to being at the offset of FWINFO_ADDRESS
-            offset += AES_BLOCK_SIZE * 2; // Skipping two blocks: the fw info and the signature block
-            continue;
-        }
+    uint32_t start_cycles = 0;
 
-        // Are we at the last block? (we'll have to pad it/after it)
-        if(firmware_info_ptr->length - offset > AES_BLOCK_SIZE) {
-            // The regular case, not last block
-            memcpy(aes_state,(void*)(MAIN_APP_START_ADDRESS + offset), AES_BLOCK_SIZE); // Copy AES_BLCOK SIZE from flash, in that offset, into state
-            aes_cbc_mac_step(aes_state, prev_state, round_keys);                        // Run the encryption on that
-        } else {
-            // Last block, needs padding
-            if(bytes_to_pad == 16) {
-                memcpy(aes_state,(void*)(MAIN_APP_START_ADDRESS + offset), AES_BLOCK_SIZE);
-                aes_cbc_mac_step(aes_state, prev_state, round_keys);
-
-                memset(aes_state, AES_BLOCK_SIZE, AES_BLOCK_SIZE);      // The special case where we add a whole block of padding, cause we were 16-aligned
-                aes_cbc_mac_step(aes_state, prev_state, round_keys);
-            } else {
-                // Just some bytes (not 16) to be padded
-                memcpy(aes_state,(void*)(MAIN_APP_START_ADDRESS + offset), AES_BLOCK_SIZE - bytes_to_pad);
-                memset((void*)(aes_state) + (AES_BLOCK_SIZE - bytes_to_pad), bytes_to_pad, bytes_to_pad);
-                aes_cbc_mac_step(aes_state, prev_state, round_keys);
-            }
-        }
-        offset += AES_BLOCK_SIZE;
+    dwt_enable_cycle_counter();
+
+    start_cycles = dwt_read_cycle_counter();
+    for(uint32_t i = 0; i < BENCHMARK_ROUNDS; i++) {
+        AES_EncryptBlock(aes_state, round_keys);
     }
-    return memcmp(signature, aes_state, AES_BLOCK_SIZE) == 0; // If these two match, it means we're successfull
-}
+    const uint32_t aes_cycles = (dwt_read_cycle_counter() - start_cycles) / BENCHMARK_ROUNDS;     // Per block
 
-static void bootloading_fail(void) {
-    comms_create_single_byte_packet(&temp_packet, BL_PACKET_NACK_DATA0);
-    comms_write(&temp_packet);
-    state = BL_State_Done;  // Breaking out of the while loop
-}
+    start_cycles = dwt_read_cycle_counter();
+    for(uint32_t i = 0; i < BENCHMARK_ROUNDS; i++) {
+        data[0] ^= crc8(data, PACKET_LENGTH - PACKET_CRC_BYTES);
+    }
+    const uint32_t crc8_cycles = (dwt_read_cycle_counter() - start_cycles) / BENCHMARK_ROUNDS;    // Per packet
 
-static void check_for_timeout(void) {
-    if(simple_timer_has_elapsed(&timer)) {
-        bootloading_fail();
+    start_cycles = dwt_read_cycle_counter();
+    for(uint32_t i = 0; i < BENCHMARK_ROUNDS; i++) {
+        data[0] ^= crc32(data, sizeof(data));
     }
+    const uint32_t crc32_cycles = (dwt_read_cycle_counter() - start_cycles) / BENCHMARK_ROUNDS;   // Per KiB
+
+    bl_update_set_benchmark(aes_cycles, crc8_cycles, crc32_cycles);
+}
+#endif
+
+/**
+ * @brief Whether the last transfer into the staging slot completed and asked for its image to be installed. The request is taken,
+ *        so it's acted on once. A valid staged image on its own isn't enough: the active slot may have been flashed with something
+ *        newer since, over SWD say, and installing the staged image then would be a downgrade nobody asked for
+ */
+static bool take_install_request(void) {
+    bl_flash_begin();
+    const bool is_requested = progress_log_take_install_request();
+    bl_flash_end();
+    return is_requested;
 }
 
-static bool is_device_id_packet(const comms_packet_t* packet) {
-    if(packet->length != 2) { return false; }   // We expect two bytes - the first one specifies that the next one is a device id
-    if(packet->data[0] != BL_PACKET_DEVICE_ID_RES_DATA0) { return false; }
-    for(uint8_t i = 2; i < PACKET_DATA_LENGTH; i++) {
-        if(packet->data[i] != 0xff) {
-            return false;
+/**
+ * @brief Which sectors the (valid) staged image differs from the (valid) active image in. The first sector always differs, since
+ *        that's where the firmware info, the signature and the sector MAC table are
+ */
+static uint8_t find_changed_sectors(void) {
+    const uint8_t* active_macs = (const uint8_t*)(ACTIVE_SLOT_ADDRESS + SECTOR_MACS_OFFSET);
+    const uint8_t* staged_macs = (const uint8_t*)(STAGING_SLOT_ADDRESS + SECTOR_MACS_OFFSET);
+    uint8_t changed_sectors = (1 << 0);
+
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        if(memcmp(&active_macs[i * IMAGE_MAC_SIZE], &staged_macs[i * IMAGE_MAC_SIZE], IMAGE_MAC_SIZE) != 0) {
+            changed_sectors |= (1 << i);
         }
     }
-    return true;
+    return changed_sectors;
 }
 
-static bool is_fw_length_packet(const comms_packet_t* packet) {
-    if(packet->length != 5) { return false; }   // 5 bytes: the first identifies it as a fw_length packet, the other 4 are a uint32_t length
-    if(packet->data[0] != BL_PACKET_FW_LENGTH_RES_DATA0) { return false; }
-    for(uint8_t i = 5; i < PACKET_DATA_LENGTH; i++) {
-        if(packet->data[i] != 0xff) {
-            return false;
+/**
+ * @brief Copy the sectors set in the sectors bitmap from the (already validated) image in the staging slot over the active slot.
+ *        The staging slot is left as it is, so if we lose power half way through, the active slot fails validation on the next
+ *        boot and we simply copy it again
+ */
+static void install_staged_image(const uint8_t sectors) {
+    const firmware_info_t* staged_info = (const firmware_info_t*)(STAGING_SLOT_ADDRESS + FWINFO_OFFSET);
+    const uint32_t length = staged_info->length;
+
+    bl_flash_begin();
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        if((sectors & (1 << i)) == 0) { continue; }
+
+        const uint32_t start = sector_mac_start_offset(i);
+        uint32_t end = sector_mac_end_offset(i);
+        uint8_t sector = 0;
+        bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS + start, &sector);
+        bl_flash_erase_sector(sector);  // If it fails, validating the sector will tell
+
+        if(start < length) {    // A sector past the end of the new image only needs erasing
+            if(end > length) { end = length; }
+            bl_flash_write(ACTIVE_SLOT_ADDRESS + start, (const uint8_t*)(STAGING_SLOT_ADDRESS + start), end - start);
         }
     }
-    return true;
+    bl_flash_end();
+}
+
+/**
+ * @brief Which of the given sectors of the image we've just installed don't match the staged image's MACs. If the header didn't
+ *        make it across, nothing in the active slot can be trusted
+ */
+static uint8_t find_badly_installed_sectors(const uint8_t sectors) {
+    if(!is_image_header_valid(ACTIVE_SLOT_ADDRESS)) { return sectors; }
+    return find_corrupt_sectors(ACTIVE_SLOT_ADDRESS, sectors);
 }
 
 int main(void) {
     
-    // Safety check that we get link error when we are overrunning the 32 KiB we specified for the bootloader
+    // Safety check that we get link error when we are overrunning the 16 KiB we specified for the bootloader
     // volatile uint8_t x = 0;
-    // for(uint32_t i = 0; i < 0x8000; i++) { x += data[i];}
+    // for(uint32_t i = 0; i < 0x4000; i++) { x += data[i];}
     
     //volatile int x = 0;
     //x++;
 
     system_setup();
+
+    // Validating is all AES done in software, so it runs at the highest clock. The uart isn't set up yet, so nothing depends on
+    // the peripheral clocks meanwhile
+    AES_KeySchedule128(secret_key, round_keys);
+    system_set_clock_profile(System_Clock_Max);
+#ifdef RAMFUNC_BENCHMARK
+    run_benchmark();
+#endif
+    bool is_active_valid = validate_firmware_image(ACTIVE_SLOT_ADDRESS);    // Receiving an update doesn't touch the active slot
+
+    // Most of the time nobody is on the other end of the uart, and waiting for them only delays the application. We listen for as
+    // long as an update may take only when the application asked for one (it leaves a request in the mailbox and resets), or when
+    // there's nothing we could boot or install. Otherwise, for BOOT_SYNC_WINDOW at most
+    uint32_t sync_window = BOOT_SYNC_WINDOW;
+    const bool is_update_requested = boot_mailbox_take_update_request();
+    if(is_update_requested || (!is_active_valid && !validate_firmware_image(STAGING_SLOT_ADDRESS))) {
+        sync_window = UPDATE_SYNC_WINDOW;
+    }
+    system_set_clock_profile(System_Clock_Default);
+
     gpio_setup();
     uart_setup();
-    comms_setup();
     // In the setups above we're configuring GPIOs, enabling clocks to peripherals (GPIOs, UART), we set up interrupt handlers in
     // the UART, we have interrupt handlers with systick, etc. If we eventually jump to our main app program, with jump_to_main,
     // those don't magiaclly stop having being configured. Even in the main application, we could end up jumping into an ISR back
@@ -242,201 +349,54 @@ int main(void) {
     // bl_flash_write(0x08040000, data, 1024);
     // bl_flash_write(0x08060000, data, 1024);
     
-    //simple_timer_t timer2;
-    simple_timer_setup(&timer, DEFAULT_TIMEOUT, false);
-    //simple_timer_setup(&timer2, 2000, true);
-
-    while(state != BL_State_Done) {
-        // comms_update();
-        // comms_write(&packet);
-        // system_delay(500);  // msec
-
-        //// Upon boot, we'll check if anyone is trying to send us a firmware update. We'll choose to employ the systick mechanism.
-        //// After timeout, we'll just jump to the main application without updating its firmware
-        // simple_timer_t tests:
-        // if(simple_timer_has_elapsed(&timer)) {
-        //     volatile int x = 0;
-        //     x++;    // Logpoint here: "Timer elapsed"
-        // }
-
-        // if(simple_timer_has_elapsed(&timer2)) {
-        //     simple_timer_reset(&timer);
-        // }
-
-        if(state == BL_State_Sync) {
-            if(uart_data_available()) {
-                sync_seq[0] = sync_seq[1];
-                sync_seq[1] = sync_seq[2];
-                sync_seq[2] = sync_seq[3];
-                sync_seq[3] = uart_read_byte();
-
-                bool is_match = sync_seq[0] == SYNQ_SEQ_0;
-                is_match = is_match && (sync_seq[1] == SYNQ_SEQ_1);
-                is_match = is_match && (sync_seq[2] == SYNQ_SEQ_2);
-                is_match = is_match && (sync_seq[3] == SYNQ_SEQ_3);
-
-                if (is_match) {
-                    // Sync is observed
-                    comms_create_single_byte_packet(&temp_packet, BL_PACKET_SYNC_OBSERVED_DATA0);
-                    // Notify the other side
-                    comms_write(&temp_packet);
-                    // In case we didn't timeout, we also want to reset the timer for the next go-around.
-                    // We don't want to have only some amount of secs for the whole process, it might take more
-                    simple_timer_reset(&timer);
-                    state = BL_State_WaitForUpdateReq;
-                } else {
-                        check_for_timeout();
-                }
-            } else {
-                check_for_timeout();
-            }
-            continue;   // To ensure we never get to the next line (state machine) if we haven't already syncd
-        }
-        // We are assured to have already syncd
-        comms_update(); // Takes control of our UART data stream
-
-        switch (state) {
-            // BL_State_Sync: addressed above
-
-            case BL_State_WaitForUpdateReq: {
-
-                if(comms_packets_available()) {
-                    comms_read(&temp_packet);
-                    if(comms_is_single_byte_packet(&temp_packet, BL_PACKET_FW_UPDATE_REQ_DATA0)) {
-                        simple_timer_reset(&timer);
-                        // Desired situation, we can send our response
-                        comms_create_single_byte_packet(&temp_packet, BL_PACKET_FW_UPDATE_RES_DATA0);
-                        comms_write(&temp_packet);
-                        state = BL_State_DevideIDReq;
-                    } else {
-                        bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
-                    }
-                } else {
-                    check_for_timeout();
-                }
-
-            } break;
-
-            case BL_State_DevideIDReq: {
-                
-                simple_timer_reset(&timer);
-                comms_create_single_byte_packet(&temp_packet, BL_PACKET_DEVICE_ID_REQ_DATA0);
-                comms_write(&temp_packet);
-                state = BL_State_DevideIDRes;
-                
-            } break;
-
-            case BL_State_DevideIDRes: {
-
-                if(comms_packets_available()) {
-                    comms_read(&temp_packet);
-                    if(is_device_id_packet(&temp_packet) && temp_packet.data[1] == DEVICE_ID) {
-                        simple_timer_reset(&timer);
-                        // device id matched
-                        state = BL_State_FWLengthReq;
-                    } else {
-                        bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
-                    }
-                } else {
-                    check_for_timeout();
-                }
-
-                
-            } break;
-
-            case BL_State_FWLengthReq: {
-
-                simple_timer_reset(&timer);
-                comms_create_single_byte_packet(&temp_packet, BL_PACKET_FW_LENGTH_REQ_DATA0);
-                comms_write(&temp_packet);
-                state = BL_State_FWLengthRes;
-
-            } break;
-
-            case BL_State_FWLengthRes: {
-
-                if(comms_packets_available()) {
-                    comms_read(&temp_packet);
-
-                    // Length data arrives in little endian
-                    fw_length = (
-                        (temp_packet.data[1])       |
-                        (temp_packet.data[2] << 8)  |
-                        (temp_packet.data[3] << 16) |
-                        (temp_packet.data[4] << 24) 
-                    );
-
-                    if(is_fw_length_packet(&temp_packet) && fw_length <= MAX_FW_LENGTH) {
-                        // Valid fw length is accepted
-                        state = BL_State_EraseApplication;
-                    } else {
-                        bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
-                    }
-                } else {
-                    check_for_timeout();
-                }
-                
-            } break;
-
-            case BL_State_EraseApplication: {
-                bl_flash_erase_main_application();  // May take several seconds
-                comms_create_single_byte_packet(&temp_packet, BL_PACKET_READY_FOR_DATA_DATA0);
-                comms_write(&temp_packet);
-                simple_timer_reset(&timer);         // Sending a packet is a blocking operation, takes time
-                state = BL_State_ReceiveFirmware;
-            } break;
-
-            case BL_State_ReceiveFirmware: {
-                
-                if(comms_packets_available()) {
-                    comms_read(&temp_packet);
-
-                    // Writing the single packet of data into flash
-                    const uint8_t packet_length = (temp_packet.length & 0x0f) + 1;  // We represnt the length of the packet by a full byte, though 4 bits are enough
-                    bl_flash_write(MAIN_APP_START_ADDRESS + bytes_written, temp_packet.data, packet_length);
-                    bytes_written += packet_length;
-                    simple_timer_reset(&timer); // Every time we get a fresh packet we'll reset the timer
-
-                    // If we're done, send the message
-                    if(bytes_written >= fw_length) {
-                        comms_create_single_byte_packet(&temp_packet, BL_PACKET_UPDATE_SUCCESSFUL_DATA0);
-                        comms_write(&temp_packet);
-                        state = BL_State_Done;
-                    } else{
-                        // If we're not done, send that we're ready for some more data
-                        comms_create_single_byte_packet(&temp_packet, BL_PACKET_READY_FOR_DATA_DATA0);
-                        comms_write(&temp_packet);
-                    }
-
-                } else {
-                    check_for_timeout();
-                }
-
-            } break;
-
-            default: {
-                state = BL_State_Sync;  // In an unlikely invalid state
+    if(sync_window > 0) {
+        // An update over uart is received into the staging slot as well, and installed below like one the application received
+        bl_update_setup(STAGING_SLOT_ADDRESS, sync_window);
+        while(bl_update_run() == BL_Update_InProgress) {
+            // We'll check if anyone is trying to send us a firmware update. If nobody syncs with us before the window closes,
+            // or the update fails, we carry on with whatever is already in flash
+            if(bl_update_can_sleep()) {
+                system_wait_for_events();   // Until the next byte comes in, or the next tick for the timeouts
             }
-
-            // No need to address the BL_State_Done case. It's in the while loop condition
-
         }
 
+        // Before performing the teardown, we need to keep in mind that all 18 bytes of the last uart packet
+        // we're sending will be sent before we hit the teardown process. Meanwhile we keep answering the host,
+        // which asks for our stats once the update is over
+        bl_update_linger(150);  // Should be enough, without the user noticing
     }
 
     // Teardown: There are a bunch of things we set up in this "bootloader" code. We need to undo them.
-    // Before performing the teardown, we need to keep in mind that all 18 bytes of the last uart packet
-    // we're sending will be sent before we hit the teardown process. A proper way would be checking to see
-    // that we finished sending everything we wanted over uart. A bad implementation would be:
-    system_delay(150);  // Should be enough, without the user noticing
     uart_teardown();
     gpio_teardown();
-    system_teardown();
     // No comms teardown needed
-    volatile int sdfsd = 33;
-    sdfsd++;
 
-    if(validate_firmware_image()){
+    system_set_clock_profile(System_Clock_Max);    // Validating and copying images. The uart is torn down already
+    const bool is_install_requested = take_install_request();
+    if(is_install_requested || !is_active_valid) {
+        // Either a new image was staged, or the active slot is broken (e.g. we lost power while installing, after the request
+        // was taken). Install the staged image, as long as it's valid
+        if(validate_firmware_image(STAGING_SLOT_ADDRESS)) {
+            const firmware_info_t* staged_info = (const firmware_info_t*)(STAGING_SLOT_ADDRESS + FWINFO_OFFSET);
+
+            // If the active image is intact, only the sectors whose MACs changed have to be copied. The rest already match the
+            // new sector MAC table, and we've just checked them. Afterwards, only the sectors we wrote need checking again
+            uint8_t sectors = is_active_valid ? find_changed_sectors() : image_sectors(staged_info->length);
+            install_staged_image(sectors);
+            sectors &= image_sectors(staged_info->length);     // The ones past the end of the new image were only erased
+
+            uint8_t corrupt_sectors = find_badly_installed_sectors(sectors);
+            if(corrupt_sectors != 0) {
+                // The MACs tell us exactly which sectors didn't make it. One more go at just those
+                install_staged_image(corrupt_sectors);
+                corrupt_sectors = find_badly_installed_sectors(corrupt_sectors);
+            }
+            is_active_valid = (corrupt_sectors == 0);
+        }
+    }
+    system_teardown();  // Back to the default clock profile, which is what the application expects to start with
+
+    if(is_active_valid){
         jump_to_main();         // Jump to the main function in our application portion
     } else {
         // Reset the device
@@ -446,4 +406,4 @@ int main(void) {
 
     // Never return, because we're going to route our whole execution to the other "space"'s main program
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,64 @@
+#include <string.h>
+#include "cbc-mac.h"
+#include "core/trace.h"
+
+/**
+ * @brief The CBC chaining operation. XOR the plaintext block with the previous ciphertext block (first: IV={0}), run it through AES,
+ *        and keep what comes out as the "previous" block for the next one
+ */
+static void cbc_mac_step(cbc_mac_t* mac, const uint8_t* block) {
+    for(uint8_t i = 0; i < AES_BLOCK_SIZE; i++) {
+        ((uint8_t*)mac->state)[i] ^= block[i];
+    }
+    AES_EncryptBlock(mac->state, mac->key_schedule);
+}
+
+void cbc_mac_init(cbc_mac_t* mac, const AES_Block_t* key_schedule) {
+    memset(mac->state, 0, AES_BLOCK_SIZE);
+    mac->key_schedule = key_schedule;
+    mac->pending_length = 0;
+}
+
+/**
+ * @brief Feed length bytes from data into the MAC. Pieces don't have to line up with blocks. While they do (the usual case), the
+ *        data is encrypted straight from where it is, without being copied
+ */
+void cbc_mac_update(cbc_mac_t* mac, const uint8_t* data, uint32_t length) {
+    TRACE(Trace_Event_MacStart, length);
+    if(mac->pending_length > 0) {
+        const uint32_t to_copy = (length < AES_BLOCK_SIZE - mac->pending_length) ? length : (AES_BLOCK_SIZE - mac->pending_length);
+        memcpy(mac->pending + mac->pending_length, data, to_copy);
+        mac->pending_length += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if(mac->pending_length < AES_BLOCK_SIZE) {
+            TRACE(Trace_Event_MacEnd, 0);
+            return;
+        }
+        cbc_mac_step(mac, mac->pending);
+        mac->pending_length = 0;
+    }
+
+    while(length >= AES_BLOCK_SIZE) {
+        cbc_mac_step(mac, data);
+        data += AES_BLOCK_SIZE;
+        length -= AES_BLOCK_SIZE;
+    }
+
+    memcpy(mac->pending, data, length);
+    mac->pending_length = length;
+    TRACE(Trace_Event_MacEnd, 0);
+}
+
+/**
+ * @brief Pad the last block and encrypt it. A message that ends on a block boundary gets an extra block full of 0x10. That's
+ *        standard, openssl does it
+ */
+void cbc_mac_finish(cbc_mac_t* mac, uint8_t out[AES_BLOCK_SIZE]) {
+    const uint8_t bytes_to_pad = AES_BLOCK_SIZE - mac->pending_length;
+    memset(mac->pending + mac->pending_length, bytes_to_pad, bytes_to_pad);
+    cbc_mac_step(mac, mac->pending);
+    mac->pending_length = 0;
+    memcpy(out, mac->state, AES_BLOCK_SIZE);
+}
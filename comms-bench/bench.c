@@ -0,0 +1,435 @@
+// The link layer benchmark. Runs the target's own comms.c, built for the host, against a host peer that does what fw-updater does
+// (host-peer.c), over a simulated serial line that flips bits, drops, duplicates and delays bytes (channel.c). The device side moves
+// an image the way the bootloader's BL_State_ReceiveFirmware does: every packet it reads is data, and it asks for the next one.
+// Time is simulated, so a run takes milliseconds however slow the line is, and the same seed gives the same run.
+//
+// usage: comms-bench [--flip <rate>] [--drop <rate>] [--dup <rate>] [--delay <rate>:<us>] [--bytes <n>] [--baud <n>] [--latency <us>]
+//                    [--busy <us>] [--stall <ms>] [--seeds <n>] [--seed <n>]
+//
+// Rates are per bit for --flip and per byte for the rest, in both directions. Without any of them, a sweep of each kind of fault is run.
+// For each setting it prints how many runs completed, and how the rest ended: deadlock (nothing on the line and both sides waiting),
+// stall (no progress for --stall ms, e.g. retransmit requests bouncing back and forth), failed (the host gave up on an unexpected packet
+// or a NACK), bad (the device took data that isn't the image's next bytes), bkpt (comms.c hit its breakpoint). Goodput counts image
+// bytes only, retx is retransmit requests sent by both sides, and recovery is the time from a fault on the line to the device's next
+// data packet. The first run of a setting that didn't complete is described with its seed, to repeat it with --seed <n> --seeds 1.
+// Exits with 1 if any run ended bad or at a breakpoint: those are never acceptable, while the others are the update giving up
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core/comms.h"
+#include "core/uart.h"
+#include "channel.h"
+#include "host-peer.h"
+
+#define DEFAULT_IMAGE_BYTES     (16 * 1024)     // One of the small sectors
+#define DEFAULT_BAUD            (115200)
+#define DEFAULT_LATENCY         (1000)          // usec, each way. A full speed usb-serial adapter's 1 ms frame
+#define DEFAULT_BUSY            (100)           // usec the device takes to write a data packet to flash, not polling the uart meanwhile
+#define DEFAULT_STALL           (2000)          // msec without progress
+#define DEFAULT_SEEDS           (10)
+#define DEVICE_RX_BUFFER_SIZE   (128)           // RING_BUFFER_SIZE in uart.c
+#define MAX_SETTINGS            (16)
+
+typedef enum run_outcome_t {
+    Run_Completed,
+    Run_Deadlock,
+    Run_Stalled,
+    Run_Failed,
+    Run_BadData,
+    Run_Breakpoint,
+    Run_OutcomeCount,
+} run_outcome_t;
+
+static const char* const outcome_names[Run_OutcomeCount] = { "completed", "deadlock", "stall", "failed", "bad", "bkpt" };
+
+typedef struct setting_t {
+    char name[32];
+    channel_faults_t faults;
+} setting_t;
+
+typedef struct run_result_t {
+    run_outcome_t outcome;
+    const char* reason;
+    uint64_t micros;
+    uint32_t bytes_received;
+    uint32_t retx_sent;
+    uint32_t recoveries;
+    uint64_t total_recovery_micros;
+    uint64_t max_recovery_micros;
+} run_result_t;
+
+typedef struct device_t {
+    uint32_t bytes_received;
+    bool is_done;
+    bool has_response_pending;      // Written once the device is done being busy with the packet
+    uint64_t busy_until;
+    const char* bad_data;
+} device_t;
+
+static uint32_t image_bytes = DEFAULT_IMAGE_BYTES;
+static uint32_t baud = DEFAULT_BAUD;
+static uint32_t latency_micros = DEFAULT_LATENCY;
+static uint32_t busy_micros = DEFAULT_BUSY;
+static uint32_t stall_millis = DEFAULT_STALL;
+static uint32_t seed_count = DEFAULT_SEEDS;
+static uint32_t first_seed = 1;
+
+static uint8_t* image = NULL;
+static channel_t to_device;
+static channel_t to_host;
+static byte_fifo_t device_rx;
+static device_t device;
+static host_peer_t host;
+static uint32_t breakpoint_hits = 0;
+
+// comms.c's uart, the device's end of the line
+void uart_write(uint8_t* data, const uint32_t length) {
+    channel_write(&to_host, data, length);
+}
+
+bool uart_data_available(void) {
+    return device_rx.count > 0;
+}
+
+uint8_t uart_read_byte(void) {
+    return byte_fifo_pop(&device_rx);
+}
+
+void host_breakpoint(void) {
+    breakpoint_hits++;
+}
+
+static void device_respond(void) {
+    comms_packet_t packet;
+    const uint8_t response = (device.bytes_received >= image_bytes) ? BL_PACKET_UPDATE_SUCCESSFUL_DATA0 : BL_PACKET_READY_FOR_DATA_DATA0;
+    comms_create_single_byte_packet(&packet, response);
+    comms_write(&packet);
+    device.is_done = (response == BL_PACKET_UPDATE_SUCCESSFUL_DATA0);
+    device.has_response_pending = false;
+}
+
+/**
+ * @brief What the bootloader's main loop does while receiving: comms_update(), then every packet is taken as the next piece of the
+ *        image. Returns true if the device took one
+ */
+static bool device_update(const uint64_t now) {
+    if(now < device.busy_until) {
+        return false;
+    }
+    if(device.has_response_pending) {
+        device_respond();
+    }
+
+    comms_update();
+
+    bool made_progress = false;
+    while(comms_packets_available() && device.bad_data == NULL) {
+        comms_packet_t packet;
+        comms_read(&packet);
+        const uint32_t length = (packet.length & 0x0f) + 1;
+        const uint32_t offset = device.bytes_received;
+        if(offset + length > image_bytes || memcmp(packet.data, &image[offset], length) != 0) {
+            const bool is_repeat = offset >= length && memcmp(packet.data, &image[offset - length], length) == 0;
+            device.bad_data = is_repeat ? "the previous data packet again" : "data that isn't the image's";
+            break;
+        }
+        device.bytes_received += length;
+        device.busy_until = now + busy_micros;
+        device.has_response_pending = true;
+        made_progress = true;
+    }
+    return made_progress;
+}
+
+static void record_recovery(run_result_t* result, const uint64_t micros) {
+    result->recoveries++;
+    result->total_recovery_micros += micros;
+    if(micros > result->max_recovery_micros) {
+        result->max_recovery_micros = micros;
+    }
+}
+
+static uint64_t latest_fault_time(void) {
+    const uint64_t a = to_device.last_fault_time;
+    const uint64_t b = to_host.last_fault_time;
+    if(a == CHANNEL_NEVER) { return b; }
+    if(b == CHANNEL_NEVER) { return a; }
+    return (a > b) ? a : b;
+}
+
+static run_result_t run(const setting_t* setting, const uint32_t seed) {
+    run_result_t result = { .outcome = Run_Completed, .reason = "" };
+
+    channel_setup(&to_device, &setting->faults, baud, latency_micros, seed * 2);
+    channel_setup(&to_host, &setting->faults, baud, latency_micros, seed * 2 + 1);
+    byte_fifo_setup(&device_rx, DEVICE_RX_BUFFER_SIZE);
+    device = (device_t){ .has_response_pending = true };  // The bootloader asks for the first packet unprompted
+    host_peer_setup(&host, &to_device, image, image_bytes);
+    breakpoint_hits = 0;
+
+    comms_setup();
+    const comms_stats_t device_stats_before = *comms_get_stats();
+
+    uint64_t now = 0;
+    uint64_t last_progress = 0;
+    uint64_t unrecovered_fault = CHANNEL_NEVER;     // The first fault since the last progress
+    while(1) {
+        channel_deliver(&to_device, now, &device_rx);
+        channel_deliver(&to_host, now, &host.rx);
+
+        const bool made_progress = device_update(now);
+        host_peer_update(&host);
+
+        channel_transmit(&to_device, now);
+        channel_transmit(&to_host, now);
+
+        const uint64_t fault_time = latest_fault_time();
+        if(fault_time != CHANNEL_NEVER && unrecovered_fault == CHANNEL_NEVER && fault_time >= last_progress) {
+            unrecovered_fault = fault_time;
+        }
+        if(made_progress) {
+            if(unrecovered_fault != CHANNEL_NEVER && unrecovered_fault < now) {     // A fault at this very moment came after the progress
+                record_recovery(&result, now - unrecovered_fault);
+                unrecovered_fault = CHANNEL_NEVER;
+            }
+            last_progress = now;
+        }
+
+        if(breakpoint_hits > 0) {
+            result.outcome = Run_Breakpoint;
+            result.reason = "packet buffer overflow in comms_update()";
+            break;
+        }
+        if(device.bad_data != NULL) {
+            result.outcome = Run_BadData;
+            result.reason = device.bad_data;
+            break;
+        }
+        if(host.state == Host_Peer_Failed) {
+            result.outcome = Run_Failed;
+            result.reason = host.failure;
+            break;
+        }
+        if(host.state == Host_Peer_Done && device.is_done) {
+            break;
+        }
+
+        uint64_t next = channel_next_event(&to_device);
+        const uint64_t next_to_host = channel_next_event(&to_host);
+        if(next_to_host < next) { next = next_to_host; }
+        if(device.busy_until > now && device.busy_until < next) { next = device.busy_until; }
+
+        if(next == CHANNEL_NEVER) {
+            result.outcome = Run_Deadlock;
+            result.reason = device.has_response_pending ? "the device has a response it can't send" : "both sides waiting, nothing on the line";
+            break;
+        }
+        if(next - last_progress > (uint64_t)stall_millis * 1000) {
+            now = last_progress + (uint64_t)stall_millis * 1000;
+            result.outcome = Run_Stalled;
+            result.reason = (host.offset < image_bytes) ? "host waiting for ready for data" : "host waiting for update successful";
+            break;
+        }
+        now = (next > now) ? next : now + 1;
+    }
+
+    const comms_stats_t* device_stats = comms_get_stats();
+    result.micros = now;
+    result.bytes_received = device.bytes_received;
+    result.retx_sent = host.stats.crc_failures + (device_stats->crc_failures - device_stats_before.crc_failures);
+    return result;
+}
+
+static void run_setting(const setting_t* setting, bool* has_violations) {
+    uint32_t outcomes[Run_OutcomeCount] = { 0 };
+    double total_goodput = 0;
+    double min_goodput = 0;
+    uint64_t total_retx = 0;
+    uint64_t recoveries = 0;
+    uint64_t total_recovery_micros = 0;
+    uint64_t max_recovery_micros = 0;
+    bool has_described_failure = false;
+    char failure[160] = "";
+
+    for(uint32_t seed = first_seed; seed < first_seed + seed_count; seed++) {
+        const run_result_t result = run(setting, seed);
+        outcomes[result.outcome]++;
+        total_retx += result.retx_sent;
+        recoveries += result.recoveries;
+        total_recovery_micros += result.total_recovery_micros;
+        if(result.max_recovery_micros > max_recovery_micros) {
+            max_recovery_micros = result.max_recovery_micros;
+        }
+
+        if(result.outcome == Run_Completed) {
+            const double goodput = (double)image_bytes * 1000000.0 / (double)result.micros;
+            total_goodput += goodput;
+            if(outcomes[Run_Completed] == 1 || goodput < min_goodput) {
+                min_goodput = goodput;
+            }
+        } else if(!has_described_failure) {
+            snprintf(failure, sizeof(failure), "  seed %u: %s at %.1f ms, %u/%u bytes (%s)", seed, outcome_names[result.outcome],
+                     (double)result.micros / 1000.0, result.bytes_received, image_bytes, result.reason);
+            has_described_failure = true;
+        }
+        if(result.outcome == Run_BadData || result.outcome == Run_Breakpoint) {
+            *has_violations = true;
+        }
+    }
+
+    const uint32_t completed = outcomes[Run_Completed];
+    printf("%-20s %5u %5u %5u %5u %5u %5u %5u", setting->name, seed_count, completed, outcomes[Run_Deadlock], outcomes[Run_Stalled],
+           outcomes[Run_Failed], outcomes[Run_BadData], outcomes[Run_Breakpoint]);
+    if(completed > 0) {
+        printf(" %8.0f %8.0f", total_goodput / completed, min_goodput);
+    } else {
+        printf(" %8s %8s", "-", "-");
+    }
+    printf(" %9.1f", (double)total_retx / seed_count);
+    if(recoveries > 0) {
+        printf(" %8.2f %8.2f\n", (double)total_recovery_micros / recoveries / 1000.0, (double)max_recovery_micros / 1000.0);
+    } else {
+        printf(" %8s %8s\n", "-", "-");
+    }
+    if(has_described_failure) {
+        printf("%s\n", failure);
+    }
+}
+
+static void add_setting(setting_t* settings, uint32_t* count, const char* name, const channel_faults_t faults) {
+    if(*count >= MAX_SETTINGS) {
+        return;
+    }
+    snprintf(settings[*count].name, sizeof(settings[*count].name), "%s", name);
+    settings[*count].faults = faults;
+    (*count)++;
+}
+
+static uint32_t default_sweep(setting_t* settings) {
+    uint32_t count = 0;
+    add_setting(settings, &count, "clean",            (channel_faults_t){ 0 });
+    add_setting(settings, &count, "flip 1e-6",        (channel_faults_t){ .bit_flip_rate = 1e-6 });
+    add_setting(settings, &count, "flip 1e-5",        (channel_faults_t){ .bit_flip_rate = 1e-5 });
+    add_setting(settings, &count, "flip 1e-4",        (channel_faults_t){ .bit_flip_rate = 1e-4 });
+    add_setting(settings, &count, "flip 1e-3",        (channel_faults_t){ .bit_flip_rate = 1e-3 });
+    add_setting(settings, &count, "drop 1e-5",        (channel_faults_t){ .drop_rate = 1e-5 });
+    add_setting(settings, &count, "drop 1e-4",        (channel_faults_t){ .drop_rate = 1e-4 });
+    add_setting(settings, &count, "dup 1e-5",         (channel_faults_t){ .duplicate_rate = 1e-5 });
+    add_setting(settings, &count, "dup 1e-4",         (channel_faults_t){ .duplicate_rate = 1e-4 });
+    add_setting(settings, &count, "delay 1e-3:2ms",   (channel_faults_t){ .delay_rate = 1e-3, .delay_micros = 2000 });
+    add_setting(settings, &count, "delay 1e-3:20ms",  (channel_faults_t){ .delay_rate = 1e-3, .delay_micros = 20000 });
+    return count;
+}
+
+static void usage(void) {
+    printf("usage: comms-bench [--flip <rate>] [--drop <rate>] [--dup <rate>] [--delay <rate>:<us>] [--bytes <n>] [--baud <n>]\n"
+           "                   [--latency <us>] [--busy <us>] [--stall <ms>] [--seeds <n>] [--seed <n>]\n");
+    exit(1);
+}
+
+static uint32_t parse_count(const char* text) {
+    char* end = NULL;
+    const unsigned long value = strtoul(text, &end, 0);
+    if(end == text || *end != '\0') {
+        usage();
+    }
+    return (uint32_t)value;
+}
+
+static double parse_rate(const char* text, char** end) {
+    const double value = strtod(text, end);
+    if(*end == text || value < 0 || value > 1) {
+        usage();
+    }
+    return value;
+}
+
+int main(int argc, char** argv) {
+    channel_faults_t faults = { 0 };
+    bool has_faults = false;
+    for(int i = 1; i < argc; i++) {
+        if(i + 1 >= argc) {
+            usage();
+        }
+        const char* option = argv[i];
+        const char* value = argv[++i];
+        char* end = NULL;
+        if(strcmp(option, "--flip") == 0) {
+            faults.bit_flip_rate = parse_rate(value, &end);
+            has_faults = true;
+        } else if(strcmp(option, "--drop") == 0) {
+            faults.drop_rate = parse_rate(value, &end);
+            has_faults = true;
+        } else if(strcmp(option, "--dup") == 0) {
+            faults.duplicate_rate = parse_rate(value, &end);
+            has_faults = true;
+        } else if(strcmp(option, "--delay") == 0) {
+            faults.delay_rate = parse_rate(value, &end);
+            if(*end != ':') {
+                usage();
+            }
+            faults.delay_micros = parse_count(end + 1);
+            has_faults = true;
+        } else if(strcmp(option, "--bytes") == 0) {
+            image_bytes = parse_count(value);
+        } else if(strcmp(option, "--baud") == 0) {
+            baud = parse_count(value);
+        } else if(strcmp(option, "--latency") == 0) {
+            latency_micros = parse_count(value);
+        } else if(strcmp(option, "--busy") == 0) {
+            busy_micros = parse_count(value);
+        } else if(strcmp(option, "--stall") == 0) {
+            stall_millis = parse_count(value);
+        } else if(strcmp(option, "--seeds") == 0) {
+            seed_count = parse_count(value);
+        } else if(strcmp(option, "--seed") == 0) {
+            first_seed = parse_count(value);
+        } else {
+            usage();
+        }
+    }
+    if(image_bytes == 0 || baud == 0 || seed_count == 0 || stall_millis == 0) {
+        usage();
+    }
+
+    // Any content will do, as long as a repeated or misplaced packet doesn't look right by chance
+    image = malloc(image_bytes);
+    if(image == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    uint32_t x = 0x12345678;
+    for(uint32_t i = 0; i < image_bytes; i++) {
+        x = x * 1664525 + 1013904223;
+        image[i] = (uint8_t)(x >> 24);
+    }
+
+    setting_t settings[MAX_SETTINGS];
+    uint32_t setting_count = 0;
+    if(has_faults) {
+        add_setting(settings, &setting_count, "custom", faults);
+    } else {
+        setting_count = default_sweep(settings);
+    }
+
+    // Per data packet: the host's ack and the data packet go one way, the device's ack and ready for data the other, each pair back
+    // to back, and each way takes the latency on top. The device writes the data while its ack goes out, so only a longer write adds
+    const double byte_micros = 10.0 * 1000000.0 / baud;
+    const double ack_micros = PACKET_LENGTH * byte_micros;
+    const double packet_micros = 2 * (2 * PACKET_LENGTH * byte_micros + latency_micros) + ((busy_micros > ack_micros) ? busy_micros - ack_micros : 0);
+    const double ideal = PACKET_DATA_LENGTH * 1000000.0 / packet_micros;
+    printf("%u byte image, %u baud (%.0f bytes/s raw), %u us latency each way, %u us busy per packet, %u seeds from %u\n",
+           image_bytes, baud, 1000000.0 / byte_micros, latency_micros, busy_micros, seed_count, first_seed);
+    printf("Stop-and-wait ceiling: about %.0f bytes/s of image\n\n", ideal);
+    printf("%-20s %5s %5s %5s %5s %5s %5s %5s %8s %8s %9s %8s %8s\n", "setting", "runs", "ok", "dead", "stall", "fail", "bad", "bkpt",
+           "B/s", "min B/s", "retx/run", "rec ms", "max ms");
+
+    bool has_violations = false;
+    for(uint32_t i = 0; i < setting_count; i++) {
+        run_setting(&settings[i], &has_violations);
+    }
+
+    free(image);
+    return has_violations ? 1 : 0;
+}
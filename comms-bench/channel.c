@@ -0,0 +1,139 @@
+#include "channel.h"
+
+#define BITS_PER_BYTE_ON_WIRE   (10)    // 8N1: a start bit, 8 data bits and a stop bit
+
+void byte_fifo_setup(byte_fifo_t* fifo, const uint32_t capacity) {
+    fifo->capacity = (capacity < BYTE_FIFO_SIZE) ? capacity : BYTE_FIFO_SIZE;
+    fifo->read_index = 0;
+    fifo->count = 0;
+    fifo->drops = 0;
+}
+
+bool byte_fifo_push(byte_fifo_t* fifo, const uint8_t byte) {
+    if(fifo->count >= fifo->capacity) {
+        fifo->drops++;
+        return false;
+    }
+    fifo->data[(fifo->read_index + fifo->count) % BYTE_FIFO_SIZE] = byte;
+    fifo->count++;
+    return true;
+}
+
+uint8_t byte_fifo_pop(byte_fifo_t* fifo) {
+    const uint8_t byte = fifo->data[fifo->read_index];
+    fifo->read_index = (fifo->read_index + 1) % BYTE_FIFO_SIZE;
+    fifo->count--;
+    return byte;
+}
+
+/**
+ * @brief xorshift64*. Each direction has its own generator, seeded per run, so a run can be repeated exactly from its seed
+ */
+static double random_unit(channel_t* channel) {
+    uint64_t x = channel->random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    channel->random_state = x;
+    return (double)((x * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static bool happens(channel_t* channel, const double rate) {
+    return (rate > 0) && (random_unit(channel) < rate);
+}
+
+void channel_setup(channel_t* channel, const channel_faults_t* faults, const uint32_t baud, const uint32_t latency_micros, const uint64_t seed) {
+    channel->faults = *faults;
+    channel->byte_micros = (BITS_PER_BYTE_ON_WIRE * 1000000 + baud - 1) / baud;
+    channel->latency_micros = latency_micros;
+    channel->random_state = seed * 0x9E3779B97F4A7C15ULL + 1;   // xorshift gets stuck on zero
+    byte_fifo_setup(&channel->tx, BYTE_FIFO_SIZE);
+    channel->in_flight_read_index = 0;
+    channel->in_flight_count = 0;
+    channel->wire_free_at = 0;
+    channel->last_arrival = 0;
+    channel->last_fault_time = CHANNEL_NEVER;
+    channel->stats = (channel_stats_t){ 0 };
+}
+
+void channel_write(channel_t* channel, const uint8_t* data, const uint32_t length) {
+    for(uint32_t i = 0; i < length; i++) {
+        byte_fifo_push(&channel->tx, data[i]);
+    }
+}
+
+static void put_in_flight(channel_t* channel, const uint8_t byte, uint64_t arrival) {
+    if(arrival < channel->last_arrival) {
+        arrival = channel->last_arrival;
+    }
+    channel->last_arrival = arrival;
+    channel->in_flight[(channel->in_flight_read_index + channel->in_flight_count) % BYTE_FIFO_SIZE] = (channel_byte_t){ byte, arrival };
+    channel->in_flight_count++;
+}
+
+/**
+ * @brief Put whatever the line is free for by now on the wire, injecting faults as it goes. The line is free again a byte time after
+ *        each byte starts, so this goes one byte at a time, and channel_next_event() says when to come back for the next one
+ */
+void channel_transmit(channel_t* channel, const uint64_t now) {
+    // Two slots, in case the byte is duplicated
+    while(channel->tx.count > 0 && channel->wire_free_at <= now && channel->in_flight_count + 2 <= BYTE_FIFO_SIZE) {
+        const channel_faults_t* faults = &channel->faults;
+        uint8_t byte = byte_fifo_pop(&channel->tx);
+        uint64_t start = now;
+        bool is_faulty = false;
+
+        if(happens(channel, faults->delay_rate)) {
+            start += faults->delay_micros;
+            channel->stats.delays++;
+            is_faulty = true;
+        }
+        for(uint8_t bit = 0; bit < 8; bit++) {
+            if(happens(channel, faults->bit_flip_rate)) {
+                byte ^= (uint8_t)(1 << bit);
+                channel->stats.bits_flipped++;
+                is_faulty = true;
+            }
+        }
+
+        const uint64_t arrival = start + channel->byte_micros + channel->latency_micros;
+        channel->wire_free_at = start + channel->byte_micros;
+        channel->stats.bytes_sent++;
+
+        if(happens(channel, faults->drop_rate)) {
+            channel->stats.bytes_dropped++;
+            is_faulty = true;
+        } else {
+            put_in_flight(channel, byte, arrival);
+            if(happens(channel, faults->duplicate_rate)) {
+                put_in_flight(channel, byte, arrival + channel->byte_micros);
+                channel->wire_free_at += channel->byte_micros;
+                channel->stats.bytes_duplicated++;
+                is_faulty = true;
+            }
+        }
+
+        if(is_faulty) {
+            channel->last_fault_time = start;
+        }
+    }
+}
+
+void channel_deliver(channel_t* channel, const uint64_t now, byte_fifo_t* receiver) {
+    while(channel->in_flight_count > 0 && channel->in_flight[channel->in_flight_read_index].arrival <= now) {
+        byte_fifo_push(receiver, channel->in_flight[channel->in_flight_read_index].byte);
+        channel->in_flight_read_index = (channel->in_flight_read_index + 1) % BYTE_FIFO_SIZE;
+        channel->in_flight_count--;
+    }
+}
+
+uint64_t channel_next_event(const channel_t* channel) {
+    uint64_t next = CHANNEL_NEVER;
+    if(channel->in_flight_count > 0) {
+        next = channel->in_flight[channel->in_flight_read_index].arrival;
+    }
+    if(channel->tx.count > 0 && channel->wire_free_at < next) {
+        next = channel->wire_free_at;
+    }
+    return next;
+}
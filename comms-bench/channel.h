@@ -0,0 +1,67 @@
+#ifndef INC_CHANNEL_H
+#define INC_CHANNEL_H
+
+#include "common-defines.h"
+
+// One direction of a simulated serial line, in simulated microseconds. Bytes written to it queue up, go out on the wire one byte
+// time after another, and arrive at the other end a fixed latency later (a usb-serial adapter's, mostly). On the way, each byte can
+// have bits flipped, be dropped, be duplicated, or hold the line up for a while, at the configured rates
+
+#define BYTE_FIFO_SIZE      (4096)
+#define CHANNEL_NEVER       (UINT64_MAX)
+
+typedef struct byte_fifo_t {
+    uint8_t data[BYTE_FIFO_SIZE];
+    uint32_t capacity;              // Up to BYTE_FIFO_SIZE. A small one stands in for the target's uart ring buffer
+    uint32_t read_index;
+    uint32_t count;
+    uint32_t drops;                 // Pushed while full
+} byte_fifo_t;
+
+typedef struct channel_faults_t {
+    double bit_flip_rate;           // Of each bit
+    double drop_rate;               // Of each byte. The byte still takes up its time on the wire
+    double duplicate_rate;          // Of each byte. The copy arrives a byte time after the original
+    double delay_rate;              // Of each byte. The line goes quiet for delay_micros before it
+    uint32_t delay_micros;
+} channel_faults_t;
+
+typedef struct channel_stats_t {
+    uint32_t bytes_sent;
+    uint32_t bits_flipped;
+    uint32_t bytes_dropped;
+    uint32_t bytes_duplicated;
+    uint32_t delays;
+} channel_stats_t;
+
+typedef struct channel_byte_t {
+    uint8_t byte;
+    uint64_t arrival;
+} channel_byte_t;
+
+typedef struct channel_t {
+    channel_faults_t faults;
+    uint32_t byte_micros;
+    uint32_t latency_micros;
+    uint64_t random_state;
+    byte_fifo_t tx;                 // Written, not on the wire yet
+    channel_byte_t in_flight[BYTE_FIFO_SIZE];
+    uint32_t in_flight_read_index;
+    uint32_t in_flight_count;
+    uint64_t wire_free_at;          // When the next byte can start
+    uint64_t last_arrival;          // Bytes can't overtake each other
+    uint64_t last_fault_time;       // When a byte last went out damaged, dropped, duplicated or late. CHANNEL_NEVER if none has
+    channel_stats_t stats;
+} channel_t;
+
+void byte_fifo_setup(byte_fifo_t* fifo, const uint32_t capacity);
+bool byte_fifo_push(byte_fifo_t* fifo, const uint8_t byte);
+uint8_t byte_fifo_pop(byte_fifo_t* fifo);          // Assumption: the fifo isn't empty
+
+void channel_setup(channel_t* channel, const channel_faults_t* faults, const uint32_t baud, const uint32_t latency_micros, const uint64_t seed);
+void channel_write(channel_t* channel, const uint8_t* data, const uint32_t length);
+void channel_transmit(channel_t* channel, const uint64_t now);                          // Doxygen style comment block in channel.c
+void channel_deliver(channel_t* channel, const uint64_t now, byte_fifo_t* receiver);    // Everything that has arrived by now
+uint64_t channel_next_event(const channel_t* channel);                                  // CHANNEL_NEVER if the line is idle
+
+#endif // INC_CHANNEL_H
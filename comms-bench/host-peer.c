@@ -0,0 +1,103 @@
+#include <string.h>
+#include "host-peer.h"
+
+static void create_packet(comms_packet_t* packet, const uint8_t length, const uint8_t* data, const uint32_t data_length) {
+    memset(packet, 0xff, sizeof(comms_packet_t));   // Padding, like the Packet constructor
+    packet->length = length;
+    memcpy(packet->data, data, data_length);
+    packet->crc = comms_compute_crc(packet);
+}
+
+static void write_packet(host_peer_t* peer, const comms_packet_t* packet) {
+    channel_write(peer->line, (const uint8_t*)packet, PACKET_LENGTH);
+    peer->last_packet = *packet;
+}
+
+static void write_single_byte_packet(host_peer_t* peer, const uint8_t byte) {
+    comms_packet_t packet;
+    create_packet(&packet, 1, &byte, 1);
+    write_packet(peer, &packet);
+}
+
+static void fail(host_peer_t* peer, const char* failure) {
+    peer->state = Host_Peer_Failed;
+    peer->failure = failure;
+}
+
+/**
+ * @brief The transfer loop's side of a packet: what run() does with what waitForSingleBytePacketAcrossErase() returns. The
+ *        benchmark's device doesn't erase, so only the packet the loop waits for is expected
+ */
+static void deliver_packet(host_peer_t* peer, const comms_packet_t* packet) {
+    if(peer->offset < peer->image_length) {
+        if(!comms_is_single_byte_packet(packet, BL_PACKET_READY_FOR_DATA_DATA0)) {
+            fail(peer, "unexpected packet, waiting for ready for data");
+            return;
+        }
+        uint32_t length = peer->image_length - peer->offset;
+        if(length > PACKET_DATA_LENGTH) {
+            length = PACKET_DATA_LENGTH;
+        }
+        comms_packet_t data_packet;
+        create_packet(&data_packet, (uint8_t)(length - 1), &peer->image[peer->offset], length);  // The length field is one less
+        write_packet(peer, &data_packet);
+        peer->offset += length;
+        return;
+    }
+
+    if(!comms_is_single_byte_packet(packet, BL_PACKET_UPDATE_SUCCESSFUL_DATA0)) {
+        fail(peer, "unexpected packet, waiting for update successful");
+        return;
+    }
+    peer->state = Host_Peer_Done;
+}
+
+static void handle_packet(host_peer_t* peer, const comms_packet_t* packet) {
+    if(comms_is_single_byte_packet(packet, PACKET_RETX_DATA0)) {
+        peer->stats.retx_requests++;
+        write_packet(peer, &peer->last_packet);
+        return;
+    }
+    if(comms_is_single_byte_packet(packet, PACKET_ACK_DATA0)) {
+        return;
+    }
+    if(comms_is_single_byte_packet(packet, BL_PACKET_NACK_DATA0)) {
+        fail(peer, "received NACK");
+        return;
+    }
+
+    write_single_byte_packet(peer, PACKET_ACK_DATA0);   // The ack goes out first, as in handlePacket()
+    deliver_packet(peer, packet);
+}
+
+void host_peer_setup(host_peer_t* peer, channel_t* line, const uint8_t* image, const uint32_t image_length) {
+    memset(peer, 0, sizeof(host_peer_t));
+    peer->line = line;
+    byte_fifo_setup(&peer->rx, BYTE_FIFO_SIZE);
+    memset(&peer->last_packet, 0xff, sizeof(comms_packet_t));   // new Packet(1, Buffer.from([0xff]))
+    peer->last_packet.length = 1;
+    peer->last_packet.crc = comms_compute_crc(&peer->last_packet);
+    peer->image = image;
+    peer->image_length = image_length;
+    peer->state = Host_Peer_Transferring;
+}
+
+void host_peer_update(host_peer_t* peer) {
+    while(peer->rx.count > 0 && peer->state == Host_Peer_Transferring) {
+        peer->rx_buffer[peer->rx_length++] = byte_fifo_pop(&peer->rx);
+        if(peer->rx_length < PACKET_LENGTH) {
+            continue;
+        }
+        peer->rx_length = 0;
+
+        comms_packet_t packet;
+        memcpy(&packet, peer->rx_buffer, PACKET_LENGTH);
+        if(packet.crc != comms_compute_crc(&packet)) {
+            peer->stats.crc_failures++;
+            write_single_byte_packet(peer, PACKET_RETX_DATA0);
+            continue;
+        }
+        peer->stats.packets_received++;
+        handle_packet(peer, &packet);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef INC_HOST_PEER_H
+#define INC_HOST_PEER_H
+
+#include "core/comms.h"
+#include "channel.h"
+
+// The host's side of the link, as fw-updater/index.ts does it: 18 bytes at a time off the serial port, a retransmit request for a
+// bad crc, the last packet again for a retransmit request, and an ack for every other packet before it's handled. On top of that,
+// the transfer loop: one data packet for every BL_PACKET_READY_FOR_DATA_DATA0, until BL_PACKET_UPDATE_SUCCESSFUL_DATA0. Anything
+// else fails the session, as it fails the updater. Keep this in step with UpdateSession's receive() and handlePacket()
+
+typedef enum host_peer_state_t {
+    Host_Peer_Transferring,
+    Host_Peer_Done,
+    Host_Peer_Failed,
+} host_peer_state_t;
+
+typedef struct host_peer_stats_t {
+    uint32_t packets_received;      // With a valid crc
+    uint32_t crc_failures;          // Each one answered with a retransmit request
+    uint32_t retx_requests;         // The device asking us to retransmit
+} host_peer_stats_t;
+
+typedef struct host_peer_t {
+    channel_t* line;                // To the device
+    byte_fifo_t rx;                 // From the device. The channel delivers into it
+    uint8_t rx_buffer[PACKET_LENGTH];
+    uint32_t rx_length;
+    comms_packet_t last_packet;
+    const uint8_t* image;
+    uint32_t image_length;
+    uint32_t offset;                // Of the next data packet to send
+    host_peer_state_t state;
+    const char* failure;
+    host_peer_stats_t stats;
+} host_peer_t;
+
+void host_peer_setup(host_peer_t* peer, channel_t* line, const uint8_t* image, const uint32_t image_length);
+void host_peer_update(host_peer_t* peer);  // Handle everything received so far
+
+#endif // INC_HOST_PEER_H
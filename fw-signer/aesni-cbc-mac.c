@@ -0,0 +1,122 @@
+#include <string.h>
+#include "aesni-cbc-mac.h"
+
+#if defined(__x86_64__)
+
+#include <wmmintrin.h>
+
+// Only these functions are built for AES-NI, so the rest of the tool still runs on a CPU without it
+#define AESNI_TARGET __attribute__ ((target("aes,sse2")))
+
+bool aesni_is_available(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+}
+
+// Each round key is the last one with its words XORed together running left to right, and XORed with the "keygen assist" word
+AESNI_TARGET static __m128i expand_round_key(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// The round constant has to be an immediate, thus a macro rather than a loop
+#define EXPAND_ROUND_KEY(keys, i, rcon) \
+    keys[i] = expand_round_key(keys[(i) - 1], _mm_aeskeygenassist_si128(keys[(i) - 1], rcon))
+
+AESNI_TARGET void aesni_key_schedule(const AES_Key128_t key, uint8_t round_keys[AESNI_ROUND_KEYS * AES_BLOCK_SIZE]) {
+    __m128i keys[AESNI_ROUND_KEYS];
+    keys[0] = _mm_loadu_si128((const __m128i*)key);
+    EXPAND_ROUND_KEY(keys, 1, 0x01);
+    EXPAND_ROUND_KEY(keys, 2, 0x02);
+    EXPAND_ROUND_KEY(keys, 3, 0x04);
+    EXPAND_ROUND_KEY(keys, 4, 0x08);
+    EXPAND_ROUND_KEY(keys, 5, 0x10);
+    EXPAND_ROUND_KEY(keys, 6, 0x20);
+    EXPAND_ROUND_KEY(keys, 7, 0x40);
+    EXPAND_ROUND_KEY(keys, 8, 0x80);
+    EXPAND_ROUND_KEY(keys, 9, 0x1b);
+    EXPAND_ROUND_KEY(keys, 10, 0x36);
+    for(uint8_t i = 0; i < AESNI_ROUND_KEYS; i++) {
+        _mm_storeu_si128((__m128i*)&round_keys[i * AES_BLOCK_SIZE], keys[i]);
+    }
+}
+
+/**
+ * @brief Chain length bytes (a multiple of the block size) into the state. The state stays in a register for the whole run
+ */
+AESNI_TARGET static void encrypt_blocks(aesni_cbc_mac_t* mac, const uint8_t* data, const uint32_t length) {
+    __m128i keys[AESNI_ROUND_KEYS];
+    for(uint8_t i = 0; i < AESNI_ROUND_KEYS; i++) {
+        keys[i] = _mm_loadu_si128((const __m128i*)&mac->round_keys[i * AES_BLOCK_SIZE]);
+    }
+
+    __m128i state = _mm_loadu_si128((const __m128i*)mac->state);
+    for(uint32_t offset = 0; offset < length; offset += AES_BLOCK_SIZE) {
+        state = _mm_xor_si128(state, _mm_loadu_si128((const __m128i*)&data[offset]));
+        state = _mm_xor_si128(state, keys[0]);
+        for(uint8_t i = 1; i < AESNI_ROUND_KEYS - 1; i++) {
+            state = _mm_aesenc_si128(state, keys[i]);
+        }
+        state = _mm_aesenclast_si128(state, keys[AESNI_ROUND_KEYS - 1]);
+    }
+    _mm_storeu_si128((__m128i*)mac->state, state);
+}
+
+#else
+
+bool aesni_is_available(void) {
+    return false;
+}
+
+void aesni_key_schedule(const AES_Key128_t key, uint8_t round_keys[AESNI_ROUND_KEYS * AES_BLOCK_SIZE]) {
+    (void)key;
+    memset(round_keys, 0, AESNI_ROUND_KEYS * AES_BLOCK_SIZE);
+}
+
+static void encrypt_blocks(aesni_cbc_mac_t* mac, const uint8_t* data, const uint32_t length) {
+    (void)mac;
+    (void)data;
+    (void)length;
+}
+
+#endif
+
+void aesni_cbc_mac_init(aesni_cbc_mac_t* mac, const uint8_t* round_keys) {
+    memset(mac->state, 0, AES_BLOCK_SIZE);
+    mac->round_keys = round_keys;
+    mac->pending_length = 0;
+}
+
+/**
+ * @brief Same as cbc_mac_update(): pieces don't have to line up with blocks
+ */
+void aesni_cbc_mac_update(aesni_cbc_mac_t* mac, const uint8_t* data, uint32_t length) {
+    if(mac->pending_length > 0) {
+        const uint32_t to_copy = (length < AES_BLOCK_SIZE - mac->pending_length) ? length : (AES_BLOCK_SIZE - mac->pending_length);
+        memcpy(mac->pending + mac->pending_length, data, to_copy);
+        mac->pending_length += to_copy;
+        data += to_copy;
+        length -= to_copy;
+
+        if(mac->pending_length < AES_BLOCK_SIZE) { return; }
+        encrypt_blocks(mac, mac->pending, AES_BLOCK_SIZE);
+        mac->pending_length = 0;
+    }
+
+    const uint32_t whole_blocks_length = length - (length % AES_BLOCK_SIZE);
+    encrypt_blocks(mac, data, whole_blocks_length);
+
+    memcpy(mac->pending, data + whole_blocks_length, length - whole_blocks_length);
+    mac->pending_length = length - whole_blocks_length;
+}
+
+void aesni_cbc_mac_finish(aesni_cbc_mac_t* mac, uint8_t out[AES_BLOCK_SIZE]) {
+    const uint8_t bytes_to_pad = AES_BLOCK_SIZE - mac->pending_length;
+    memset(mac->pending + mac->pending_length, bytes_to_pad, bytes_to_pad);
+    encrypt_blocks(mac, mac->pending, AES_BLOCK_SIZE);
+    mac->pending_length = 0;
+    memcpy(out, mac->state, AES_BLOCK_SIZE);
+}
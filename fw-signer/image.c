@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "image.h"
+
+static const uint32_t sector_sizes[SECTOR_MAC_COUNT] = IMAGE_SECTOR_SIZES;   // The active slot's sectors (2-5)
+
+const AES_Key128_t signing_key = {
+    0x00, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b,
+    0x0c, 0x0d, 0x0e, 0x0f
+};  // Has to match the bootloader's secret_key
+
+void write_le32(uint8_t* out, const uint32_t value) {
+    out[0] = (uint8_t)(value);
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+uint32_t read_le32(const uint8_t* in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+/**
+ * @brief Reads the whole file, minus the first bootloader_size bytes (BOOTLOADER_SIZE for firmware.bin, zero for signed.bin).
+ *        Returns NULL if it can't, or if there's nothing after the bootloader
+ */
+uint8_t* read_image(const char* filename, const uint32_t bootloader_size, uint32_t* length) {
+    FILE* f = fopen(filename, "rb");
+    if(f == NULL) { return NULL; }
+
+    fseek(f, 0, SEEK_END);
+    const long file_length = ftell(f);
+    if(file_length <= (long)bootloader_size) {
+        fclose(f);
+        return NULL;
+    }
+
+    *length = (uint32_t)(file_length - bootloader_size);
+    uint8_t* image = malloc(*length);
+    fseek(f, bootloader_size, SEEK_SET);    // Chopping off the bootloader
+    if(image != NULL && fread(image, 1, *length, f) != *length) {
+        free(image);
+        image = NULL;
+    }
+    fclose(f);
+    return image;
+}
+
+/**
+ * @brief Where sector index starts and ends in an image of the given length. False if the image doesn't reach it (its MAC is zeroed)
+ */
+bool image_sector_bounds(const uint8_t index, const uint32_t length, uint32_t* start, uint32_t* end) {
+    *start = 0;
+    for(uint8_t i = 0; i < index; i++) {
+        *start += sector_sizes[i];
+    }
+    if(*start >= length) { return false; }
+
+    *end = *start + sector_sizes[index];
+    if(*end > length) { *end = length; }
+    return true;
+}
+
+/**
+ * @brief The first block MACed for every sector, sector_mac_header_t in core/firmware-info.h
+ */
+void image_sector_mac_header(const uint8_t index, const uint32_t start, const uint32_t end, uint8_t out[AES_BLOCK_SIZE]) {
+    write_le32(&out[0], FWINFO_SENTINEL);
+    write_le32(&out[4], index);
+    write_le32(&out[8], start);
+    write_le32(&out[12], end - start);
+}
@@ -0,0 +1,26 @@
+#ifndef INC_IMAGE_H
+#define INC_IMAGE_H
+
+#include "common-defines.h"
+#include "aes.h"
+
+// The layout of a signed image, shared by the host tools. core/firmware-info.h can't be included here, it pulls in libopencm3.
+// Offsets are relative to the start of the image, once the bootloader is chopped off firmware.bin. BOOTLOADER_SIZE, SLOT_SIZE,
+// DEVICE_ID, FWINFO_SENTINEL, the firmware info's fields, SECTOR_MAC_COUNT and IMAGE_SECTOR_SIZES come from shared/protocol.json, and
+// FWINFO_OFFSET (where DEADC0DE starts) from app/firmware.elf, through generated.protocol.h
+#include "generated.protocol.h"
+
+#define SIGNATURE_OFFSET        (FWINFO_OFFSET + FWINFO_SIZE)
+#define SECTOR_MACS_OFFSET      (SIGNATURE_OFFSET + AES_BLOCK_SIZE)
+#define IMAGE_HEADER_END_OFFSET (SECTOR_MACS_OFFSET + AES_BLOCK_SIZE * SECTOR_MAC_COUNT)
+#define MAX_FW_LENGTH           (SLOT_SIZE) // Has to fit in the active slot
+
+extern const AES_Key128_t signing_key;
+
+void write_le32(uint8_t* out, const uint32_t value);
+uint32_t read_le32(const uint8_t* in);
+uint8_t* read_image(const char* filename, const uint32_t bootloader_size, uint32_t* length);   // Doxygen style comment block in image.c
+bool image_sector_bounds(const uint8_t index, const uint32_t length, uint32_t* start, uint32_t* end);
+void image_sector_mac_header(const uint8_t index, const uint32_t start, const uint32_t end, uint8_t out[AES_BLOCK_SIZE]);
+
+#endif // INC_IMAGE_H
@@ -12,12 +12,14 @@ import os
 import subprocess
 import struct
 
-BOOTLOADER_SIZE       = 0x8000
-FWINFO_OFFSET         = 0x01B0 # This is were DEADC0DE starts in firmware.bin
+# Generated by make in app/, from shared/protocol.json. FWINFO_OFFSET, where DEADC0DE starts, is taken from firmware.elf
+from generated_protocol import BOOTLOADER_SIZE, FWINFO_OFFSET, FWINFO_SIZE, FWINFO_VERSION_OFFSET, FWINFO_LENGTH_OFFSET, FWINFO_SENTINEL, IMAGE_SECTOR_SIZES, SLOT_SIZE
+
 AES_BLOCK_SIZE        = 16
-FWINFO_VERSION_OFFSET = 8  # According to how the fiels in the firmware_info_t struct are ordered
-FWINFO_LENGTH_OFFSET  = 12 # According to how the fiels in the firmware_info_t struct are ordered
-SIGNATURE_OFFSET      = FWINFO_OFFSET + AES_BLOCK_SIZE
+SIGNATURE_OFFSET      = FWINFO_OFFSET + FWINFO_SIZE
+SECTOR_MACS_OFFSET    = SIGNATURE_OFFSET + AES_BLOCK_SIZE
+SECTOR_SIZES          = IMAGE_SECTOR_SIZES # The image is MACed one sector at a time
+IMAGE_HEADER_END_OFFSET = SECTOR_MACS_OFFSET + AES_BLOCK_SIZE * len(SECTOR_SIZES) # Firmware info, signature, and the table of sector MACs
 
 signing_key = "000102030405060708090a0b0c0d0e0f"
 zeroed_iv   = "00000000000000000000000000000000"
@@ -34,6 +36,11 @@ with open(sys.argv[1], "rb") as f:
     fw_image = bytearray(f.read()) # Raw firmware image that we get from the build
     f.close()
 
+# The bootloader would refuse it anyway, but only once an update is underway
+if len(fw_image) > SLOT_SIZE:
+    print(f"firmware image is {len(fw_image)} bytes, the active slot only holds {SLOT_SIZE}")
+    exit(1)
+
 # Cut out the signature secion, extract out the firmware info section, as the first block to be encrypted:
 # This part got left out eventually
 # fw_info_section = fw_image[FWINFO_ADDRESS:FWINFO_ADDRESS + AES_BLOCK_SIZE]
@@ -45,33 +52,46 @@ with open(sys.argv[1], "rb") as f:
 struct.pack_into("<I", fw_image, FWINFO_OFFSET + FWINFO_LENGTH_OFFSET, len(fw_image)) # < for little endian, I for 32-bit unsigned int
 struct.pack_into("<I", fw_image, FWINFO_OFFSET + FWINFO_VERSION_OFFSET, version_value) # < for little endian, I for 32-bit unsigned int
 
+def cbc_mac(data):
+    # On the host platform we can use openssl to do the aes-128-cbc encryption. The final block of output is our MAC !
+    # ("signature" - it doesn't comply with being a formal signature, see beginning of episode 13 of the series)
+    openssl_command = f"openssl enc -aes-128-cbc -nosalt -K {signing_key} -iv {zeroed_iv}"
+    encrypted = subprocess.run(openssl_command.split(" "), input=bytes(data), stdout=subprocess.PIPE, check=True).stdout
+    return encrypted[-AES_BLOCK_SIZE:]
+
+# Use AES-CBC with a zeroed IV to encrypt every block of the firmware:
+# There's an attack that takes advantage of non-zeroed IV, that changes with every update.
+
+# Every sector of the image gets a MAC of its own, so the bootloader can check (or find the corrupt) sectors one at a time. The first
+# block of each is the sector's index, offset and length (sector_mac_header_t), so sectors can't be swapped around or extended.
+# The firmware info, signature and the table itself are left out of the first sector, like the signature used to be left out of the
+# whole image. Sectors the image doesn't reach get a zeroed MAC
+sector_macs = bytearray()
+sector_start = 0
+for index, sector_size in enumerate(SECTOR_SIZES):
+    if sector_start < len(fw_image):
+        sector_end = min(sector_start + sector_size, len(fw_image))
+        sector_data = struct.pack("<IIII", FWINFO_SENTINEL, index, sector_start, sector_end - sector_start)
+        if sector_start < FWINFO_OFFSET:
+            sector_data += fw_image[sector_start:FWINFO_OFFSET] + fw_image[IMAGE_HEADER_END_OFFSET:sector_end]
+        else:
+            sector_data += fw_image[sector_start:sector_end]
+        sector_macs += cbc_mac(sector_data)
+    else:
+        sector_macs += bytes(AES_BLOCK_SIZE)
+    sector_start += sector_size
+
+# The signature covers the firmware info and the table of sector MACs, and through them, the whole image
 signing_image  = fw_image[FWINFO_OFFSET:FWINFO_OFFSET + AES_BLOCK_SIZE]
-signing_image += fw_image[:FWINFO_OFFSET] # That should give us the vector table, and then we skip the firmware info section
-signing_image += fw_image[FWINFO_OFFSET + AES_BLOCK_SIZE * 2:] # That should give us everything else
+signing_image += sector_macs
 
 signing_image_filename = "image_to_be_signed.bin"
-encrypted_filename     = "encrypted_image.bin"
 
 with open(signing_image_filename, "wb") as f:
     f.write(signing_image)
     f.close()
-# Checking firmware_to_be_signed.bin in ghex or any other hex editor looks good as expected
 
-# On the host platform we can use openssl to do the aes-128-cbc encryption
-openssl_command = f"openssl enc -aes-128-cbc -nosalt -K {signing_key} -iv {zeroed_iv} -in {signing_image_filename} -out {encrypted_filename}"
-# encrypted_filename isn't the MAC yet, cause that's just the last 16 bytes
-subprocess.call(openssl_command.split(" "))
-
-
-# Use AES-CBC with a zeroed IV to encrypt every block of the firmware:
-# There's an attack that takes advantage of non-zeroed IV, that changes with every update.
-
-
-# The final block of output is our MAC ! ("signature" - it doesn't comply with being a formal signature, see beginning of episode 13 of the series)
-with open(encrypted_filename, "rb") as f:
-    f.seek(-AES_BLOCK_SIZE, os.SEEK_END) # Takes us to just shy of the end
-    signature = f.read(BOOTLOADER_SIZE) # Raw firmware image that we get from the build
-    f.close()
+signature = cbc_mac(signing_image)
 
 signature_text = ""
 for byte in signature:
@@ -82,12 +102,12 @@ print(f"key      = {signing_key}")
 print(f"signature= {signature_text}") 
 
 # os.remove(signing_image_filename)
-# os.remove(encrypted_filename)
 
 # Patch the signature back into the original firmware image, accounting for the padded length of the encoded firmware. The last block is padded to 16 bytes. If it
 # was exactly 16 bytes, it'll be padded with a whole additional block
 
 fw_image[SIGNATURE_OFFSET:SIGNATURE_OFFSET + AES_BLOCK_SIZE] = signature
+fw_image[SECTOR_MACS_OFFSET:IMAGE_HEADER_END_OFFSET] = sector_macs
 
 # Create a new signed file. This is the image we can stream in over the firmware update program
 signed_filename = "signed.bin"
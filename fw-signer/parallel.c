@@ -0,0 +1,47 @@
+#define _POSIX_C_SOURCE 200809L     // For pthreads and sysconf() under -std=c99
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+
+static pthread_mutex_t next_index_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t next_index = 0;
+static uint32_t job_count = 0;
+static parallel_job_t job = NULL;
+
+static void* run_worker(void* arg) {
+    (void)arg;
+    while(true) {
+        pthread_mutex_lock(&next_index_lock);
+        const uint32_t index = next_index++;
+        pthread_mutex_unlock(&next_index_lock);
+
+        if(index >= job_count) { return NULL; }
+        job(index);
+    }
+}
+
+/**
+ * @brief Call job for every index from 0 to count - 1, on one thread per core (this one included). Each thread takes the next index
+ *        as soon as it's done with its last one, so uneven jobs still keep every core busy. Returns once they're all done
+ */
+void parallel_run(const parallel_job_t parallel_job, const uint32_t count) {
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if(thread_count > (long)count) { thread_count = (long)count; }
+    if(thread_count < 1) { thread_count = 1; }
+
+    job = parallel_job;
+    job_count = count;
+    next_index = 0;
+
+    pthread_t* threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    long started = 0;
+    while(threads != NULL && started < thread_count - 1 && pthread_create(&threads[started], NULL, run_worker, NULL) == 0) {
+        started++;
+    }
+    run_worker(NULL);   // If no thread could be started, this one does all the work
+    for(long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
@@ -0,0 +1,10 @@
+#ifndef INC_PARALLEL_H
+#define INC_PARALLEL_H
+
+#include "common-defines.h"
+
+typedef void (*parallel_job_t)(const uint32_t index);
+
+void parallel_run(const parallel_job_t parallel_job, const uint32_t count);   // Doxygen style comment block in parallel.c
+
+#endif // INC_PARALLEL_H
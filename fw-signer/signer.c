@@ -0,0 +1,334 @@
+// The native signer. Signs firmware.bin into signed.bin exactly like main.py does, byte for byte, but in a single pass over the image
+// in memory: no image_to_be_signed.bin, no openssl processes. It's built from the bootloader's own aes.c and cbc-mac.c (see the
+// Makefile), so the signer and the bootloader compute MACs with the very same code.
+//
+// usage: signer <input file> <version number hex>
+//        signer --batch <manifest> <output directory>
+//
+// The batch mode signs every (input image, device ID, version) entry of a manifest, on all of the host's cores. See sign_batch()
+
+#define _POSIX_C_SOURCE 200809L     // For strdup() under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aes.h"
+#include "cbc-mac.h"
+#include "image.h"
+#include "parallel.h"
+
+#define SIGNED_FILENAME         "signed.bin"
+#define SUMMARY_FILENAME        "summary.csv"
+#define MAX_PATH_LENGTH         (4096)
+
+static AES_Block_t key_schedule[NUM_ROUND_KEYS_128];    // Scheduled once, then only ever read, from any thread
+
+/**
+ * @brief The same MAC the bootloader's compute_sector_mac() comes up with: the sector_mac_header_t block, then the sector's data,
+ *        leaving out the firmware info, signature and sector MAC table. Sectors the image doesn't reach get a zeroed MAC
+ */
+static void compute_sector_mac(const uint8_t* image, const uint32_t length, const uint8_t index, uint8_t out[AES_BLOCK_SIZE]) {
+    uint32_t start = 0;
+    uint32_t end = 0;
+    if(!image_sector_bounds(index, length, &start, &end)) {
+        memset(out, 0, AES_BLOCK_SIZE);
+        return;
+    }
+
+    uint8_t header[AES_BLOCK_SIZE];
+    image_sector_mac_header(index, start, end, header);
+
+    cbc_mac_t mac;
+    cbc_mac_init(&mac, key_schedule);
+    cbc_mac_update(&mac, header, sizeof(header));
+
+    uint32_t from = start;
+    if(from < FWINFO_OFFSET) {
+        cbc_mac_update(&mac, image + from, FWINFO_OFFSET - from);
+        from = IMAGE_HEADER_END_OFFSET;
+    }
+    cbc_mac_update(&mac, image + from, end - from);
+    cbc_mac_finish(&mac, out);
+}
+
+/**
+ * @brief Fill in the sector MAC table, which goes straight into its place in the image. The sector MACs leave the firmware info out,
+ *        so they stay the same whatever device ID and version the image is signed for
+ */
+static void compute_sector_macs(uint8_t* image, const uint32_t length) {
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        compute_sector_mac(image, length, i, &image[SECTOR_MACS_OFFSET + i * AES_BLOCK_SIZE]);
+    }
+}
+
+/**
+ * @brief The signature covers the firmware info followed by the sector MAC table. Six blocks of AES, however long the image is
+ */
+static void compute_signature(const uint8_t fwinfo[FWINFO_SIZE], const uint8_t* sector_macs, uint8_t out[AES_BLOCK_SIZE]) {
+    cbc_mac_t mac;
+    cbc_mac_init(&mac, key_schedule);
+    cbc_mac_update(&mac, fwinfo, FWINFO_SIZE);
+    cbc_mac_update(&mac, sector_macs, SECTOR_MAC_COUNT * AES_BLOCK_SIZE);
+    cbc_mac_finish(&mac, out);
+}
+
+static void print_hex(const uint8_t* data, const uint32_t length) {
+    for(uint32_t i = 0; i < length; i++) { printf("%02x", data[i]); }
+}
+
+static int sign_single(const char* input_path, const char* version_hex) {
+    const uint32_t version = (uint32_t)strtoul(version_hex, NULL, 16);
+
+    uint32_t length = 0;
+    uint8_t* image = read_image(input_path, BOOTLOADER_SIZE, &length);
+    if(image == NULL) {
+        printf("Can't read a firmware image from %s\n", input_path);
+        return 1;
+    }
+    if(length < IMAGE_HEADER_END_OFFSET) {
+        printf("%s is too short to hold the firmware info and the sector MAC table\n", input_path);
+        free(image);
+        return 1;
+    }
+
+    write_le32(&image[FWINFO_OFFSET + FWINFO_LENGTH_OFFSET], length);
+    write_le32(&image[FWINFO_OFFSET + FWINFO_VERSION_OFFSET], version);
+    compute_sector_macs(image, length);
+    compute_signature(&image[FWINFO_OFFSET], &image[SECTOR_MACS_OFFSET], &image[SIGNATURE_OFFSET]);
+
+    printf("Signed firmware version %s\n", version_hex);
+    printf("key      = ");
+    print_hex(signing_key, AES_BLOCK_SIZE);
+    printf("\nsignature= ");
+    print_hex(&image[SIGNATURE_OFFSET], AES_BLOCK_SIZE);
+    printf("\n");
+
+    FILE* f = fopen(SIGNED_FILENAME, "wb");
+    const bool is_written = (f != NULL) && (fwrite(image, 1, length, f) == length);
+    if(f != NULL) { fclose(f); }
+    free(image);
+
+    if(!is_written) {
+        printf("Can't write %s\n", SIGNED_FILENAME);
+        return 1;
+    }
+    return 0;
+}
+
+/* Batch signing ******************************************************************************************************************/
+
+// Every distinct input image is read and MACed once, however many entries sign it. Only the firmware info, and with it the signature,
+// differ between an image's variants, so each variant costs six blocks of AES and writing its file. Both steps are spread over all
+// cores (parallel.c)
+
+typedef struct batch_input_t {
+    char* path;
+    uint8_t* image;             // With the sector MAC table filled in. NULL if it couldn't be read
+    uint32_t length;
+} batch_input_t;
+
+typedef struct batch_entry_t {
+    uint32_t line;              // In the manifest, for error messages
+    uint32_t input;             // Index into batch_inputs
+    uint32_t device_id;
+    uint32_t version;
+    char* output_path;
+    uint8_t signature[AES_BLOCK_SIZE];
+    bool is_signed;
+} batch_entry_t;
+
+static batch_input_t* batch_inputs = NULL;
+static uint32_t batch_input_count = 0;
+static uint32_t batch_input_capacity = 0;
+static batch_entry_t* batch_entries = NULL;
+static uint32_t batch_entry_count = 0;
+static uint32_t batch_entry_capacity = 0;
+
+static void load_input(const uint32_t index) {
+    batch_input_t* input = &batch_inputs[index];
+    input->image = read_image(input->path, BOOTLOADER_SIZE, &input->length);
+    if(input->image == NULL) { return; }
+
+    if(input->length < IMAGE_HEADER_END_OFFSET) {
+        free(input->image);
+        input->image = NULL;
+        return;
+    }
+    write_le32(&input->image[FWINFO_OFFSET + FWINFO_LENGTH_OFFSET], input->length);
+    compute_sector_macs(input->image, input->length);
+}
+
+/**
+ * @brief Sign one variant of an already MACed input. The image is shared with the other variants, so the header (firmware info,
+ *        signature and sector MAC table) is put together on the side, and written out in place of the image's own
+ */
+static void sign_entry(const uint32_t index) {
+    batch_entry_t* entry = &batch_entries[index];
+    const batch_input_t* input = &batch_inputs[entry->input];
+    if(input->image == NULL) { return; }
+
+    uint8_t header[IMAGE_HEADER_END_OFFSET - FWINFO_OFFSET];
+    memcpy(header, &input->image[FWINFO_OFFSET], sizeof(header));
+    write_le32(&header[FWINFO_DEVICE_ID_OFFSET], entry->device_id);
+    write_le32(&header[FWINFO_VERSION_OFFSET], entry->version);
+    compute_signature(header, &header[SECTOR_MACS_OFFSET - FWINFO_OFFSET], entry->signature);
+    memcpy(&header[SIGNATURE_OFFSET - FWINFO_OFFSET], entry->signature, AES_BLOCK_SIZE);
+
+    FILE* f = fopen(entry->output_path, "wb");
+    if(f == NULL) { return; }
+    const uint32_t rest_length = input->length - IMAGE_HEADER_END_OFFSET;
+    bool is_written = fwrite(input->image, 1, FWINFO_OFFSET, f) == FWINFO_OFFSET;
+    is_written = is_written && (fwrite(header, 1, sizeof(header), f) == sizeof(header));
+    is_written = is_written && (fwrite(&input->image[IMAGE_HEADER_END_OFFSET], 1, rest_length, f) == rest_length);
+    is_written = (fclose(f) == 0) && is_written;
+    entry->is_signed = is_written;
+}
+
+static void* grow(void* array, uint32_t* capacity, const uint32_t count, const size_t element_size) {
+    if(count < *capacity) { return array; }
+    *capacity = (*capacity == 0) ? 64 : *capacity * 2;
+    array = realloc(array, *capacity * element_size);
+    if(array == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static uint32_t find_or_add_input(const char* path) {
+    for(uint32_t i = 0; i < batch_input_count; i++) {
+        if(strcmp(batch_inputs[i].path, path) == 0) { return i; }
+    }
+    batch_inputs = grow(batch_inputs, &batch_input_capacity, batch_input_count, sizeof(batch_input_t));
+    batch_input_t* input = &batch_inputs[batch_input_count];
+    input->path = strdup(path);
+    input->image = NULL;
+    input->length = 0;
+    return batch_input_count++;
+}
+
+/**
+ * @brief One entry per line: <input file> <device id hex> <version hex>, separated by spaces or tabs. Empty lines and lines starting
+ *        with # are skipped. Every entry is signed into <output directory>/<input file name>-<device id>-<version>.bin
+ */
+static bool read_manifest(const char* manifest_path, const char* output_dir) {
+    FILE* f = fopen(manifest_path, "r");
+    if(f == NULL) {
+        printf("Can't read the manifest %s\n", manifest_path);
+        return false;
+    }
+
+    char line[MAX_PATH_LENGTH + 64];
+    uint32_t line_number = 0;
+    bool is_valid = true;
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        line_number++;
+        const char* first = line + strspn(line, " \t\r\n");
+        if(*first == '\0' || *first == '#') { continue; }
+
+        char input_path[MAX_PATH_LENGTH];
+        char device_id_hex[32];
+        char version_hex[32];
+        if(sscanf(line, "%4095s %31s %31s", input_path, device_id_hex, version_hex) != 3) {
+            printf("%s:%u: expected <input file> <device id hex> <version hex>\n", manifest_path, line_number);
+            is_valid = false;
+            continue;
+        }
+
+        batch_entries = grow(batch_entries, &batch_entry_capacity, batch_entry_count, sizeof(batch_entry_t));
+        batch_entry_t* entry = &batch_entries[batch_entry_count++];
+        entry->line = line_number;
+        entry->input = find_or_add_input(input_path);
+        entry->device_id = (uint32_t)strtoul(device_id_hex, NULL, 16);
+        entry->version = (uint32_t)strtoul(version_hex, NULL, 16);
+        entry->is_signed = false;
+
+        // Output files are named after the input file, without its directory and extension
+        const char* name = strrchr(input_path, '/');
+        name = (name != NULL) ? name + 1 : input_path;
+        const char* extension = strrchr(name, '.');
+        const int name_length = (extension != NULL && extension != name) ? (int)(extension - name) : (int)strlen(name);
+
+        const size_t output_path_size = strlen(output_dir) + (size_t)name_length + 32;
+        entry->output_path = malloc(output_path_size);
+        if(entry->output_path == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        snprintf(entry->output_path, output_path_size, "%s/%.*s-%02x-%08x.bin", output_dir, name_length, name, entry->device_id, entry->version);
+    }
+    fclose(f);
+    return is_valid;
+}
+
+/**
+ * @brief A line per entry, in the order of the manifest: output file, input file, device ID, version, length, signature
+ */
+static bool write_summary(const char* output_dir) {
+    char summary_path[MAX_PATH_LENGTH];
+    snprintf(summary_path, sizeof(summary_path), "%s/%s", output_dir, SUMMARY_FILENAME);
+    FILE* f = fopen(summary_path, "w");
+    if(f == NULL) {
+        printf("Can't write %s\n", summary_path);
+        return false;
+    }
+
+    fprintf(f, "output,input,device_id,version,length,signature\n");
+    for(uint32_t i = 0; i < batch_entry_count; i++) {
+        const batch_entry_t* entry = &batch_entries[i];
+        if(!entry->is_signed) { continue; }
+
+        fprintf(f, "%s,%s,0x%02x,0x%08x,%u,", entry->output_path, batch_inputs[entry->input].path, entry->device_id, entry->version,
+                batch_inputs[entry->input].length);
+        for(uint8_t j = 0; j < AES_BLOCK_SIZE; j++) { fprintf(f, "%02x", entry->signature[j]); }
+        fprintf(f, "\n");
+    }
+    return fclose(f) == 0;
+}
+
+/**
+ * @brief Sign every entry of the manifest into the output directory (which has to exist), and write a summary of them all next to
+ *        them. Unlike signer <input file> <version>, the device ID is set too. Every entry that fails is reported, and the rest are
+ *        still signed
+ */
+static int sign_batch(const char* manifest_path, const char* output_dir) {
+    bool is_ok = read_manifest(manifest_path, output_dir);
+
+    parallel_run(load_input, batch_input_count);
+    for(uint32_t i = 0; i < batch_input_count; i++) {
+        if(batch_inputs[i].image == NULL) {
+            printf("Can't read a firmware image from %s\n", batch_inputs[i].path);
+            is_ok = false;
+        }
+    }
+
+    parallel_run(sign_entry, batch_entry_count);
+    uint32_t signed_count = 0;
+    for(uint32_t i = 0; i < batch_entry_count; i++) {
+        const batch_entry_t* entry = &batch_entries[i];
+        if(entry->is_signed) {
+            signed_count++;
+        } else if(batch_inputs[entry->input].image != NULL) {
+            printf("%s:%u: can't write %s\n", manifest_path, entry->line, entry->output_path);
+            is_ok = false;
+        }
+    }
+
+    is_ok = write_summary(output_dir) && is_ok;
+    printf("Signed %u of %u entries (%u distinct images) into %s\n", signed_count, batch_entry_count, batch_input_count, output_dir);
+    return is_ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    AES_KeySchedule128(signing_key, key_schedule);
+
+    if(argc == 4 && strcmp(argv[1], "--batch") == 0) {
+        return sign_batch(argv[2], argv[3]);
+    }
+    if(argc < 3) {
+        printf("usage: signer <input file> <version number hex>\n");
+        printf("       signer --batch <manifest> <output directory>\n");
+        return 1;
+    }
+    return sign_single(argv[1], argv[2]);
+}
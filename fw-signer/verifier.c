@@ -0,0 +1,313 @@
+// The offline verifier. Checks signed images on the host the way the bootloader's validate_firmware_image() checks them on the
+// target, in the same order: the firmware info (sentinel, device ID, length), the signature over the firmware info and the sector MAC
+// table, and then every sector against its MAC. It also checks that the image is as long as its firmware info says, which the
+// bootloader can't (it only sees flash). Every failure comes with the reason.
+//
+// usage: verifier [--device-id <hex>] [--portable] <signed image or directory>...
+//
+// Directories are searched for *.bin files (not recursively). Images are verified in parallel on all cores. The MACs are computed on
+// the CPU's AES instructions when it has them, or with the bootloader's own aes.c and cbc-mac.c otherwise (or with --portable).
+// Exits with 1 if any image fails, so it can gate a release pipeline
+
+#define _POSIX_C_SOURCE 200809L     // For opendir(), strdup() and clock_gettime() under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "aes.h"
+#include "cbc-mac.h"
+#include "aesni-cbc-mac.h"
+#include "image.h"
+#include "parallel.h"
+
+#define MAX_REASON_LENGTH   (128)
+
+typedef struct verifier_image_t {
+    char* path;
+    uint32_t length;
+    uint32_t version;
+    bool is_valid;
+    char reason[MAX_REASON_LENGTH];     // Why it isn't valid
+} verifier_image_t;
+
+static verifier_image_t* images = NULL;
+static uint32_t image_count = 0;
+static uint32_t image_capacity = 0;
+
+static uint32_t expected_device_id = DEVICE_ID;
+static bool use_aesni = false;
+static AES_Block_t key_schedule[NUM_ROUND_KEYS_128];
+static uint8_t aesni_round_keys[AESNI_ROUND_KEYS * AES_BLOCK_SIZE];
+
+// Either MAC implementation, behind one interface
+
+typedef struct mac_t {
+    cbc_mac_t portable;
+    aesni_cbc_mac_t aesni;
+} mac_t;
+
+static void mac_init(mac_t* mac) {
+    if(use_aesni) {
+        aesni_cbc_mac_init(&mac->aesni, aesni_round_keys);
+    } else {
+        cbc_mac_init(&mac->portable, key_schedule);
+    }
+}
+
+static void mac_update(mac_t* mac, const uint8_t* data, const uint32_t length) {
+    if(use_aesni) {
+        aesni_cbc_mac_update(&mac->aesni, data, length);
+    } else {
+        cbc_mac_update(&mac->portable, data, length);
+    }
+}
+
+static void mac_finish(mac_t* mac, uint8_t out[AES_BLOCK_SIZE]) {
+    if(use_aesni) {
+        aesni_cbc_mac_finish(&mac->aesni, out);
+    } else {
+        cbc_mac_finish(&mac->portable, out);
+    }
+}
+
+/**
+ * @brief Before trusting AES-NI with a release, check that it comes up with the same MACs as the bootloader's code does, over
+ *        messages of every length up to a few blocks
+ */
+static bool is_aesni_consistent(void) {
+    uint8_t data[4 * AES_BLOCK_SIZE];
+    for(uint32_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    for(uint32_t length = 0; length <= sizeof(data); length++) {
+        uint8_t expected[AES_BLOCK_SIZE];
+        uint8_t actual[AES_BLOCK_SIZE];
+        cbc_mac_t portable;
+        aesni_cbc_mac_t aesni;
+
+        cbc_mac_init(&portable, key_schedule);
+        cbc_mac_update(&portable, data, length);
+        cbc_mac_finish(&portable, expected);
+        aesni_cbc_mac_init(&aesni, aesni_round_keys);
+        aesni_cbc_mac_update(&aesni, data, length);
+        aesni_cbc_mac_finish(&aesni, actual);
+
+        if(memcmp(expected, actual, AES_BLOCK_SIZE) != 0) { return false; }
+    }
+    return true;
+}
+
+/**
+ * @brief The bootloader's compute_sector_mac(), over the image in memory
+ */
+static void compute_sector_mac(const uint8_t* image, const uint32_t length, const uint8_t index, uint8_t out[AES_BLOCK_SIZE]) {
+    uint32_t start = 0;
+    uint32_t end = 0;
+    if(!image_sector_bounds(index, length, &start, &end)) {
+        memset(out, 0, AES_BLOCK_SIZE);
+        return;
+    }
+
+    uint8_t header[AES_BLOCK_SIZE];
+    image_sector_mac_header(index, start, end, header);
+
+    mac_t mac;
+    mac_init(&mac);
+    mac_update(&mac, header, sizeof(header));
+
+    uint32_t from = start;
+    if(from < FWINFO_OFFSET) {
+        mac_update(&mac, image + from, FWINFO_OFFSET - from);
+        from = IMAGE_HEADER_END_OFFSET;
+    }
+    mac_update(&mac, image + from, end - from);
+    mac_finish(&mac, out);
+}
+
+/**
+ * @brief The bootloader's is_image_header_valid() and find_corrupt_sectors(), in the same order. Returns NULL if the image is
+ *        valid, or the reason it isn't
+ */
+static const char* check_image(const uint8_t* image, const uint32_t file_length, char reason[MAX_REASON_LENGTH]) {
+    if(file_length < FWINFO_OFFSET + FWINFO_SIZE) {
+        return "too short to hold the firmware info";
+    }
+
+    const uint8_t* fwinfo = &image[FWINFO_OFFSET];
+    const uint32_t sentinel = read_le32(&fwinfo[FWINFO_SENTINEL_OFFSET]);
+    const uint32_t device_id = read_le32(&fwinfo[FWINFO_DEVICE_ID_OFFSET]);
+    const uint32_t length = read_le32(&fwinfo[FWINFO_LENGTH_OFFSET]);
+
+    if(sentinel != FWINFO_SENTINEL) {
+        snprintf(reason, MAX_REASON_LENGTH, "firmware info sentinel is 0x%08x, not 0x%08x", sentinel, FWINFO_SENTINEL);
+        return reason;
+    }
+    if(device_id != expected_device_id) {
+        snprintf(reason, MAX_REASON_LENGTH, "device ID is 0x%02x, not 0x%02x", device_id, expected_device_id);
+        return reason;
+    }
+    if(length > MAX_FW_LENGTH) {
+        snprintf(reason, MAX_REASON_LENGTH, "length %u doesn't fit in the active slot (%u)", length, MAX_FW_LENGTH);
+        return reason;
+    }
+    if(length < IMAGE_HEADER_END_OFFSET) {
+        snprintf(reason, MAX_REASON_LENGTH, "length %u can't hold the sector MAC table", length);
+        return reason;
+    }
+    if(length != file_length) {
+        snprintf(reason, MAX_REASON_LENGTH, "firmware info says %u bytes, the file has %u", length, file_length);
+        return reason;
+    }
+
+    uint8_t expected[AES_BLOCK_SIZE];
+    mac_t mac;
+    mac_init(&mac);
+    mac_update(&mac, fwinfo, FWINFO_SIZE);
+    mac_update(&mac, &image[SECTOR_MACS_OFFSET], SECTOR_MAC_COUNT * AES_BLOCK_SIZE);
+    mac_finish(&mac, expected);
+    if(memcmp(&image[SIGNATURE_OFFSET], expected, AES_BLOCK_SIZE) != 0) {
+        return "signature doesn't match the firmware info and sector MAC table";
+    }
+
+    for(uint8_t i = 0; i < SECTOR_MAC_COUNT; i++) {
+        uint32_t start = 0;
+        uint32_t end = 0;
+        if(!image_sector_bounds(i, length, &start, &end)) { continue; }    // The bootloader doesn't check past the image either
+
+        compute_sector_mac(image, length, i, expected);
+        if(memcmp(&image[SECTOR_MACS_OFFSET + i * AES_BLOCK_SIZE], expected, AES_BLOCK_SIZE) != 0) {
+            snprintf(reason, MAX_REASON_LENGTH, "sector %u (bytes %u to %u) doesn't match its MAC", i, start, end);
+            return reason;
+        }
+    }
+    return NULL;
+}
+
+static void verify_image(const uint32_t index) {
+    verifier_image_t* entry = &images[index];
+    uint8_t* image = read_image(entry->path, 0, &entry->length);   // Signed images don't have the bootloader in front of them
+    if(image == NULL) {
+        entry->is_valid = false;
+        snprintf(entry->reason, MAX_REASON_LENGTH, "can't read it");
+        return;
+    }
+
+    const char* reason = check_image(image, entry->length, entry->reason);
+    entry->is_valid = (reason == NULL);
+    if(reason != NULL && reason != entry->reason) {
+        snprintf(entry->reason, MAX_REASON_LENGTH, "%s", reason);
+    }
+    if(entry->length >= FWINFO_OFFSET + FWINFO_SIZE) {
+        entry->version = read_le32(&image[FWINFO_OFFSET + FWINFO_VERSION_OFFSET]);
+    }
+    free(image);
+}
+
+static void add_image(const char* path) {
+    if(image_count == image_capacity) {
+        image_capacity = (image_capacity == 0) ? 64 : image_capacity * 2;
+        images = realloc(images, image_capacity * sizeof(verifier_image_t));
+        if(images == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    verifier_image_t* entry = &images[image_count++];
+    memset(entry, 0, sizeof(verifier_image_t));
+    entry->path = strdup(path);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(((const verifier_image_t*)a)->path, ((const verifier_image_t*)b)->path);
+}
+
+/**
+ * @brief Add every *.bin file in the directory, in name order
+ */
+static void add_directory(const char* dir_path) {
+    DIR* dir = opendir(dir_path);
+    if(dir == NULL) {
+        add_image(dir_path);    // Reported as unreadable
+        return;
+    }
+
+    const uint32_t first = image_count;
+    struct dirent* dir_entry = NULL;
+    while((dir_entry = readdir(dir)) != NULL) {
+        const size_t name_length = strlen(dir_entry->d_name);
+        if(name_length < 4 || strcmp(&dir_entry->d_name[name_length - 4], ".bin") != 0) { continue; }
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, dir_entry->d_name);
+        struct stat path_stat;
+        if(stat(path, &path_stat) == 0 && S_ISREG(path_stat.st_mode)) {
+            add_image(path);
+        }
+    }
+    closedir(dir);
+    qsort(&images[first], image_count - first, sizeof(verifier_image_t), compare_paths);
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    bool is_portable = false;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--device-id") == 0 && i + 1 < argc) {
+            expected_device_id = (uint32_t)strtoul(argv[++i], NULL, 16);
+        } else if(strcmp(argv[i], "--portable") == 0) {
+            is_portable = true;
+        } else {
+            struct stat path_stat;
+            if(stat(argv[i], &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+                add_directory(argv[i]);
+            } else {
+                add_image(argv[i]);
+            }
+        }
+    }
+    if(image_count == 0) {
+        printf("usage: verifier [--device-id <hex>] [--portable] <signed image or directory>...\n");
+        return 1;
+    }
+
+    AES_KeySchedule128(signing_key, key_schedule);
+    if(!is_portable && aesni_is_available()) {
+        aesni_key_schedule(signing_key, aesni_round_keys);
+        if(!is_aesni_consistent()) {
+            printf("AES-NI MACs don't match the bootloader's. Not verifying anything\n");
+            return 2;
+        }
+        use_aesni = true;
+    }
+
+    const double start = now_seconds();
+    parallel_run(verify_image, image_count);
+    const double elapsed = now_seconds() - start;
+
+    uint32_t failed_count = 0;
+    uint64_t total_length = 0;
+    for(uint32_t i = 0; i < image_count; i++) {
+        const verifier_image_t* entry = &images[i];
+        total_length += entry->length;
+        if(entry->is_valid) {
+            printf("PASS %s (version 0x%08x, %u bytes)\n", entry->path, entry->version, entry->length);
+        } else {
+            printf("FAIL %s: %s\n", entry->path, entry->reason);
+            failed_count++;
+        }
+    }
+
+    const double megabytes = (double)total_length / (1024.0 * 1024.0);
+    printf("%u images, %u passed, %u failed. %.1f MiB in %.3f s (%.1f MiB/s, %s)\n", image_count, image_count - failed_count,
+           failed_count, megabytes, elapsed, (elapsed > 0.0) ? megabytes / elapsed : 0.0, use_aesni ? "AES-NI" : "portable AES");
+    return (failed_count == 0) ? 0 : 1;
+}
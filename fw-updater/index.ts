@@ -2,44 +2,41 @@ import * as fs from 'fs/promises';
 import * as path from 'path';
 import {SerialPort} from 'serialport';
 
-// Constants for the packet protocol
-const PACKET_LENGTH_BYTES   = 1;
-const PACKET_DATA_BYTES     = 16;
-const PACKET_CRC_BYTES      = 1;
-const PACKET_CRC_INDEX      = PACKET_LENGTH_BYTES + PACKET_DATA_BYTES;
-const PACKET_LENGTH         = PACKET_LENGTH_BYTES + PACKET_DATA_BYTES + PACKET_CRC_BYTES;
-
-const PACKET_ACK_DATA0      = 0x15;
-const PACKET_RETX_DATA0     = 0x19;
-
-// Bootloader constants
-const BL_PACKET_SYNC_OBSERVED_DATA0     = (0x20);
-const BL_PACKET_FW_UPDATE_REQ_DATA0     = (0x31);
-const BL_PACKET_FW_UPDATE_RES_DATA0     = (0x37);
-const BL_PACKET_DEVICE_ID_REQ_DATA0     = (0x3C);
-const BL_PACKET_DEVICE_ID_RES_DATA0     = (0x3F);
-const BL_PACKET_FW_LENGTH_REQ_DATA0     = (0x42);
-const BL_PACKET_FW_LENGTH_RES_DATA0     = (0x45);
-const BL_PACKET_READY_FOR_DATA_DATA0    = (0x48);
-const BL_PACKET_UPDATE_SUCCESSFUL_DATA0 = (0x54);
-const BL_PACKET_NACK_DATA0              = (0x59);
-
-const VECTOR_TABLE_SIZE                 = (0x01B0); // This is were DEADC0DE starts in firmware.bin
-
-const FWINFO_DEVICE_ID_OFFSET           = (VECTOR_TABLE_SIZE + (1 * 4));
-const FWINFO_LENGTH_OFFSET              = (VECTOR_TABLE_SIZE + (3 * 4));
-
-const SYNC_SEQ  = Buffer.from([0xc4, 0x55, 0x7e, 0x10]);
-
-const SYNC_SEQ_0  = Buffer.from([0xc4]);
-const SYNC_SEQ_1  = Buffer.from([0x55]);
-const SYNC_SEQ_2  = Buffer.from([0x7e]);
-const SYNC_SEQ_3  = Buffer.from([0x10]);
+// The packet protocol and the image layout. Generated by make in app/, from shared/protocol.json and firmware.elf (FWINFO_OFFSET)
+import {
+  PACKET_DATA_LENGTH, PACKET_LENGTH_BYTES, PACKET_LENGTH, PACKET_ACK_DATA0, PACKET_RETX_DATA0,
+  BL_PACKET_SYNC_OBSERVED_DATA0, BL_PACKET_FW_UPDATE_REQ_DATA0, BL_PACKET_FW_UPDATE_RES_DATA0, BL_PACKET_DEVICE_ID_REQ_DATA0,
+  BL_PACKET_DEVICE_ID_RES_DATA0, BL_PACKET_FW_LENGTH_REQ_DATA0, BL_PACKET_FW_LENGTH_RES_DATA0, BL_PACKET_READY_FOR_DATA_DATA0,
+  BL_PACKET_ERASE_COMPLETE_DATA0, BL_PACKET_ERASE_BUSY_DATA0, BL_PACKET_UPDATE_SUCCESSFUL_DATA0, BL_PACKET_NACK_DATA0,
+  BL_PACKET_SECTOR_DIGEST_DATA0, BL_PACKET_SECTOR_MAP_REQ_DATA0, BL_PACKET_SECTOR_MAP_RES_DATA0, BL_PACKET_IMAGE_ID_REQ_DATA0,
+  BL_PACKET_IMAGE_ID_RES_DATA0, BL_PACKET_RESUME_DATA0, BL_PACKET_STATS_REQ_DATA0, BL_PACKET_STATS_RES_DATA0,
+  BL_PACKET_TRACE_REQ_DATA0, BL_PACKET_TRACE_RES_DATA0, BL_PACKET_DIGEST_REQ_DATA0, BL_PACKET_DIGEST_RES_DATA0,
+  SYNC_SEQ as SYNC_SEQ_BYTES, FWINFO_OFFSET, FWINFO_DEVICE_ID_OFFSET, SLOT_SIZE,
+} from './generated.protocol';
+
+const PACKET_CRC_INDEX      = PACKET_LENGTH_BYTES + PACKET_DATA_LENGTH;
+
+const TRACE_RECORD_BYTES                = (9);  // In a trace dump: the event, and little-endian uint32_t's of its cycle count and argument
+
+const SYNC_SEQ  = Buffer.from(SYNC_SEQ_BYTES);
 
 const DEFAULT_TIMEOUT  = (60000);
+const SYNC_RETRY_TIMEOUT = (500);
+const ERASE_TIMEOUT_MARGIN = (1000); // On top of the erase time the bootloader asks for, to cover the link latency
+const STATS_TIMEOUT = (100);        // The device only lingers for a little while after an update, answering stats requests
+const DIGEST_TIMEOUT = (2000);      // A crc32 of a whole slot takes the device a while
+
+// What the counters on each page of the device's stats are. See BL_STATS_PAGE_ in bl-update.h
+const STATS_PAGES = [
+  { name: 'Link',   counters: ['packets received', 'crc failures', 'retransmit requests'] },
+  { name: 'Uart',   counters: ['bytes received', 'ring buffer drops', 'overruns'] },
+  { name: 'Flash',  counters: ['us erasing', 'us programming', 'words programmed'] },
+  { name: 'Update', counters: ['us computing MACs', 'ack timeouts', 'cycles max wake latency'] },
+  { name: 'Benchmark', counters: ['cycles per AES block', 'cycles per crc8 packet', 'cycles per crc32 KiB'] },
+];
 
 // Details about the serial port connection
-const serialPath            = "/dev/ttyACM0";
+const DEFAULT_SERIAL_PATH   = "/dev/ttyACM0";   // When only an image is given
 const baudRate              = 115200;
 
 // CRC8 implementation. Same as the implementation on the target machine
@@ -79,9 +76,6 @@ const crc32 = (data: Buffer, length: number) => {
   return (~crc) >>> 0;
 }
 
-// Async delay function, which gives the event loop time to process outside input
-const delay = (ms: number) => new Promise(r => setTimeout(r, ms));
-
 class Logger {
   static info(message: string) { console.log(`[.] ${message}`); }
   static success(message: string) { console.log(`[$] ${message}`); }
@@ -102,7 +96,7 @@ class Packet {
     this.length = length;
     this.data = data;
 
-    const bytesToPad = PACKET_DATA_BYTES - this.data.length;
+    const bytesToPad = PACKET_DATA_LENGTH - this.data.length;
     const padding = Buffer.alloc(bytesToPad).fill(0xff);
     this.data = Buffer.concat([this.data, padding]);  // Padding to 16 bytes
 
@@ -127,7 +121,7 @@ class Packet {
   isSingleBytePacket(byte: number) {
     if (this.length !== 1) return false;
     if (this.data[0] !== byte) return false;
-    for (let i = 1; i < PACKET_DATA_BYTES; i++) {
+    for (let i = 1; i < PACKET_DATA_LENGTH; i++) {
       if (this.data[i] !== 0xff) return false;
     }
     return true;
@@ -146,275 +140,689 @@ class Packet {
   }
 }
 
-// Serial port instance
-const uart = new SerialPort({ path: serialPath, baudRate });
-
-// Packet buffer
-// Won't implement a ring-buffer in this TypeScript file because we have automatic garbage collection and extending arrays
-let packets: Packet[] = [];
-
-let lastPacket: Packet = new Packet(1, Buffer.from([0xff]));
-const writePacket = (packet: Packet) => {
-  uart.write(packet.toBuffer());
-  //console.log(`Inside WritePackeT(). Right after uart.write(packet.toBuffer()); with packet = ${packet}`);
-  lastPacket = packet;
+// Packets that came in before anyone was waiting for them. Whoever is awaiting a packet gets handed it straight from the data
+// handler, so an await resumes as soon as the packet is in, instead of on the next turn of a polling loop
+type PacketWaiter = {
+  resolve: (packet: Packet) => void;
+  reject: (error: Error) => void;
+  timer: NodeJS.Timeout;
 };
 
-// Serial data buffer, with a splice-like function for consuming data
-let rxBuffer = Buffer.from([]);
-const consumeFromBuffer = (n: number) => {
+// Where the time of an update goes, in milliseconds. Sectors are erased in the middle of the transfer, so the time we spend waiting
+// on erases is taken out of the transfer time and counted on its own
+type PhaseTimes = { sync: number, handshake: number, transfer: number, erase: number, check: number };
+type FlashRange = { offset: number, size: number };
 
-  //const consumed = rxBuffer.slice(0, n);
-  const consumed = rxBuffer.subarray(0,n);
+const now = () => performance.now();
+const formatPacket = (packet: Packet) => [...packet.toBuffer()].map(x => x.toString(16)).join(' ');
 
-  //rxBuffer = rxBuffer.slice(n);
-  rxBuffer = rxBuffer.subarray(n);
-
-  return consumed;
-}
+// Serial data buffer size. Allocated once per port: incoming data is copied in behind what's left of the last packet, and once the
+// whole packets are taken out, the leftover bytes (less than a packet) are moved back to the front. A data event bigger than the
+// free space is taken in as several chunks
+const RX_BUFFER_SIZE = 4096;
 
-// This function fires whenever data is received over the serial port. The whole
-// packet state machine runs here.
-uart.on('data', data => {
-  
-  //console.log(`Received ${data.length} bytes through uart`);
+/**
+ * @brief Everything about updating one device: its serial port, its image, and the state of the link. Sessions don't share any
+ *        state, so any number of them can run side by side in one process. A session that fails (NACK, timeout, port closing) only
+ *        rejects its own run(); the others carry on
+ */
+class UpdateSession {
+  readonly portPath: string;
+  readonly firmwareFilename: string;
+  private readonly tag: string;   // Prefixed to every line we log, when more than one device is being updated
+  private readonly uart: SerialPort;
+
+  // Won't implement a ring-buffer in this TypeScript file because we have automatic garbage collection and extending arrays
+  private packets: Packet[] = [];
+  private packetWaiters: PacketWaiter[] = [];
+  private failure: Error | null = null;   // Once set, every wait fails with it
+
+  private lastPacket: Packet = new Packet(1, Buffer.from([0xff]));
+  private readonly rxBuffer = Buffer.alloc(RX_BUFFER_SIZE);
+  private rxLength = 0;
+
+  phaseTimes: PhaseTimes = { sync: 0, handshake: 0, transfer: 0, erase: 0, check: 0 };
+  totalEraseDuration = 0;       // As the bootloader measured it
+  private eraseStart = 0;
+  private sectorsErased = 0;    // Erase completions we've seen. The bootloader sends one again if our ack doesn't reach it in time
+  bytesWritten = 0;
+  bytesToWrite = 0;
+  done = false;
+
+  readonly traceFilename: string | null;   // Where to dump the device's trace ring after the update, if anywhere
+
+  constructor(portPath: string, firmwareFilename: string, tagged: boolean, traceFilename: string | null) {
+    this.portPath = portPath;
+    this.firmwareFilename = firmwareFilename;
+    this.traceFilename = traceFilename;
+    this.tag = tagged ? `${portPath}: ` : '';
+
+    // This function fires whenever data is received over the serial port. The whole
+    // packet state machine runs here.
+    this.uart = new SerialPort({ path: portPath, baudRate });
+    this.uart.on('data', (data: Buffer) => this.receive(data));
+    this.uart.on('error', (e: Error) => this.fail(new Error(`Serial port error: ${e.message}`)));
+    this.uart.on('close', () => this.fail(new Error('Serial port closed')));
+  }
 
-  // Add the data to the packet
-  rxBuffer = Buffer.concat([rxBuffer, data]);
+  info(message: string) { Logger.info(`${this.tag}${message}`); }
+  success(message: string) { Logger.success(`${this.tag}${message}`); }
+  error(message: string) { Logger.error(`${this.tag}${message}`); }
 
-  //console.log(`Building packet`);
+  close() {
+    this.done = true;
+    this.uart.close();
+  }
 
-  // Can we build a packet?
-  while (rxBuffer.length >= PACKET_LENGTH) {
-    const raw = consumeFromBuffer(PACKET_LENGTH); // Will give us a Node Buffer with 18 bytes in it
-    // console.log(raw);
-    
-    //const packet = new Packet(raw[0], raw.slice(1, 1+PACKET_DATA_BYTES), raw[PACKET_CRC_INDEX]);
-    const packet = new Packet(raw[0], raw.subarray(1, 1+PACKET_DATA_BYTES), raw[PACKET_CRC_INDEX]);
+  private writePacket(packet: Packet) {
+    this.uart.write(packet.toBuffer());
+    //console.log(`Inside WritePackeT(). Right after uart.write(packet.toBuffer()); with packet = ${packet}`);
+    this.lastPacket = packet;
+  }
 
-    const computedCrc = packet.computeCrc();
+  /**
+   * @brief Stop the session: whoever is waiting for a packet, and whoever waits for one from now on, gets the error
+   */
+  private fail(error: Error) {
+    if (this.done || this.failure !== null) {
+      return;
+    }
+    this.failure = error;
+    for (const waiter of this.packetWaiters.splice(0)) {
+      clearTimeout(waiter.timer);
+      waiter.reject(error);
+    }
+  }
 
-    // Need retransmission?
-    if (packet.crc !== computedCrc) {
-      // console.log(`CRC failed, computed 0x${computedCrc.toString(16)}, got 0x${packet.crc.toString(16)}`);
-      writePacket(Packet.retx);
-      continue;
+  private deliverPacket(packet: Packet) {
+    const waiter = this.packetWaiters.shift();
+    if (typeof waiter === 'undefined') {
+      this.packets.push(packet);
+      return;
     }
+    clearTimeout(waiter.timer);
+    waiter.resolve(packet);
+  }
 
+  // Handle a packet that passed its crc. Either the link layer deals with it here, or it goes to whoever is waiting for it
+  private handlePacket(packet: Packet) {
     // Are we being asked to retransmit?
     if (packet.isRetx()) {
       // console.log(`Retransmitting last packet`);
       // console.log(`Last packet:`, lastPacket);
-      writePacket(lastPacket);
-      continue;
+      this.writePacket(this.lastPacket);
+      return;
     }
 
     // If this is an ack, move on
     if (packet.isAck()) {
       //console.log(`It was an ack, nothing to do`);
-      continue;
+      return;
     }
 
-    // If this is an nack, exit the program
+    // If this is an nack, this update is over
     if (packet.isSingleBytePacket(BL_PACKET_NACK_DATA0)) {
-      Logger.error('Received NACK. Exiting...');
-      // console.log('packets', packets);
-      // console.log('uart buffer', rxBuffer);
-      process.exit(1);
+      this.fail(new Error('Received NACK'));
+      return;
     }
 
-    // Otherwise write the packet in to the buffer, and send an ack
+    // Otherwise ack it, and hand the packet on. The ack goes out first, so the target can get on with its next packet while we're
+    // still handling this one
     //console.log(`Storing packet and ack'ing`);
-    packets.push(packet);
-    writePacket(Packet.ack);
+    this.writePacket(Packet.ack);
+    this.deliverPacket(packet);
   }
-});
 
-// Function to allow us to await a packet
-const waitForPacket = async (timeout = DEFAULT_TIMEOUT) => {
-  let timeWaited = 0;
-  while (packets.length < 1) {
-    await delay(1);
-    timeWaited += 1;
+  private receive(data: Buffer) {
+    //console.log(`Received ${data.length} bytes through uart`);
+
+    let dataOffset = 0;
+    while (dataOffset < data.length) {
+      // Add the data to the buffer
+      const copied = data.copy(this.rxBuffer, this.rxLength, dataOffset);
+      this.rxLength += copied;
+      dataOffset += copied;
+
+      // Can we build a packet?
+      let rxOffset = 0;
+      while (this.rxLength - rxOffset >= PACKET_LENGTH) {
+        const raw = this.rxBuffer.subarray(rxOffset, rxOffset + PACKET_LENGTH); // 18 bytes, still in rxBuffer
+        rxOffset += PACKET_LENGTH;
+        // console.log(raw);
+
+        // The constructor copies the data out (padding it to 16 bytes), so the packet doesn't change when rxBuffer is reused
+        const packet = new Packet(raw[0], raw.subarray(1, 1+PACKET_DATA_LENGTH), raw[PACKET_CRC_INDEX]);
+
+        // Need retransmission?
+        if (packet.crc !== packet.computeCrc()) {
+          // console.log(`CRC failed, computed 0x${packet.computeCrc().toString(16)}, got 0x${packet.crc.toString(16)}`);
+          this.writePacket(Packet.retx);
+          continue;
+        }
+
+        this.handlePacket(packet);
+      }
 
-    if (timeWaited >= timeout) {
-      throw Error('Timed out waiting for packet'); // Not exiting. We might want to attemp receieve a packets
+      // Keep what's left of a partial packet
+      this.rxBuffer.copyWithin(0, rxOffset, this.rxLength);
+      this.rxLength -= rxOffset;
+    }
+  }
+
+  // Function to allow us to await a packet. Resolves as soon as the data handler has one for us
+  private waitForPacket(timeout = DEFAULT_TIMEOUT) {
+    const packet = this.packets.shift();
+    if (typeof packet !== 'undefined') {
+      return Promise.resolve(packet);
+    }
+    if (this.failure !== null) {
+      return Promise.reject(this.failure);
+    }
+
+    return new Promise<Packet>((resolve, reject) => {
+      const waiter: PacketWaiter = {
+        resolve,
+        reject,
+        timer: setTimeout(() => {
+          this.packetWaiters.splice(this.packetWaiters.indexOf(waiter), 1);
+          reject(new Error('Timed out waiting for packet')); // Not failing the session. We might want to attemp receieve a packets
+        }, timeout),
+      };
+      this.packetWaiters.push(waiter);
+    });
+  }
+
+  // For when things go wrong: what we have received but not handled yet
+  logReceiveState() {
+    console.log(`${this.tag}uart buffer:`, this.rxBuffer.subarray(0, this.rxLength));
+    console.log(`${this.tag}packets:`, this.packets);
+  }
+
+  private async waitForSingleBytePacket(byte: number, timeout = DEFAULT_TIMEOUT) {
+    const packet = await this.waitForPacket(timeout);   // When a packet comes in..
+    // Check if it's the packet we're looking for
+    if (packet.length !== 1 || packet.data[0] !== byte) {
+      throw new Error(`Unexpected packet received. Expected single byte 0x${byte.toString(16)}), got packet ${formatPacket(packet)}`);
     }
   }
-  return packets.splice(0, 1)[0];
-}
 
-const waitForSingleBytePacket = (byte: number, timeout = DEFAULT_TIMEOUT) => (
-  waitForPacket(timeout)
-    .then(packet => {   // When a packet comes in..
-      // Check if it's the packet we're looking for
-      if (packet.length !== 1 || packet.data[0] !== byte) {
-        const formattedPacket = [...packet.toBuffer()].map(x => x.toString(16)).join(' ');
-        throw new Error(`Unexpected packet received. Expected single byte 0x${byte.toString(16)}), got packet ${formattedPacket}`);
+  // Sectors are erased just in time, right before the first write into them. The bootloader lets us know when it starts
+  // erasing a sector and how long to allow for it, and again once it's done. We continue the moment the erase completes,
+  // and only allow an erase the time the bootloader asked for, instead of guessing a fixed delay
+  private async waitForSingleBytePacketAcrossErase(byte: number, timeout = DEFAULT_TIMEOUT) {
+    let packetTimeout = timeout;
+    while (true) {
+      const packet = await this.waitForPacket(packetTimeout);
+      packetTimeout = timeout;
+
+      if (packet.length === 6 && packet.data[0] === BL_PACKET_ERASE_BUSY_DATA0) {
+        const eraseTimeout = packet.data.readUInt32LE(2);
+        this.info(`Bootloader is erasing sector ${packet.data[1]}...`);
+        this.eraseStart = now();
+        packetTimeout = eraseTimeout + ERASE_TIMEOUT_MARGIN;
+        continue;
       }
-    })
-    .catch((e: Error) => {
-      Logger.error(e.message);
-      console.log(rxBuffer);
-      console.log(packets);
-      process.exit(1);
-    })
-);
 
-/**
- * @brief Observe the sync sequence: send the sync sequence and get the corresponding message back, indicating we can continue
- * @param syncDelay 
- * @param timeout 
- * @returns 
- */
-const syncWithBootloader = async (syncDelay = 500, timeout = DEFAULT_TIMEOUT) => {
-  let timeWaited = 0;
-
-  while (true) {
-    console.log("Sending SYNC_SEQ:", Buffer.from(SYNC_SEQ));
-    
-    uart.write(SYNC_SEQ);
-    // const SYNC_DELAY_MS = 600;
-    // uart.write(SYNC_SEQ_0);
-    // await delay(SYNC_DELAY_MS);
-    // uart.write(SYNC_SEQ_1);
-    // await delay(SYNC_DELAY_MS);
-    // uart.write(SYNC_SEQ_2);
-    // await delay(SYNC_DELAY_MS);
-    // uart.write(SYNC_SEQ_3);
-    // await delay(SYNC_DELAY_MS);
-
-    await delay(syncDelay); // We send a "pulse" of data. The bootloader responds to it immediately, within less than millisecs, and we'll
-                            // pick that up. The delay to assure we're not sending them constantly, and then if the bootloader recognizes
-                            // and sends one back we're already sending more bytes. If we do that, it'll mess up the syncronization we're trying
-                            // to create.
-    timeWaited += syncDelay;
-
-    if (packets.length > 0) {
-      // Being here means that there is a packet and we can retrieve it
-      const packet = packets.splice(0, 1)[0];
-      if (packet.isSingleBytePacket(BL_PACKET_SYNC_OBSERVED_DATA0)) {
-        //Logger.success('Synced');
-        return;
+      // The bootloader sends the resume packet again if our ack doesn't reach it in time, and we may have moved on already
+      if (packet.length === 5 && packet.data[0] === BL_PACKET_RESUME_DATA0) {
+        continue;
       }
-      Logger.error('Wrong packet observed during sync sequence');
-      process.exit(1);
+
+      if (packet.length === 8 && packet.data[0] === BL_PACKET_ERASE_COMPLETE_DATA0) {
+        const eraseDuration = packet.data.readUInt32LE(1);
+        const [sector, sectorsErased, sectorsTotal] = [packet.data[5], packet.data[6], packet.data[7]];
+        if (sectorsErased <= this.sectorsErased) {
+          continue;   // A repeat of one we've already counted
+        }
+        this.sectorsErased = sectorsErased;
+        this.totalEraseDuration += eraseDuration;
+        this.phaseTimes.erase += now() - this.eraseStart;
+        this.info(`Sector ${sector} erased (took ${eraseDuration} ms, ${sectorsErased}/${sectorsTotal} sectors)`);
+        continue;
+      }
+
+      if (!packet.isSingleBytePacket(byte)) {
+        throw new Error(`Unexpected packet received. Expected single byte 0x${byte.toString(16)}), got packet ${formatPacket(packet)}`);
+      }
+      return;
     }
+  }
 
-    if (timeWaited >= timeout) {
-      Logger.error('Timed out waiting for sync sequence observed');
-      process.exit(1);
+  /**
+   * @brief Observe the sync sequence: send the sync sequence and get the corresponding message back, indicating we can continue
+   * @param retryTimeout How long to wait for the bootloader to answer before sending the sequence again
+   * @param timeout 
+   * @returns 
+   */
+  private async syncWithBootloader(retryTimeout = SYNC_RETRY_TIMEOUT, timeout = DEFAULT_TIMEOUT) {
+    const start = now();
+
+    while (true) {
+      console.log(`${this.tag}Sending SYNC_SEQ:`, Buffer.from(SYNC_SEQ));
+
+      this.uart.write(SYNC_SEQ);
+
+      // We send a "pulse" of data. The bootloader responds to it immediately, within less than millisecs, and we carry on the moment
+      // its answer is in. We only send the sequence again if no answer came in time: sending more bytes while the bootloader's answer
+      // is on its way would mess up the syncronization we're trying to create
+      const packet = await this.waitForPacket(retryTimeout).catch((e: Error) => {
+        if (this.failure !== null) throw e;
+        return null;
+      });
+
+      if (packet !== null) {
+        if (packet.isSingleBytePacket(BL_PACKET_SYNC_OBSERVED_DATA0)) {
+          //Logger.success('Synced');
+          return;
+        }
+        throw new Error('Wrong packet observed during sync sequence');
+      }
+
+      if (now() - start >= timeout) {
+        throw new Error('Timed out waiting for sync sequence observed');
+      }
     }
   }
-  
+
+  /**
+   * @brief The whole update of this device. Rejects with what went wrong, for this device only
+   */
+  async run() {
+    // We need to know what's the length of the firmware that we're sending as an update.
+    // It'll be passed to the target machine to make sure it has enough space for it.
+
+    this.info('Reading the firmware image...');
+    const fwImage = await fs.readFile(path.resolve(process.cwd(), this.firmwareFilename));
+    const fwLength = fwImage.length;
+    if (fwLength > SLOT_SIZE) {
+      // The bootloader would NACK the length, but only after we've synced with it
+      throw new Error(`Firmware image is ${fwLength} bytes, the active slot only holds ${SLOT_SIZE}`);
+    }
+    this.success(`Read firmware image (${fwLength} bytes)`);
+
+    this.info('Attempting to sync with the bootloader');
+    let phaseStart = now();
+    await this.syncWithBootloader();
+    this.phaseTimes.sync = now() - phaseStart;
+    this.success('Synced!');
+
+    phaseStart = now();
+
+    this.info('Requesting firmware update');
+    const fwUpdatePacket = Packet.createSingleBytePacket(BL_PACKET_FW_UPDATE_REQ_DATA0);
+    this.writePacket(fwUpdatePacket);
+    await this.waitForSingleBytePacket(BL_PACKET_FW_UPDATE_RES_DATA0);
+    this.success('Firmware update request accepted');
+
+    this.info('Waiting for device ID request');
+    await this.waitForSingleBytePacket(BL_PACKET_DEVICE_ID_REQ_DATA0);
+    this.success('Device ID request recieved');
+
+    // At this point we expect the bootloader to ask us for Device ID (to make sure they both match)
+
+    const deviceId = fwImage[FWINFO_OFFSET + FWINFO_DEVICE_ID_OFFSET];
+    const deviceIDPacket = new Packet(2, Buffer.from([BL_PACKET_DEVICE_ID_RES_DATA0, deviceId]));
+    this.writePacket(deviceIDPacket);
+    this.info(`Responding with device ID 0x${deviceId.toString(16)}`);
+
+    this.info('Waiting for firmware length request');
+    await this.waitForSingleBytePacket(BL_PACKET_FW_LENGTH_REQ_DATA0);
+    this.success('Firmware length request recieved');
+
+    const fwLengthPacketBuffer = Buffer.alloc(5);  // 5: 1 byte for the message kind, 4 bytes to store a little-endian uint32 value represnting the size
+    fwLengthPacketBuffer[0] = BL_PACKET_FW_LENGTH_RES_DATA0;
+    fwLengthPacketBuffer.writeUInt32LE(fwLength, 1);
+    const fwLengthPacket = new Packet(5, fwLengthPacketBuffer);
+    this.writePacket(fwLengthPacket);
+    this.info('Responding with firmware length');
+
+    // If that's unsuccessfull, meaning the firmware length is non-adequate, we'll get a NACK.
+    // Otherwise the bootloader asks which image this is. If an earlier transfer of the same image was interrupted, it picks up from there
+    await this.waitForSingleBytePacket(BL_PACKET_IMAGE_ID_REQ_DATA0);
+    const imageIdPacketBuffer = Buffer.alloc(5);  // 5: 1 byte for the message kind, 4 bytes for a little-endian uint32 crc32 of the whole image
+    imageIdPacketBuffer[0] = BL_PACKET_IMAGE_ID_RES_DATA0;
+    imageIdPacketBuffer.writeUInt32LE(crc32(fwImage, fwLength), 1);
+    this.writePacket(new Packet(5, imageIdPacketBuffer));
+
+    // Then the bootloader sends a crc32 of each sector of the image it's running, out of the ones the new image spans (the active
+    // slot's sectors, 16K to 128K). Only the sectors that differ from our image get sent. The device copies the others from its
+    // running image. Nothing is erased up front, the bootloader erases each sector when the image first reaches it
+    const imageSectors: FlashRange[] = [];
+    const sectorsToWrite: FlashRange[] = [];
+    let sectorMap = 0;
+    while (true) {
+      const packet = await this.waitForPacket();
+
+      if (packet.isSingleBytePacket(BL_PACKET_SECTOR_MAP_REQ_DATA0)) {
+        break;
+      }
+
+      if (packet.length !== 14 || packet.data[0] !== BL_PACKET_SECTOR_DIGEST_DATA0) {
+        throw new Error(`Unexpected packet received. Expected a sector digest, got packet ${formatPacket(packet)}`);
+      }
+
+      const index = packet.data[1];
+      if (index < imageSectors.length) {
+        continue;   // Sent again, our ack didn't reach the bootloader in time. They come in order
+      }
+      const offset = packet.data.readUInt32LE(2);
+      const size = packet.data.readUInt32LE(6);
+      const digest = packet.data.readUInt32LE(10);
+      imageSectors.push({offset, size});
+      if (crc32(fwImage.subarray(offset, offset + size), size) !== digest) {
+        sectorMap |= (1 << index);
+        sectorsToWrite.push({offset, size});
+      }
+    }
+
+    const sectorMapPacket = new Packet(2, Buffer.from([BL_PACKET_SECTOR_MAP_RES_DATA0, sectorMap]));
+    this.writePacket(sectorMapPacket);
+
+    const resumePacket = await this.waitForPacket();
+    if (resumePacket.length !== 5 || resumePacket.data[0] !== BL_PACKET_RESUME_DATA0) {
+      throw new Error('Unexpected packet received. Expected where to resume from');
+    }
+    const resumeOffset = resumePacket.data.readUInt32LE(1);
+    if (resumeOffset > 0) {
+      this.info(`Resuming an earlier transfer from byte ${resumeOffset}`);
+    }
+
+    // Everything before resumeOffset is already in flash
+    const sectorSize = (sector: {offset: number, size: number}) => Math.max(0, sector.offset + sector.size - Math.max(sector.offset, resumeOffset));
+    this.bytesToWrite = sectorsToWrite.reduce((total, sector) => total + sectorSize(sector), 0);
+    this.info(`Sending ${sectorsToWrite.length} changed sector(s) (${this.bytesToWrite}/${fwLength} bytes)`);
+
+    this.phaseTimes.handshake = now() - phaseStart;
+
+    phaseStart = now();
+    const eraseBefore = this.phaseTimes.erase;
+    for (const sector of sectorsToWrite) {
+      const sectorEnd = sector.offset + sector.size;
+      let offset = Math.max(sector.offset, resumeOffset);
+      while (offset < sectorEnd) {
+        await this.waitForSingleBytePacketAcrossErase(BL_PACKET_READY_FOR_DATA_DATA0);
+
+        const dataBytes = fwImage.subarray(offset, Math.min(offset + PACKET_DATA_LENGTH, sectorEnd));
+        //const dataBytes = fwImage.slice(bytesWritten, bytesWritten + PACKET_DATA_LENGTH);  // Try to grab 16 bytes and send them out.
+                                                                                          // Note: when we use slice(), if we try to slice more data than available,
+                                                                                          // the operation doesn't fail, it gives back as many bytes as could be.
+                                                                                          // This "edge case" will happen at the edge of the firmware image.
+
+        const dataLength = dataBytes.length;
+        const dataPacket = new Packet(dataLength - 1, dataBytes); // The -1 is because we're ignoring the top 4 bits. Our packet length can be represented by 4 bits
+        this.writePacket(dataPacket);
+        offset += dataLength;
+        this.bytesWritten += dataLength;
+
+        // Eventually, we should have written all of the changed bytes, or, will have timed out waiting for a packet, in which case we'll fail out
+      }
+
+      // Logging every 16 bytes would cost more than the round trip it reports on
+      this.info(`Wrote sector at 0x${sector.offset.toString(16)} (${this.bytesWritten}/${this.bytesToWrite} bytes)`);
+    }
+
+    // The device answers the last packet as soon as it's written. Validating the image comes later, once it's done with the uart
+    await this.waitForSingleBytePacketAcrossErase(BL_PACKET_UPDATE_SUCCESSFUL_DATA0);
+    this.phaseTimes.transfer = now() - phaseStart - (this.phaseTimes.erase - eraseBefore);
+
+    // Then we make sure of what actually landed in flash. An older device can't tell us, which is no reason to fail the update
+    phaseStart = now();
+    const differences = await this.findFlashDifferences(fwImage, imageSectors)
+      .catch((e: Error) => {
+        this.info(`Flash check not available (${e.message})`);
+        return null;
+      });
+    this.phaseTimes.check = now() - phaseStart;
+    if (differences !== null && differences.length > 0) {
+      const ranges = differences.map(range => `0x${range.offset.toString(16)}-0x${(range.offset + range.size).toString(16)}`);
+      throw new Error(`What's in flash differs from the image at offset(s) ${ranges.join(', ')}`);
+    }
+    if (differences !== null) {
+      this.success('Flash matches the image');
+    }
+
+    this.success(`Firmware update complete! (${this.totalEraseDuration} ms of it spent erasing)`);
+
+    // An older device doesn't know about stats. That doesn't make the update any less successful
+    await this.readStats()
+      .then(pages => this.logStats(pages))
+      .catch((e: Error) => this.info(`Device stats not available (${e.message})`));
+
+    if (this.traceFilename !== null) {
+      await this.dumpTrace(this.traceFilename)
+        .catch((e: Error) => this.error(`Couldn't read the device's trace (${e.message})`));
+    }
+  }
+
+  /**
+   * @brief Read the device's trace ring, oldest record first, into a file for fw-updater/trace-decode.ts. Asking for the first
+   *        record freezes the ring, asking for one past the newest lets it record again
+   */
+  async dumpTrace(filename: string, timeout = STATS_TIMEOUT) {
+    const records: Buffer[] = [];
+    for (let index = 0; index < 0x10000; index++) {
+      const request = Buffer.from([BL_PACKET_TRACE_REQ_DATA0, 0, 0]);
+      request.writeUInt16LE(index, 1);
+      this.writePacket(new Packet(3, request));
+
+      const packet = await this.waitForPacket(timeout);
+      if (packet.data[0] !== BL_PACKET_TRACE_RES_DATA0 || packet.data.readUInt16LE(1) !== index) {
+        throw new Error(`Unexpected packet received. Expected trace record ${index}, got packet ${formatPacket(packet)}`);
+      }
+      if (packet.length === 3) {
+        break;
+      }
+      records.push(packet.data.subarray(3, 3 + TRACE_RECORD_BYTES));
+    }
+
+    if (records.length === 0) {
+      this.info('The device has no trace. Build it with make TRACE=1');
+      return;
+    }
+    await fs.writeFile(filename, Buffer.concat(records));
+    this.success(`Wrote ${records.length} trace records to ${filename}`);
+  }
+
+  /**
+   * @brief A crc32 of a range of what the device wrote the image into, as it's in flash now
+   */
+  private async readFlashDigest(offset: number, size: number, timeout = DIGEST_TIMEOUT) {
+    const request = Buffer.alloc(9);  // 9: 1 byte for the message kind, and little-endian uint32's of the offset and length
+    request[0] = BL_PACKET_DIGEST_REQ_DATA0;
+    request.writeUInt32LE(offset, 1);
+    request.writeUInt32LE(size, 5);
+    this.writePacket(new Packet(9, request));
+
+    const packet = await this.waitForPacket(timeout);
+    if (packet.length !== 13 || packet.data[0] !== BL_PACKET_DIGEST_RES_DATA0 || packet.data.readUInt32LE(1) !== offset) {
+      throw new Error(`Unexpected packet received. Expected a digest of 0x${offset.toString(16)}, got packet ${formatPacket(packet)}`);
+    }
+    return { size: packet.data.readUInt32LE(5), digest: packet.data.readUInt32LE(9) };
+  }
+
+  /**
+   * @brief Check what's in flash against the image without reading it back: one digest of the whole image, which is all it takes
+   *        when the update went well. Otherwise one per sector, and each sector that differs is halved down to the first packet's
+   *        worth of data that differs
+   */
+  async findFlashDifferences(fwImage: Buffer, sectors: FlashRange[]) {
+    const differs = async (offset: number, size: number) => {
+      const flash = await this.readFlashDigest(offset, size);
+      return flash.size !== size || flash.digest !== crc32(fwImage.subarray(offset, offset + size), size);
+    };
+
+    const differences: FlashRange[] = [];
+    if (!await differs(0, fwImage.length)) {
+      return differences;
+    }
+
+    for (const sector of sectors) {
+      if (!await differs(sector.offset, sector.size)) {
+        continue;
+      }
+
+      let range = { ...sector };
+      while (range.size > PACKET_DATA_LENGTH) {
+        const firstHalf = { offset: range.offset, size: Math.ceil(range.size / 2) };
+        const secondHalf = { offset: range.offset + firstHalf.size, size: range.size - firstHalf.size };
+        range = await differs(firstHalf.offset, firstHalf.size) ? firstHalf : secondHalf;
+      }
+      differences.push(range);
+    }
+    if (differences.length === 0) {
+      differences.push({ offset: 0, size: fwImage.length });   // Every sector matches, so the difference is past the last one
+    }
+    return differences;
+  }
+
+  /**
+   * @brief Ask the device for its counters, a page at a time, until it answers with a page that has none
+   */
+  async readStats(timeout = STATS_TIMEOUT) {
+    const pages: number[][] = [];
+    for (let page = 0; page < 256; page++) {
+      this.writePacket(new Packet(2, Buffer.from([BL_PACKET_STATS_REQ_DATA0, page])));
+      const packet = await this.waitForPacket(timeout);
+      if (packet.data[0] !== BL_PACKET_STATS_RES_DATA0 || packet.data[1] !== page || packet.length < 2 || (packet.length - 2) % 4 !== 0) {
+        throw new Error(`Unexpected packet received. Expected stats page ${page}, got packet ${formatPacket(packet)}`);
+      }
+
+      const counterCount = (packet.length - 2) / 4;
+      if (counterCount === 0) {
+        break;
+      }
+      pages.push(Array.from({ length: counterCount }, (_, i) => packet.data.readUInt32LE(2 + (i * 4))));
+    }
+    return pages;
+  }
+
+  logStats(pages: number[][]) {
+    pages.forEach((counters, page) => {
+      const description = STATS_PAGES[page] ?? { name: `Page ${page}`, counters: [] };
+      const values = counters.map((value, i) => `${value} ${description.counters[i] ?? `counter ${i}`}`);
+      this.info(`Device ${description.name}: ${values.join(', ')}`);
+    });
+  }
+
+  bytesPerSecond() {
+    return this.phaseTimes.transfer > 0 ? Math.round(this.bytesWritten / (this.phaseTimes.transfer / 1000)) : 0;
+  }
+
+  logPhaseTimes() {
+    const ms = (time: number) => `${time.toFixed(1)} ms`;
+    this.info(`Sync:      ${ms(this.phaseTimes.sync)}`);
+    this.info(`Handshake: ${ms(this.phaseTimes.handshake)}`);
+    this.info(`Erase:     ${ms(this.phaseTimes.erase)}`);
+    this.info(`Transfer:  ${ms(this.phaseTimes.transfer)} (${this.bytesWritten} bytes, ${this.bytesPerSecond()} bytes/s)`);
+    this.info(`Check:     ${ms(this.phaseTimes.check)}`);
+  }
 }
 
+/**
+ * @brief Where to dump a device's trace. Each device gets its own file when there are several, named after its port
+ */
+const traceFilenameFor = (traceFilename: string | null, portPath: string, multipleDevices: boolean) => {
+  if (traceFilename === null || !multipleDevices) {
+    return traceFilename;
+  }
+  return `${traceFilename}.${path.basename(portPath)}`;
+};
+
+/**
+ * @brief The devices to update, from the command line. Either a single image, sent over the default serial port, or any number of
+ *        <serial port>=<signed firmware> pairs, one per device
+ */
+const parseTargets = (args: string[]) => {
+  if (args.length === 1 && !args[0].includes('=')) {
+    return [{ portPath: DEFAULT_SERIAL_PATH, firmwareFilename: args[0] }];
+  }
+
+  return args.map(arg => {
+    const separator = arg.indexOf('=');
+    if (separator <= 0 || separator === arg.length - 1) {
+      Logger.error(`Expected <serial port>=<signed firmware>, got ${arg}`);
+      process.exit(1);
+    }
+    return { portPath: arg.slice(0, separator), firmwareFilename: arg.slice(separator + 1) };
+  });
+};
+
+// While several devices are being updated, how often to report on all of them together
+const PROGRESS_REPORT_INTERVAL = (1000);
+
 // Do everything in an async function so we can have loops, awaits etc
 const main = async () => {
-  if (process.argv.length < 3) {
-    console.log("usage: fw-updater <signed firmware>");
+  const args = process.argv.slice(2);
+  let traceFilename: string | null = null;
+  const traceOption = args.indexOf('--trace');
+  if (traceOption !== -1) {
+    traceFilename = args[traceOption + 1] ?? null;
+    args.splice(traceOption, 2);
+  }
+
+  if (args.length < 1 || (traceOption !== -1 && traceFilename === null)) {
+    console.log("usage: fw-updater [--trace <dump file>] <signed firmware>");
+    console.log("       fw-updater [--trace <dump file>] <serial port>=<signed firmware> [<serial port>=<signed firmware>...]");
+    process.exit(1);
+  }
+  const targets = parseTargets(args);
+  const multipleDevices = targets.length > 1;
+
+  const portPaths = targets.map(target => target.portPath);
+  if (new Set(portPaths).size !== portPaths.length) {
+    Logger.error('Each serial port can only be given once');
     process.exit(1);
   }
-  const firmwareFilename = process.argv[2];
-
-  // We need to know what's the length of the firmware that we're sending as an update.
-  // It'll be passed to the target machine to make sure it has enough space for it.
-  
-  Logger.info('Reading the firmware image...');
-  const fwImage = await fs.readFile(path.join(process.cwd(), firmwareFilename));
-  const fwLength = fwImage.length;
-  Logger.success(`Read firmware image (${fwLength} bytes)`);
-
-  Logger.info('Attempting to sync with the bootloader');
-  await syncWithBootloader();
-  Logger.success('Synced!');
-
-  Logger.info('Requesting firmware update');
-  const fwUpdatePacket = Packet.createSingleBytePacket(BL_PACKET_FW_UPDATE_REQ_DATA0);
-  writePacket(fwUpdatePacket);
-  await waitForSingleBytePacket(BL_PACKET_FW_UPDATE_RES_DATA0);
-  Logger.success('Firmware update request accepted');
-
-  Logger.info('Waiting for device ID request');
-  await waitForSingleBytePacket(BL_PACKET_DEVICE_ID_REQ_DATA0);
-  Logger.success('Device ID request recieved');
-
-  // At this point we expect the bootloader to ask us for Device ID (to make sure they both match)
-
-  const deviceId = fwImage[FWINFO_DEVICE_ID_OFFSET];
-  const deviceIDPacket = new Packet(2, Buffer.from([BL_PACKET_DEVICE_ID_RES_DATA0, deviceId]));
-  writePacket(deviceIDPacket);
-  Logger.info(`Responding with device ID 0x${deviceId.toString(16)}`);
-
-  Logger.info('Waiting for firmware length request');
-  await waitForSingleBytePacket(BL_PACKET_FW_LENGTH_REQ_DATA0);
-  Logger.success('Firmware length request recieved');
-
-  const fwLengthPacketBuffer = Buffer.alloc(5);  // 5: 1 byte for the message kind, 4 bytes to store a little-endian uint32 value represnting the size
-  fwLengthPacketBuffer[0] = BL_PACKET_FW_LENGTH_RES_DATA0;
-  fwLengthPacketBuffer.writeUInt32LE(fwLength, 1);
-  const fwLengthPacket = new Packet(5, fwLengthPacketBuffer);
-  writePacket(fwLengthPacket);
-  Logger.info('Responding with firmware length');
-
-  // If that's unsuccessfull, meaning the firmware length is non-adequate, we'll get a NACK. 
-  // If it's successfull, that's the moment the bootloader is going to start erasing its main app from flash
-  // It seemed to take my machine longer time to erase flash. Went for this overkill
-  Logger.info('Waiting for a few seconds for main application to be erased...');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 1 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 2 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 3 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 4 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 5 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 6 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 7 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 8 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 9 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 10 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 11 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 12 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 13 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 14 sec)');
-  await delay(1000);
-  Logger.info('Waiting for a few seconds for main application to be erased... (waited 15 sec)');
-
-  let bytesWritten = 0;
-  while (bytesWritten < fwLength) {
-    await waitForSingleBytePacket(BL_PACKET_READY_FOR_DATA_DATA0);
-
-    const dataBytes = fwImage.subarray(bytesWritten, bytesWritten + PACKET_DATA_BYTES);
-    //const dataBytes = fwImage.slice(bytesWritten, bytesWritten + PACKET_DATA_BYTES);  // Try to grab 16 bytes and send them out.
-                                                                                      // Note: when we use slice(), if we try to slice more data than available,
-                                                                                      // the operation doesn't fail, it gives back as many bytes as could be.
-                                                                                      // This "edge case" will happen at the edge of the firmware image.
-                                                                                      
-    const dataLength = dataBytes.length;
-    const dataPacket = new Packet(dataLength - 1, dataBytes); // The -1 is because we're ignoring the top 4 bits. Our packet length can be represented by 4 bits
-    writePacket(dataPacket);
-    bytesWritten += dataLength;
-
-    Logger.info(`Wrote ${dataLength} bytes (${bytesWritten}/${fwLength})`);
-
-    // Eventually, we should have written all of the bytes in the firmware image, or, will have timed out waiting for a packet, in which case we'll fail out
-  }
-
-  await waitForSingleBytePacket(BL_PACKET_UPDATE_SUCCESSFUL_DATA0);
-  Logger.success("Firmware update complete!");
+
+  const sessions = targets.map(target => new UpdateSession(target.portPath, target.firmwareFilename, multipleDevices,
+                                                          traceFilenameFor(traceFilename, target.portPath, multipleDevices)));
+  const start = now();
+  const totalBytesWritten = () => sessions.reduce((total, session) => total + session.bytesWritten, 0);
+
+  // Every device goes at its own pace. The report adds them up, so we can see the station's throughput as a whole
+  const progressReport = multipleDevices ? setInterval(() => {
+    const seconds = (now() - start) / 1000;
+    const bytesToWrite = sessions.reduce((total, session) => total + session.bytesToWrite, 0);
+    const finished = sessions.filter(session => session.done).length;
+    Logger.info(`Progress: ${totalBytesWritten()}/${bytesToWrite} bytes, ${Math.round(totalBytesWritten() / seconds)} bytes/s, ${finished}/${sessions.length} devices finished`);
+  }, PROGRESS_REPORT_INTERVAL) : null;
+
+  // A device that fails doesn't stop the others
+  const results = await Promise.allSettled(sessions.map(session =>
+    session.run()
+      .catch((e: Error) => {
+        session.error(e.message);
+        session.logReceiveState();
+        throw e;
+      })
+      .finally(() => session.close())
+  ));
+
+  if (progressReport !== null) {
+    clearInterval(progressReport);
+  }
+
+  if (!multipleDevices) {
+    if (results[0].status === 'fulfilled') {
+      sessions[0].logPhaseTimes();
+    }
+  } else {
+    const seconds = (now() - start) / 1000;
+    results.forEach((result, i) => {
+      const session = sessions[i];
+      if (result.status === 'fulfilled') {
+        Logger.success(`${session.portPath}: ${session.firmwareFilename} updated (${session.bytesWritten} bytes, ${session.bytesPerSecond()} bytes/s)`);
+      } else {
+        Logger.error(`${session.portPath}: ${session.firmwareFilename} failed: ${(result.reason as Error).message}`);
+      }
+    });
+    const succeeded = results.filter(result => result.status === 'fulfilled').length;
+    Logger.info(`${succeeded}/${sessions.length} devices updated in ${seconds.toFixed(1)} s (${totalBytesWritten()} bytes, ${Math.round(totalBytesWritten() / seconds)} bytes/s overall)`);
+  }
+
+  if (results.some(result => result.status === 'rejected')) {
+    process.exitCode = 1;
+  }
 }
 
-main()
-  .finally(() => uart.close());
+main();
@@ -0,0 +1,181 @@
+import * as fs from 'fs/promises';
+
+// Turns a trace dump, written by `fw-updater --trace <dump file>`, into a timeline of what the device was doing, followed by
+// a summary of how long each kind of work took. Each record in the dump is 9 bytes: the event, and little-endian uint32_t's
+// of the cpu cycle count when it happened and its argument. See shared/inc/core/trace.h
+
+// Same order as trace_event_t in shared/inc/core/trace.h
+const TRACE_EVENT_CLOCK_CHANGE       = (1);
+const TRACE_EVENT_FREEZE             = (2);
+const TRACE_EVENT_UART_RX            = (3);
+const TRACE_EVENT_PACKET_START       = (4);
+const TRACE_EVENT_PACKET_DONE        = (5);
+const TRACE_EVENT_FLASH_WRITE_START  = (6);
+const TRACE_EVENT_FLASH_WRITE_END    = (7);
+const TRACE_EVENT_ERASE_START        = (8);
+const TRACE_EVENT_ERASE_END          = (9);
+const TRACE_EVENT_MAC_START          = (10);
+const TRACE_EVENT_MAC_END            = (11);
+
+const TRACE_UART_DROPPED             = (1 << 8);
+const TRACE_UART_OVERRUN             = (1 << 9);
+const TRACE_PACKET_CRC_FAILURE       = (0x100);
+
+const TRACE_RECORD_BYTES             = (9);
+const DEFAULT_CPU_MHZ                = (84);     // System_Clock_Default. Only used if the dump has nothing to tell the frequency by
+const UART_BYTE_MICROS               = (10 * 1000000 / 115200);  // 8N1: 10 bits per byte
+
+const EVENT_NAMES: Record<number, string> = {
+  [TRACE_EVENT_CLOCK_CHANGE]:      'clock change',
+  [TRACE_EVENT_FREEZE]:            'freeze',
+  [TRACE_EVENT_UART_RX]:           'uart rx',
+  [TRACE_EVENT_PACKET_START]:      'packet start',
+  [TRACE_EVENT_PACKET_DONE]:       'packet done',
+  [TRACE_EVENT_FLASH_WRITE_START]: 'flash write start',
+  [TRACE_EVENT_FLASH_WRITE_END]:   'flash write end',
+  [TRACE_EVENT_ERASE_START]:       'erase start',
+  [TRACE_EVENT_ERASE_END]:         'erase end',
+  [TRACE_EVENT_MAC_START]:         'mac start',
+  [TRACE_EVENT_MAC_END]:           'mac end',
+};
+
+// Pairs of events that bracket a piece of work. The time between them is what the summary adds up
+const SPANS: Array<{ name: string, start: number, end: number }> = [
+  { name: 'Parse',       start: TRACE_EVENT_PACKET_START,      end: TRACE_EVENT_PACKET_DONE },
+  { name: 'Flash write', start: TRACE_EVENT_FLASH_WRITE_START, end: TRACE_EVENT_FLASH_WRITE_END },
+  { name: 'Erase',       start: TRACE_EVENT_ERASE_START,       end: TRACE_EVENT_ERASE_END },
+  { name: 'MAC',         start: TRACE_EVENT_MAC_START,         end: TRACE_EVENT_MAC_END },
+];
+
+type TraceRecord = { event: number, cycles: number, argument: number };
+
+const hex = (value: number) => `0x${value.toString(16)}`;
+
+const describeArgument = (record: TraceRecord) => {
+  const { event, argument } = record;
+  switch (event) {
+    case TRACE_EVENT_CLOCK_CHANGE:
+      return `${argument >>> 16} -> ${argument & 0xffff} MHz`;
+    case TRACE_EVENT_FREEZE:
+      return `${argument} MHz`;
+    case TRACE_EVENT_UART_RX: {
+      const flags = [
+        (argument & TRACE_UART_DROPPED) ? 'DROPPED' : '',
+        (argument & TRACE_UART_OVERRUN) ? 'OVERRUN' : '',
+      ].filter(flag => flag !== '');
+      return [hex(argument & 0xff), ...flags].join(' ');
+    }
+    case TRACE_EVENT_PACKET_DONE:
+      return (argument === TRACE_PACKET_CRC_FAILURE) ? 'CRC FAILURE' : hex(argument);
+    case TRACE_EVENT_FLASH_WRITE_START:
+    case TRACE_EVENT_MAC_START:
+      return `${argument} bytes`;
+    case TRACE_EVENT_ERASE_START:
+      return `sector ${argument}`;
+    case TRACE_EVENT_ERASE_END:
+      return argument ? 'FAILED' : '';
+    default:
+      return '';
+  }
+};
+
+/**
+ * @brief The cpu frequency the first record was counted at. A clock change tells us what it was before, otherwise the
+ *        frequency at freeze time held all along
+ */
+const initialMhz = (records: TraceRecord[], fallbackMhz: number) => {
+  const firstChange = records.find(record => record.event === TRACE_EVENT_CLOCK_CHANGE);
+  if (typeof firstChange !== 'undefined' && (firstChange.argument >>> 16) > 0) {
+    return firstChange.argument >>> 16;
+  }
+  const freeze = records.find(record => record.event === TRACE_EVENT_FREEZE);
+  if (typeof freeze !== 'undefined' && freeze.argument > 0) {
+    return freeze.argument;
+  }
+  return fallbackMhz;
+};
+
+const main = async () => {
+  const args = process.argv.slice(2);
+  const summaryOnly = args.includes('--summary');
+  const mhzOption = args.indexOf('--mhz');
+  const fallbackMhz = (mhzOption !== -1) ? Number(args[mhzOption + 1]) : DEFAULT_CPU_MHZ;
+  const positional = args.filter((arg, i) => !arg.startsWith('--') && (mhzOption === -1 || i !== mhzOption + 1));
+
+  if (positional.length !== 1 || !(fallbackMhz > 0)) {
+    console.log("usage: trace-decode [--summary] [--mhz <cpu MHz>] <trace dump>");
+    process.exit(1);
+  }
+
+  const dump = await fs.readFile(positional[0]);
+  const records: TraceRecord[] = [];
+  for (let offset = 0; offset + TRACE_RECORD_BYTES <= dump.length; offset += TRACE_RECORD_BYTES) {
+    records.push({
+      event: dump[offset],
+      cycles: dump.readUInt32LE(offset + 1),
+      argument: dump.readUInt32LE(offset + 5),
+    });
+  }
+  if (records.length === 0) {
+    console.log('Empty trace');
+    return;
+  }
+
+  // Cycle counts wrap around at 32 bits. Between two records there's always less than a full wrap (23 s at 180 MHz)
+  let mhz = initialMhz(records, fallbackMhz);
+  let micros = 0;
+  const times: number[] = [];
+  records.forEach((record, i) => {
+    if (i > 0) {
+      micros += ((record.cycles - records[i - 1].cycles) >>> 0) / mhz;
+    }
+    times.push(micros);
+    if (record.event === TRACE_EVENT_CLOCK_CHANGE) {
+      mhz = record.argument & 0xffff;   // The cycles from here on are counted at the new frequency
+    }
+  });
+
+  if (!summaryOnly) {
+    records.forEach((record, i) => {
+      const delta = (i > 0) ? times[i] - times[i - 1] : 0;
+      const name = EVENT_NAMES[record.event] ?? `event ${record.event}`;
+      console.log(`${times[i].toFixed(3).padStart(14)} us  (+${delta.toFixed(3).padStart(10)})  ${name.padEnd(18)} ${describeArgument(record)}`);
+    });
+    console.log('');
+  }
+
+  console.log(`${records.length} records over ${(micros / 1000).toFixed(3)} ms`);
+
+  for (const span of SPANS) {
+    const durations: number[] = [];
+    let startTime: number | null = null;
+    records.forEach((record, i) => {
+      if (record.event === span.start) {
+        startTime = times[i];
+      } else if (record.event === span.end && startTime !== null) {
+        durations.push(times[i] - startTime);
+        startTime = null;
+      }
+    });
+    if (durations.length === 0) {
+      continue;
+    }
+    const total = durations.reduce((sum, duration) => sum + duration, 0);
+    const max = Math.max(...durations);
+    console.log(`${span.name.padEnd(12)} ${String(durations.length).padStart(6)} x, total ${total.toFixed(1)} us, mean ${(total / durations.length).toFixed(1)} us, max ${max.toFixed(1)} us`);
+  }
+
+  // Bytes come in one per byte time at most. Two interrupts closer together than that mean the first one ran late, by at least the difference
+  const rxTimes = times.filter((_, i) => records[i].event === TRACE_EVENT_UART_RX);
+  if (rxTimes.length > 1) {
+    const rxRecords = records.filter(record => record.event === TRACE_EVENT_UART_RX);
+    const gaps = rxTimes.slice(1).map((time, i) => time - rxTimes[i]);
+    const minGap = Math.min(...gaps);
+    const dropped = rxRecords.filter(record => record.argument & TRACE_UART_DROPPED).length;
+    const overruns = rxRecords.filter(record => record.argument & TRACE_UART_OVERRUN).length;
+    const lateBy = Math.max(0, UART_BYTE_MICROS - minGap);
+    console.log(`Uart rx      ${String(rxRecords.length).padStart(6)} x, ${dropped} dropped, ${overruns} overruns, shortest gap ${minGap.toFixed(1)} us (interrupt late by at least ${lateBy.toFixed(1)} us)`);
+  }
+};
+
+main();
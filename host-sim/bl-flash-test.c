@@ -0,0 +1,239 @@
+// Tests of bl-flash.c's write combining, against flash-model.c: bytes are staged until their word is complete, each word is programmed
+// exactly once with a single flash_program_word(), whatever the alignment and length of the writes, and a partial last word only
+// reaches flash on bl_flash_flush() or bl_flash_end(), padded with 0xff. Also checks the erase, the lock around a session, and that
+// the ART caches are off while the flash changes and reset before they're back on.
+//
+// usage: bl-flash-test [--seed <n>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libopencm3/stm32/flash.h>
+#include "core/bl-flash.h"
+#include "core/system.h"
+#include "generated.protocol.h"
+#include "flash-model.h"
+#include "check.h"
+
+#define SECTOR_2_ADDRESS    (0x08008000)
+#define SECTOR_2_SIZE       (16 * 1024)
+#define RANDOM_RUNS         (200)
+#define MAX_RUN_LENGTH      (4000)
+
+// bl-flash.c times itself. Time doesn't matter here
+uint64_t system_get_micros(void) {
+    return 0;
+}
+
+static const uint8_t* flash_at(const uint32_t address) {
+    return (const uint8_t*)(uintptr_t)address;
+}
+
+static bool is_erased(const uint32_t address, const uint32_t length) {
+    for(uint32_t i = 0; i < length; i++) {
+        if(flash_at(address)[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t words_programmed(void) {
+    return flash_model_get_stats()->words_programmed;
+}
+
+static void start_session(void) {
+    flash_model_erase_all();
+    bl_flash_begin();
+}
+
+static void test_aligned_words(void) {
+    const uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    CHECK(words_programmed() == 2);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS), data, sizeof(data)) == 0);
+
+    bl_flash_end();
+    CHECK(words_programmed() == 2);     // Nothing was left staged
+    CHECK(flash_model_is_locked());
+    CHECK(flash_model_get_stats()->misuses == 0);
+}
+
+static void test_unaligned_start(void) {
+    const uint8_t data[3] = { 0x11, 0x22, 0x33 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS + 1, data, sizeof(data));  // Ends on the last byte of the word, so it's programmed right away
+    CHECK(words_programmed() == 1);
+    CHECK(flash_at(SECTOR_2_ADDRESS)[0] == 0xff);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS + 1), data, sizeof(data)) == 0);
+
+    bl_flash_write(SECTOR_2_ADDRESS + 6, data, 1);    // Starts in the middle of the next word
+    bl_flash_end();
+    CHECK(words_programmed() == 2);
+    CHECK(is_erased(SECTOR_2_ADDRESS + 4, 2));
+    CHECK(flash_at(SECTOR_2_ADDRESS + 6)[0] == 0x11);
+    CHECK(flash_at(SECTOR_2_ADDRESS + 7)[0] == 0xff);
+    CHECK(flash_model_get_stats()->misuses == 0);
+}
+
+static void test_write_spanning_words(void) {
+    const uint8_t data[6] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS + 3, data, sizeof(data));  // The last byte of one word, all of the next, the first byte of the one after
+    CHECK(words_programmed() == 2);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS + 3), data, 5) == 0);
+    CHECK(flash_at(SECTOR_2_ADDRESS + 8)[0] == 0xff);   // Still staged
+
+    bl_flash_end();
+    CHECK(words_programmed() == 3);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS + 3), data, sizeof(data)) == 0);
+    CHECK(is_erased(SECTOR_2_ADDRESS, 3));
+    CHECK(is_erased(SECTOR_2_ADDRESS + 9, 3));
+}
+
+static void test_tail_flush(void) {
+    const uint8_t data[5] = { 0xde, 0xad, 0xbe, 0xef, 0x42 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    CHECK(words_programmed() == 1);
+    CHECK(flash_at(SECTOR_2_ADDRESS + 4)[0] == 0xff);  // The tail waits for the rest of its word
+
+    bl_flash_flush();
+    CHECK(words_programmed() == 2);
+    CHECK(flash_at(SECTOR_2_ADDRESS + 4)[0] == 0x42);
+    CHECK(is_erased(SECTOR_2_ADDRESS + 5, 3));          // Padding
+    CHECK(!flash_model_is_locked());                    // Flushing doesn't end the session
+
+    bl_flash_flush();
+    bl_flash_end();
+    CHECK(words_programmed() == 2);                     // Nothing staged, nothing programmed
+    CHECK(flash_model_get_stats()->misuses == 0);
+}
+
+static void test_jump_to_another_word(void) {
+    const uint8_t data[2] = { 0x5a, 0xa5 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    bl_flash_write(SECTOR_2_ADDRESS + 8, data, sizeof(data));  // Skips a word. The partial one before it goes out, padded
+    CHECK(words_programmed() == 1);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS), data, sizeof(data)) == 0);
+    CHECK(is_erased(SECTOR_2_ADDRESS + 2, 10));
+
+    bl_flash_end();
+    CHECK(words_programmed() == 2);
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS + 8), data, sizeof(data)) == 0);
+    CHECK(flash_model_get_stats()->misuses == 0);
+}
+
+/**
+ * @brief What the update state machine does: a run of packets of 1 to PACKET_DATA_LENGTH bytes, one after the other, from a random
+ *        start. Every word the run touches has to be programmed exactly once, and everything around the run has to stay erased
+ */
+static void test_random_packet_runs(void) {
+    static uint8_t data[MAX_RUN_LENGTH];
+    for(uint32_t run = 0; run < RANDOM_RUNS; run++) {
+        const uint32_t start = SECTOR_2_ADDRESS + 64 + (rand() % 64);
+        const uint32_t length = 1 + (rand() % MAX_RUN_LENGTH);
+        for(uint32_t i = 0; i < length; i++) {
+            data[i] = rand() & 0xff;
+        }
+
+        start_session();
+        for(uint32_t offset = 0; offset < length;) {
+            uint32_t packet_length = 1 + (rand() % PACKET_DATA_LENGTH);
+            if(packet_length > length - offset) { packet_length = length - offset; }
+            bl_flash_write(start + offset, &data[offset], packet_length);
+            offset += packet_length;
+        }
+        bl_flash_end();
+
+        const uint32_t first_word = start / 4;
+        const uint32_t last_word = (start + length - 1) / 4;
+        if(!CHECK(words_programmed() == last_word - first_word + 1) ||
+           !CHECK(memcmp(flash_at(start), data, length) == 0) ||
+           !CHECK(is_erased(SECTOR_2_ADDRESS, start - SECTOR_2_ADDRESS)) ||
+           !CHECK(is_erased(start + length, SECTOR_2_SIZE - (start + length - SECTOR_2_ADDRESS))) ||
+           !CHECK(flash_model_get_stats()->misuses == 0)) {
+            printf("  run %u: %u bytes from 0x%08x\n", run, length, start);
+            return;
+        }
+    }
+}
+
+static void test_stats(void) {
+    const uint8_t data[7] = {0};
+    start_session();
+    const uint32_t words_before = bl_flash_get_stats()->words_programmed;
+    bl_flash_write(SECTOR_2_ADDRESS + 2, data, sizeof(data));   // Three words: 2 bytes, 4 bytes, 1 byte
+    bl_flash_end();
+    CHECK(bl_flash_get_stats()->words_programmed - words_before == 3);
+}
+
+static void test_erase(void) {
+    const uint8_t data[4] = { 1, 2, 3, 4 };
+    start_session();
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    CHECK(bl_flash_erase_sector(2));
+    CHECK(is_erased(SECTOR_2_ADDRESS, SECTOR_2_SIZE));
+
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    flash_model_fail_next_erase();
+    CHECK(!bl_flash_erase_sector(2));                           // The flash's error flags are reported
+    CHECK(memcmp(flash_at(SECTOR_2_ADDRESS), data, sizeof(data)) == 0);
+    CHECK(bl_flash_erase_sector(2));                            // And cleared again, so they aren't blamed on the next erase
+    bl_flash_end();
+    CHECK(flash_model_get_stats()->misuses == 0);
+}
+
+static void test_caches(void) {
+    const uint8_t data[6] = { 1, 2, 3, 4, 5, 6 };
+    start_session();
+    flash_icache_enable();
+    flash_dcache_enable();
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    bl_flash_erase_sector(3);
+    bl_flash_end();
+    CHECK(flash_model_get_stats()->cached_changes == 0);
+    CHECK(flash_model_get_stats()->cache_resets == 6);      // Both caches, after the write, the erase and the flush of the tail
+    CHECK((FLASH_ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN)) == (FLASH_ACR_ICEN | FLASH_ACR_DCEN));
+    CHECK(flash_model_get_stats()->misuses == 0);
+
+    start_session();
+    flash_icache_enable();  // Only what was on comes back on
+    bl_flash_write(SECTOR_2_ADDRESS, data, sizeof(data));
+    bl_flash_end();
+    CHECK((FLASH_ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN)) == FLASH_ACR_ICEN);
+    CHECK(flash_model_get_stats()->cached_changes == 0);
+}
+
+static void test_sectors(void) {
+    uint8_t sector = 0;
+    CHECK(!bl_flash_sector_for_address(0x08000000, &sector));  // The bootloader's own
+    CHECK(bl_flash_sector_for_address(0x08008000, &sector) && sector == 2);
+    CHECK(bl_flash_sector_for_address(0x0801ffff, &sector) && sector == 4);
+    CHECK(bl_flash_sector_for_address(0x0807ffff, &sector) && sector == 7);
+    CHECK(!bl_flash_sector_for_address(0x08080000, &sector));
+    CHECK(bl_flash_sector_end_address(5) == bl_flash_sector_start_address(6));
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = 1;
+    if(argc == 3 && strcmp(argv[1], "--seed") == 0) {
+        seed = strtoul(argv[2], NULL, 0);
+    }
+    srand(seed);
+    flash_model_setup();
+
+    test_aligned_words();
+    test_unaligned_start();
+    test_write_spanning_words();
+    test_tail_flush();
+    test_jump_to_another_word();
+    test_random_packet_runs();
+    test_stats();
+    test_erase();
+    test_caches();
+    test_sectors();
+    return check_report("bl-flash-test");
+}
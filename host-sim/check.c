@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include "check.h"
+
+static uint32_t checks = 0;
+static uint32_t failures = 0;
+
+bool check(const bool condition, const char* text, const char* file, const int line) {
+    checks++;
+    if(!condition) {
+        failures++;
+        printf("%s:%d: failed: %s\n", file, line, text);
+    }
+    return condition;
+}
+
+int check_report(const char* name) {
+    printf("%s: %u checks, %u failed\n", name, checks, failures);
+    return failures == 0 ? 0 : 1;
+}
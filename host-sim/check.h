@@ -0,0 +1,14 @@
+#ifndef INC_CHECK_H
+#define INC_CHECK_H
+
+#include "common-defines.h"
+
+// The smallest test harness that does the job: CHECK() prints the condition that failed and where, and carries on, so one run shows
+// every failure. check_report() prints the count and gives main() its exit status
+
+#define CHECK(condition)    check((condition), #condition, __FILE__, __LINE__)
+
+bool check(const bool condition, const char* text, const char* file, const int line);     // Returns the condition
+int check_report(const char* name);
+
+#endif // INC_CHECK_H
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE     // MAP_FIXED_NOREPLACE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <libopencm3/stm32/flash.h>
+#include "flash-model.h"
+
+volatile uint32_t host_flash_acr = 0;
+volatile uint32_t host_flash_cr = 0;
+volatile uint32_t host_flash_sr = 0;
+
+// Same as bl-flash.c's table, plus the end of the last sector
+static const uint32_t sector_addresses[] = {
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000, 0x08010000, 0x08020000, 0x08040000, 0x08060000, 0x08080000,
+};
+#define SECTOR_COUNT (sizeof(sector_addresses) / sizeof(sector_addresses[0]) - 1)
+
+static uint8_t* flash = NULL;
+static bool is_locked = true;
+static bool should_fail_next_erase = false;
+static flash_model_stats_t stats = {0};
+
+void flash_model_setup(void) {
+    void* mapped = mmap((void*)FLASH_MODEL_ADDRESS, FLASH_MODEL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if(mapped != (void*)FLASH_MODEL_ADDRESS) {
+        fprintf(stderr, "flash-model: can't map the flash at 0x%08x\n", FLASH_MODEL_ADDRESS);
+        exit(1);
+    }
+    flash = mapped;
+    flash_model_erase_all();
+}
+
+void flash_model_erase_all(void) {
+    memset(flash, 0xff, FLASH_MODEL_SIZE);
+    memset(&stats, 0, sizeof(stats));
+    is_locked = true;
+    should_fail_next_erase = false;
+    host_flash_acr = 0;
+    host_flash_cr = 0;
+    host_flash_sr = 0;
+}
+
+void flash_model_fail_next_erase(void) {
+    should_fail_next_erase = true;
+}
+
+bool flash_model_is_locked(void) {
+    return is_locked;
+}
+
+const flash_model_stats_t* flash_model_get_stats(void) {
+    return &stats;
+}
+
+void flash_unlock(void) {
+    is_locked = false;
+}
+
+void flash_lock(void) {
+    is_locked = true;
+}
+
+void flash_wait_for_last_operation(void) {
+    // Every operation completes inside its call
+}
+
+void flash_clear_status_flags(void) {
+    host_flash_sr &= ~(FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR | FLASH_SR_OPERR | FLASH_SR_EOP);
+}
+
+static void count_cached_change(void) {
+    if(host_flash_acr & (FLASH_ACR_ICEN | FLASH_ACR_DCEN)) {
+        stats.cached_changes++;
+    }
+}
+
+static void reset_cache(const uint32_t enable_bit) {
+    if(host_flash_acr & enable_bit) {
+        stats.misuses++;    // The reference manual only allows it with the cache off
+    }
+    stats.cache_resets++;
+}
+
+void flash_icache_enable(void)  { host_flash_acr |= FLASH_ACR_ICEN; }
+void flash_icache_disable(void) { host_flash_acr &= ~FLASH_ACR_ICEN; }
+void flash_icache_reset(void)   { reset_cache(FLASH_ACR_ICEN); }
+void flash_dcache_enable(void)  { host_flash_acr |= FLASH_ACR_DCEN; }
+void flash_dcache_disable(void) { host_flash_acr &= ~FLASH_ACR_DCEN; }
+void flash_dcache_reset(void)   { reset_cache(FLASH_ACR_DCEN); }
+
+void flash_erase_sector(uint8_t sector, uint32_t program_size) {
+    (void)program_size;
+    count_cached_change();
+    if(is_locked || sector >= SECTOR_COUNT) {
+        stats.misuses++;
+        host_flash_sr |= FLASH_SR_WRPERR;
+        return;
+    }
+    if(should_fail_next_erase) {
+        should_fail_next_erase = false;
+        host_flash_sr |= FLASH_SR_OPERR;
+        return;
+    }
+    memset(&flash[sector_addresses[sector] - FLASH_MODEL_ADDRESS], 0xff, sector_addresses[sector + 1] - sector_addresses[sector]);
+    stats.sectors_erased++;
+    host_flash_sr |= FLASH_SR_EOP;
+}
+
+void flash_program_word(uint32_t address, uint32_t data) {
+    if(is_locked || (address & 3) != 0 || address < FLASH_MODEL_ADDRESS || address - FLASH_MODEL_ADDRESS > FLASH_MODEL_SIZE - 4) {
+        stats.misuses++;
+        host_flash_sr |= is_locked ? FLASH_SR_WRPERR : FLASH_SR_PGAERR;
+        return;
+    }
+    count_cached_change();
+    uint32_t word;
+    memcpy(&word, &flash[address - FLASH_MODEL_ADDRESS], sizeof(word));
+    if(word != 0xffffffff) {
+        stats.misuses++;
+    }
+    word &= data;   // Programming only ever clears bits
+    memcpy(&flash[address - FLASH_MODEL_ADDRESS], &word, sizeof(word));
+    stats.words_programmed++;
+    host_flash_sr |= FLASH_SR_EOP;
+}
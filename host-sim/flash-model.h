@@ -0,0 +1,29 @@
+#ifndef INC_FLASH_MODEL_H
+#define INC_FLASH_MODEL_H
+
+#include "common-defines.h"
+
+// The STM32F446's flash, in host ram, mapped at its target address so target code can read it through plain pointers the way it does
+// on the chip. Programming goes through the libopencm3 calls in stubs/libopencm3/stm32/flash.h. Like the real thing, programming can
+// only clear bits, so a word programmed twice between erases ends up as the AND of both. The model counts that as a misuse, along
+// with programming or erasing while the flash is locked, unaligned word writes and resetting a cache that's on, instead of failing
+// right away, so a test can check. It also counts erases and programs done with a cache on, which leave the cache stale
+
+#define FLASH_MODEL_ADDRESS     (0x08000000)
+#define FLASH_MODEL_SIZE        (512 * 1024)
+
+typedef struct flash_model_stats_t {
+    uint32_t words_programmed;
+    uint32_t sectors_erased;
+    uint32_t misuses;               // Writes to a word that wasn't erased, writes or erases while locked, unaligned writes, cache resets while on
+    uint32_t cached_changes;        // Erases and programs while the instruction or data cache was on
+    uint32_t cache_resets;
+} flash_model_stats_t;
+
+void flash_model_setup(void);                       // Maps the flash, all erased, locked. Exits if the address range is taken
+void flash_model_erase_all(void);                   // Back to all erased and locked, with the stats cleared
+void flash_model_fail_next_erase(void);             // The next erase leaves the sector as it was, and flags an operation error
+bool flash_model_is_locked(void);
+const flash_model_stats_t* flash_model_get_stats(void);
+
+#endif // INC_FLASH_MODEL_H
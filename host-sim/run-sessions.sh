@@ -0,0 +1,84 @@
+#!/bin/bash
+# Updates several simulated devices (sim-device) at once from a single fw-updater, the way a production station programs several boards,
+# and checks what each of them ended up with in its staging slot. The images are handed out to the devices in turn, so adding one for
+# another device ID checks that its failure leaves the other devices alone. With --rounds, fw-updater is run that many times over the
+# same devices, whose flash is kept between rounds, so the later rounds pick up where the earlier ones got to (the end, for the same image).
+# Exits with 1 if fw-updater or any device reports a failure, or a device that succeeded doesn't hold its image.
+#
+# usage: run-sessions.sh [--devices <n>] [--rounds <n>] <signed image>...
+# FW_UPDATER says how to run fw-updater. ts-node ../fw-updater by default
+
+cd "$(dirname "$0")" || exit 1
+
+devices=4
+rounds=1
+images=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --devices) devices="$2"; shift 2 ;;
+        --rounds)  rounds="$2"; shift 2 ;;
+        *)         images+=("$(realpath "$1")") || exit 1; shift ;;
+    esac
+done
+if [ ${#images[@]} -eq 0 ] || [ "$devices" -lt 1 ] || [ "$rounds" -lt 1 ]; then
+    echo "usage: run-sessions.sh [--devices <n>] [--rounds <n>] <signed image>..." >&2
+    exit 2
+fi
+FW_UPDATER="${FW_UPDATER:-ts-node ../fw-updater}"
+
+make -s sim-device || exit 1
+
+workdir="$(mktemp -d)"
+pids=()
+trap 'kill "${pids[@]}" 2>/dev/null; rm -rf "$workdir"' EXIT
+
+# Each device prints the path of its pseudo terminal once it's ready
+pairs=()
+for ((i = 0; i < devices; i++)); do
+    ./sim-device --sessions "$rounds" --dump "$workdir/device$i.bin" > "$workdir/device$i.port" 2> "$workdir/device$i.log" &
+    pids+=($!)
+done
+for ((i = 0; i < devices; i++)); do
+    for ((wait = 0; wait < 50; wait++)); do
+        [ -s "$workdir/device$i.port" ] && break
+        sleep 0.1
+    done
+    if [ ! -s "$workdir/device$i.port" ]; then
+        echo "Device $i didn't start" >&2
+        exit 1
+    fi
+    pairs+=("$(head -n 1 "$workdir/device$i.port")=${images[i % ${#images[@]}]}")
+done
+
+status=0
+for ((round = 1; round <= rounds; round++)); do
+    echo "Round $round of $rounds: ${pairs[*]}"
+    $FW_UPDATER "${pairs[@]}" || status=1
+done
+
+# The devices exit once they've served their last session, and lingered for the host's stats requests. One the host never got through
+# to is still waiting for it
+for ((wait = 0; wait < 30; wait++)); do
+    kill -0 "${pids[@]}" 2>/dev/null || break
+    sleep 0.1
+done
+
+for ((i = 0; i < devices; i++)); do
+    image="${images[i % ${#images[@]}]}"
+    if kill -0 "${pids[i]}" 2>/dev/null; then
+        result="never finished its sessions"
+        status=1
+    elif wait "${pids[i]}"; then
+        if cmp -s -n "$(stat -c %s "$image")" "$image" "$workdir/device$i.bin"; then
+            result="holds $(basename "$image")"
+        else
+            result="succeeded, but doesn't hold $(basename "$image")"
+            status=1
+        fi
+    else
+        result="failed: $(grep -c failed "$workdir/device$i.log") of $rounds session(s)"
+        status=1
+    fi
+    echo "Device $i ($(head -n 1 "$workdir/device$i.port")): $result"
+done
+exit $status
@@ -0,0 +1,226 @@
+// Tests of scheduler.c (on timer-wheel.c) against a simulated clock: tasks advance it by however long they take to run, and sleeping
+// advances it to the next systick, or to a uart byte the test arranged for. Checks that periodic tasks are re-armed on their period
+// and, after a stall, run once instead of once for every period they missed, that deadline misses are counted from when a task became
+// ready rather than when the scheduler got to it, that a task with more work runs again without the scheduler sleeping, and that the
+// idle time and the tasks' run times add up to the time that went by.
+//
+// usage: scheduler-test
+
+#include <stdio.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include "core/scheduler.h"
+#include "core/system.h"
+#include "check.h"
+
+#define NO_EVENT    (UINT64_MAX)
+#define TASK_COUNT  (2)
+
+static uint64_t now_micros = 0;
+static uint64_t rx_event_micros = NO_EVENT;     // When a uart byte arrives. One at a time is all the tests need
+static uint32_t pending_events = 0;
+static uint32_t sleeps = 0;
+static uint64_t end_micros = 0;
+static jmp_buf scheduler_done;                  // scheduler_run() doesn't return. The first sleep at or after end_micros jumps here
+
+uint64_t system_get_ticks(void) {
+    return now_micros / 1000;
+}
+
+uint64_t system_get_micros(void) {
+    return now_micros;
+}
+
+uint32_t system_take_events(void) {
+    const uint32_t events = pending_events;
+    pending_events = 0;
+    return events;
+}
+
+uint32_t system_wait_for_events(void) {
+    if(now_micros >= end_micros) {
+        longjmp(scheduler_done, 1);
+    }
+    sleeps++;
+
+    const uint64_t next_tick = (now_micros / 1000 + 1) * 1000;
+    if(rx_event_micros < next_tick) {
+        now_micros = (rx_event_micros > now_micros) ? rx_event_micros : now_micros;
+        rx_event_micros = NO_EVENT;
+        return SYSTEM_EVENT_UART_RX;
+    }
+    now_micros = next_tick;
+    return SYSTEM_EVENT_TICK;
+}
+
+// What each task does when it runs: takes this long, and says it has more work to do this many times
+static uint32_t run_micros[TASK_COUNT];
+static uint32_t more_work[TASK_COUNT];
+static uint32_t sleeps_at_run[TASK_COUNT];      // How many times the scheduler had slept by the task's last run
+
+static bool run_task(const uint32_t index) {
+    now_micros += run_micros[index];
+    sleeps_at_run[index] = sleeps;
+    if(more_work[index] > 0) {
+        more_work[index]--;
+        return true;
+    }
+    return false;
+}
+
+static bool task_0(void) { return run_task(0); }
+static bool task_1(void) { return run_task(1); }
+
+static void reset_system(void) {
+    now_micros = 0;
+    rx_event_micros = NO_EVENT;
+    pending_events = 0;
+    sleeps = 0;
+    for(uint32_t i = 0; i < TASK_COUNT; i++) {
+        run_micros[i] = 0;
+        more_work[i] = 0;
+        sleeps_at_run[i] = 0;
+    }
+}
+
+static void run_scheduler_until(const uint64_t micros) {
+    end_micros = micros;
+    if(setjmp(scheduler_done) == 0) {
+        scheduler_run();
+    }
+}
+
+static uint64_t total_run_micros(const scheduler_task_t* tasks, const uint32_t count) {
+    uint64_t total = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        total += tasks[i].stats.total_run_micros;
+    }
+    return total;
+}
+
+static void test_periodic_task(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "periodic", .function = task_0, .period = 10 },
+    };
+    reset_system();
+    run_micros[0] = 3000;
+    scheduler_setup(tasks, 1);
+    run_scheduler_until(1000000);
+
+    const scheduler_task_stats_t* stats = &tasks[0].stats;
+    CHECK(stats->runs == 100);              // At 10 ms, 20 ms, ... 1 s
+    CHECK(stats->max_run_micros == 3000 && stats->last_run_micros == 3000);
+    CHECK(stats->total_run_micros == 100 * 3000);
+    CHECK(stats->deadline_misses == 0);
+    CHECK(tasks[0].timer.is_running);
+
+    // Nothing else takes time, so whatever the task didn't use was spent asleep
+    CHECK(scheduler_get_idle_micros() + total_run_micros(tasks, 1) == now_micros);
+    CHECK(scheduler_get_idle_micros() == now_micros - 100 * 3000);
+}
+
+static void test_deadline_misses(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "first",  .function = task_0, .period = 10 },
+        { .name = "second", .function = task_1, .period = 10, .deadline = 6000 },
+    };
+    reset_system();
+    run_micros[0] = 4000;
+    run_micros[1] = 4000;
+    scheduler_setup(tasks, 2);
+    run_scheduler_until(100000);
+
+    // Ready at the same time. The first one runs first and finishes 4 ms in, well within its period. The second one waits for it,
+    // and finishes 8 ms in, past its own deadline
+    CHECK(tasks[0].stats.runs == 10 && tasks[1].stats.runs == 10);
+    CHECK(tasks[0].stats.deadline_misses == 0);
+    CHECK(tasks[1].stats.deadline_misses == 10);
+}
+
+static void test_late_timer_counts_from_its_deadline(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "rx",       .function = task_0, .events = SYSTEM_EVENT_UART_RX },
+        { .name = "periodic", .function = task_1, .period = 10, .deadline = 3000 },
+    };
+    reset_system();
+    run_micros[0] = 7000;
+    run_micros[1] = 1000;
+    rx_event_micros = 18500;
+    scheduler_setup(tasks, 2);
+    run_scheduler_until(30000);
+
+    // The rx task runs from 18.5 ms to 25.5 ms, so the wheel only gets to the periodic task's 20 ms deadline at 26 ms. It became
+    // ready at 20 ms all the same, and finishing at 27 ms misses its 3 ms deadline. The runs before and after are on time
+    CHECK(tasks[0].stats.runs == 1);
+    CHECK(tasks[0].stats.deadline_misses == 0);     // Neither a deadline nor a period: never late
+    CHECK(tasks[1].stats.runs == 3);                // At 10, 26 and 30 ms
+    CHECK(tasks[1].stats.deadline_misses == 1);
+}
+
+static void test_stall(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "rx",       .function = task_0, .events = SYSTEM_EVENT_UART_RX },
+        { .name = "periodic", .function = task_1, .period = 10 },
+    };
+    reset_system();
+    run_micros[0] = 95000;
+    run_micros[1] = 100;
+    rx_event_micros = 25500;
+    scheduler_setup(tasks, 2);
+    run_scheduler_until(200000);
+
+    // Ran at 10 and 20 ms, then once at 121 ms for all of the periods the 95 ms stall took up, and on its phase from 130 to 200 ms
+    CHECK(tasks[1].stats.runs == 2 + 1 + 8);
+    CHECK(tasks[1].timer.deadline == 210);
+    CHECK(tasks[1].stats.deadline_misses == 0);     // Ready at 120 ms, the last period it missed, when it runs again
+    CHECK(tasks[0].stats.max_run_micros == 95000);
+    CHECK(scheduler_get_idle_micros() + total_run_micros(tasks, 2) == now_micros);
+}
+
+static void test_more_work(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "batch",    .function = task_0, .events = SYSTEM_EVENT_UART_RX },
+        { .name = "periodic", .function = task_1, .period = 1 },
+    };
+    reset_system();
+    run_micros[0] = 400;
+    run_micros[1] = 10;
+    more_work[0] = 3;
+    rx_event_micros = 2200;
+    scheduler_setup(tasks, 2);
+    run_scheduler_until(10000);
+
+    // Runs four times in a row from the one event, 1.6 ms in all, with no sleep in between. The periodic task gets its turn on the
+    // passes in between, and its tick during the batch isn't lost
+    CHECK(tasks[0].stats.runs == 4);
+    CHECK(tasks[0].stats.total_run_micros == 4 * 400);
+    CHECK(tasks[1].stats.runs == 10);
+    CHECK(more_work[0] == 0);
+    CHECK(scheduler_get_idle_micros() + total_run_micros(tasks, 2) == now_micros);
+}
+
+static void test_more_work_without_sleeping(void) {
+    static scheduler_task_t tasks[] = {
+        { .name = "batch", .function = task_0, .events = SYSTEM_EVENT_UART_RX },
+    };
+    reset_system();
+    run_micros[0] = 100;
+    more_work[0] = 5;
+    rx_event_micros = 500;
+    scheduler_setup(tasks, 1);
+
+    run_scheduler_until(1);     // Sleeps once, until the event, and then goes back to sleep after the last run
+    CHECK(tasks[0].stats.runs == 6);
+    CHECK(sleeps_at_run[0] == 1);
+    CHECK(now_micros == 500 + 6 * 100);
+}
+
+int main(void) {
+    test_periodic_task();
+    test_deadline_misses();
+    test_late_timer_counts_from_its_deadline();
+    test_stall();
+    test_more_work();
+    test_more_work_without_sleeping();
+    return check_report("scheduler-test");
+}
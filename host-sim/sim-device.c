@@ -0,0 +1,249 @@
+// A device on a pseudo terminal, for fw-updater to update without a board. It's the target's own update state machine (bl-update.c),
+// link layer (comms.c) and flash driver (bl-flash.c) built for the host, with the flash modelled in ram (flash-model.c), and the uart
+// and the clock provided here. It prints the path of its end of the terminal, which fw-updater opens like any serial port, then serves
+// update sessions into the staging slot, one after the other like the application's update agent does. The flash is kept between
+// sessions, so a later session of the same image picks up where the earlier one got to. The active slot is left erased, so there's
+// no running image to copy unchanged sectors from, and every sector is sent. Exits with 1 if any session failed. run-sessions.sh
+// runs several of these against a single fw-updater.
+//
+// usage: sim-device [--sessions <n>] [--dump <file>]
+//   --sessions  How many update sessions to serve before exiting. 1 by default
+//   --dump      Write the staging slot to a file on exit, to compare with the image
+
+#define _XOPEN_SOURCE 600   // posix_openpt() and friends
+#define _DEFAULT_SOURCE     // cfmakeraw()
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "core/bl-update.h"
+#include "core/firmware-info.h"
+#include "core/system.h"
+#include "core/uart.h"
+#include "flash-model.h"
+
+#define LINGER_TIME     (500)   // msec. Longer than the target's, since a host under load may be slow to ask for our stats
+#define RX_BUFFER_SIZE  (1024)
+
+static int terminal = -1;       // Our end of the pseudo terminal
+static uint8_t rx_buffer[RX_BUFFER_SIZE];
+static uint32_t rx_start = 0;
+static uint32_t rx_end = 0;
+static uart_stats_t uart_stats = {0};
+static uint32_t pending_events = 0;
+static uint64_t start_micros = 0;
+
+static uint64_t monotonic_micros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+/**
+ * @brief Open a pseudo terminal and print the path of the end the host opens. That end is put in raw mode before the host gets to it:
+ *        a terminal echoes by default, and would send the host's bytes straight back at it. We keep a handle on it as well, so the
+ *        terminal and its settings outlast each of the host's sessions
+ */
+static void open_terminal(void) {
+    terminal = posix_openpt(O_RDWR | O_NOCTTY);
+    if(terminal < 0 || grantpt(terminal) != 0 || unlockpt(terminal) != 0) {
+        perror("sim-device: can't open a pseudo terminal");
+        exit(1);
+    }
+
+    const char* path = ptsname(terminal);
+    const int host_end = open(path, O_RDWR | O_NOCTTY);
+    struct termios settings;
+    if(host_end < 0 || tcgetattr(host_end, &settings) != 0) {
+        perror("sim-device: can't set up the pseudo terminal");
+        exit(1);
+    }
+    cfmakeraw(&settings);
+    tcsetattr(host_end, TCSANOW, &settings);
+    fcntl(terminal, F_SETFL, O_NONBLOCK);
+
+    printf("%s\n", path);
+    fflush(stdout);
+}
+
+/**
+ * @brief What the receive interrupt and ring buffer do on the target: take in whatever the host has sent so far, as far as there's room
+ */
+static void receive(void) {
+    if(rx_start == rx_end) {
+        rx_start = 0;
+        rx_end = 0;
+    }
+    const ssize_t received = read(terminal, &rx_buffer[rx_end], RX_BUFFER_SIZE - rx_end);
+    if(received > 0) {
+        rx_end += (uint32_t)received;
+        uart_stats.bytes_received += (uint32_t)received;
+        system_set_events(SYSTEM_EVENT_UART_RX);
+    }
+}
+
+void uart_setup(void) {}
+
+void uart_teardown(void) {}
+
+void uart_write(uint8_t* data, const uint32_t length) {
+    uint32_t written = 0;
+    while(written < length) {
+        const ssize_t result = write(terminal, &data[written], length - written);
+        if(result > 0) {
+            written += (uint32_t)result;
+        } else if(result < 0 && errno == EAGAIN) {
+            struct pollfd writable = { .fd = terminal, .events = POLLOUT };
+            poll(&writable, 1, 1);  // The host isn't reading. Like a blocking uart write, we wait for it
+        } else {
+            perror("sim-device: write");
+            exit(1);
+        }
+    }
+}
+
+void uart_write_byte(uint8_t data) {
+    uart_write(&data, 1);
+}
+
+uint32_t uart_read(uint8_t* data, const uint32_t length) {
+    receive();
+    uint32_t count = rx_end - rx_start;
+    if(count > length) {
+        count = length;
+    }
+    memcpy(data, &rx_buffer[rx_start], count);
+    rx_start += count;
+    return count;
+}
+
+uint8_t uart_read_byte(void) {
+    uint8_t data = 0;
+    uart_read(&data, 1);
+    return data;
+}
+
+bool uart_data_available(void) {
+    receive();
+    return rx_start != rx_end;
+}
+
+uart_stats_t uart_get_stats(void) {
+    return uart_stats;
+}
+
+void system_setup(void) {
+    start_micros = monotonic_micros();
+}
+
+void system_teardown(void) {}
+
+void system_set_clock_profile(const system_clock_profile_t profile) {
+    (void)profile;
+}
+
+uint64_t system_get_ticks(void) {
+    return system_get_micros() / 1000;
+}
+
+uint64_t system_get_micros(void) {
+    return monotonic_micros() - start_micros;
+}
+
+void system_delay(uint64_t milliseconds) {
+    const struct timespec delay = { .tv_sec = milliseconds / 1000, .tv_nsec = (milliseconds % 1000) * 1000000 };
+    nanosleep(&delay, NULL);
+}
+
+void system_delay_micros(uint32_t microseconds) {
+    const struct timespec delay = { .tv_sec = microseconds / 1000000, .tv_nsec = (microseconds % 1000000) * 1000 };
+    nanosleep(&delay, NULL);
+}
+
+void system_set_events(const uint32_t events) {
+    pending_events |= events;
+}
+
+/**
+ * @brief Sleep until the host sends something, or for a millisecond, which is when the systick would have woken us on the target
+ */
+uint32_t system_wait_for_events(void) {
+    while(pending_events == 0) {
+        struct pollfd readable = { .fd = terminal, .events = POLLIN };
+        if(poll(&readable, 1, 1) > 0) {
+            system_set_events(SYSTEM_EVENT_UART_RX);
+        } else {
+            system_set_events(SYSTEM_EVENT_TICK);
+        }
+    }
+    return system_take_events();
+}
+
+uint32_t system_take_events(void) {
+    const uint32_t events = pending_events;
+    pending_events = 0;
+    return events;
+}
+
+uint32_t system_get_max_wake_latency(void) {
+    return 0;   // Nothing to measure here
+}
+
+// comms.c's breakpoint, for conditions that should never happen
+void host_breakpoint(void) {
+    fprintf(stderr, "sim-device: hit the breakpoint in comms.c\n");
+    abort();
+}
+
+static void dump_staging_slot(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if(file == NULL || fwrite((const void*)(uintptr_t)STAGING_SLOT_ADDRESS, 1, SLOT_SIZE, file) != SLOT_SIZE) {
+        perror("sim-device: can't write the dump");
+        exit(1);
+    }
+    fclose(file);
+}
+
+int main(int argc, char** argv) {
+    uint32_t sessions = 1;
+    const char* dump_path = NULL;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+            sessions = strtoul(argv[++i], NULL, 0);
+        } else if(strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: sim-device [--sessions <n>] [--dump <file>]\n");
+            return 2;
+        }
+    }
+
+    flash_model_setup();
+    system_setup();
+    open_terminal();
+
+    bool has_failed = false;
+    for(uint32_t session = 0; session < sessions; session++) {
+        bl_update_result_t result = BL_Update_InProgress;
+        bl_update_setup(STAGING_SLOT_ADDRESS, BL_UPDATE_WAIT_FOREVER);
+        while((result = bl_update_run()) == BL_Update_InProgress) {
+            if(bl_update_can_sleep()) {
+                system_wait_for_events();
+            }
+        }
+        bl_update_linger(LINGER_TIME);
+
+        fprintf(stderr, "sim-device: session %u %s\n", session + 1, (result == BL_Update_Succeeded) ? "succeeded" : "failed");
+        has_failed |= (result != BL_Update_Succeeded);
+    }
+
+    if(dump_path != NULL) {
+        dump_staging_slot(dump_path);
+    }
+    return has_failed ? 1 : 0;
+}
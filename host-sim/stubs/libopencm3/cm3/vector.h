@@ -0,0 +1,16 @@
+#ifndef INC_HOST_SIM_VECTOR_H
+#define INC_HOST_SIM_VECTOR_H
+
+#include <stdint.h>
+
+// firmware-info.h sizes the vector table to find the firmware info in an image. Nothing built for the host looks there, so the
+// table only has to exist. Its real layout (and size) is in libopencm3's cm3/vector.h
+
+typedef void (*vector_table_entry_t)(void);
+
+typedef struct {
+    uint32_t initial_sp_value;
+    vector_table_entry_t entries[111];
+} vector_table_t;
+
+#endif // INC_HOST_SIM_VECTOR_H
@@ -0,0 +1,51 @@
+#ifndef INC_HOST_SIM_FLASH_H
+#define INC_HOST_SIM_FLASH_H
+
+#include <stdint.h>
+#include <libopencm3/stm32/memorymap.h>    // As libopencm3's own flash.h does
+
+// Just enough of libopencm3's flash.h for the target's bl-flash.c to build on the host. The registers are plain variables, and the
+// functions are implemented by flash-model.c. Values are the reference manual's, so the target code's register arithmetic still holds
+
+extern volatile uint32_t host_flash_acr;
+extern volatile uint32_t host_flash_cr;
+extern volatile uint32_t host_flash_sr;
+#define FLASH_ACR               host_flash_acr
+#define FLASH_CR                host_flash_cr
+#define FLASH_SR                host_flash_sr
+
+#define FLASH_ACR_ICEN          (1 << 9)
+#define FLASH_ACR_DCEN          (1 << 10)
+#define FLASH_ACR_ICRST         (1 << 11)
+#define FLASH_ACR_DCRST         (1 << 12)
+
+#define FLASH_SR_BSY            (1 << 16)
+#define FLASH_SR_PGSERR         (1 << 7)
+#define FLASH_SR_PGPERR         (1 << 6)
+#define FLASH_SR_PGAERR         (1 << 5)
+#define FLASH_SR_WRPERR         (1 << 4)
+#define FLASH_SR_OPERR          (1 << 1)
+#define FLASH_SR_EOP            (1 << 0)
+
+#define FLASH_CR_SNB_SHIFT      3
+#define FLASH_CR_SNB_MASK       0x1f
+#define FLASH_CR_PROGRAM_SHIFT  8
+#define FLASH_CR_PROGRAM_MASK   0x3
+#define FLASH_CR_PROGRAM_X32    2
+#define FLASH_CR_SER            (1 << 1)
+#define FLASH_CR_STRT           (1 << 16)
+
+void flash_unlock(void);
+void flash_lock(void);
+void flash_wait_for_last_operation(void);
+void flash_clear_status_flags(void);
+void flash_erase_sector(uint8_t sector, uint32_t program_size);
+void flash_program_word(uint32_t address, uint32_t data);
+void flash_icache_enable(void);
+void flash_icache_disable(void);
+void flash_icache_reset(void);
+void flash_dcache_enable(void);
+void flash_dcache_disable(void);
+void flash_dcache_reset(void);
+
+#endif // INC_HOST_SIM_FLASH_H
@@ -0,0 +1,8 @@
+#ifndef INC_HOST_SIM_MEMORYMAP_H
+#define INC_HOST_SIM_MEMORYMAP_H
+
+// Just the base of the flash, where flash-model.c maps its copy of it
+
+#define FLASH_BASE      (0x08000000U)
+
+#endif // INC_HOST_SIM_MEMORYMAP_H
@@ -0,0 +1,272 @@
+// Tests of timer-wheel.c against a clock the test moves by hand: timers fire on the tick of their deadline and only then, also when
+// the deadline is more than a lap of the wheel away, periodic timers are re-armed on their phase, a main loop that fell behind
+// (by less or more than a lap) calls each due timer once, and callbacks can start and stop timers in the slot being gone through,
+// also their own timer with no delay.
+// Ends with random timers checked against the ticks they should have fired on.
+//
+// usage: timer-wheel-test [--seed <n>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core/timer-wheel.h"
+#include "core/system.h"
+#include "check.h"
+
+#define WHEEL_SLOTS     (64)    // As in timer-wheel.c
+#define RANDOM_TIMERS   (32)
+#define RANDOM_TICKS    (5000)
+
+static uint64_t now_ticks = 0;
+
+uint64_t system_get_ticks(void) {
+    return now_ticks;
+}
+
+typedef struct fired_t {
+    uint32_t count;
+    uint64_t last_tick;
+} fired_t;
+
+static void record_fired(void* context) {
+    fired_t* fired = (fired_t*)context;
+    fired->count++;
+    fired->last_tick = now_ticks;
+}
+
+static void start_wheel(const uint64_t start_tick) {
+    now_ticks = start_tick;
+    timer_wheel_setup();
+}
+
+// Calls timer_wheel_update() on every tick up to and including the given one, like a main loop that keeps up
+static void run_until(const uint64_t tick) {
+    while(now_ticks < tick) {
+        now_ticks++;
+        timer_wheel_update();
+    }
+}
+
+static void test_one_shot(void) {
+    timer_wheel_timer_t timer = {0};
+    fired_t fired = {0};
+    start_wheel(1000);
+    timer_wheel_start(&timer, 5, 0, record_fired, &fired);
+    timer_wheel_update();
+
+    run_until(1004);
+    CHECK(fired.count == 0);
+    run_until(1005);
+    CHECK(fired.count == 1 && fired.last_tick == 1005);
+    CHECK(!timer.is_running);
+    run_until(1005 + 3 * WHEEL_SLOTS);
+    CHECK(fired.count == 1);                // Not again when its slot comes round
+}
+
+static void test_slot_wrap(void) {
+    timer_wheel_timer_t far = {0};
+    timer_wheel_timer_t near_end = {0};
+    fired_t far_fired = {0};
+    fired_t near_end_fired = {0};
+    start_wheel(WHEEL_SLOTS - 3);           // Close to the end of the ring, so the deadlines below land in slots before the current one
+    timer_wheel_start(&far, 2 * WHEEL_SLOTS + 10, 0, record_fired, &far_fired);
+    timer_wheel_start(&near_end, 5, 0, record_fired, &near_end_fired);
+
+    run_until(WHEEL_SLOTS + 2);
+    CHECK(near_end_fired.count == 1 && near_end_fired.last_tick == WHEEL_SLOTS + 2);
+
+    // The far timer's slot comes round twice before its deadline. It has to wait in it
+    run_until(3 * WHEEL_SLOTS + 6);
+    CHECK(far_fired.count == 0);
+    run_until(3 * WHEEL_SLOTS + 7);
+    CHECK(far_fired.count == 1 && far_fired.last_tick == 3 * WHEEL_SLOTS + 7);
+}
+
+static void test_periodic(void) {
+    timer_wheel_timer_t timer = {0};
+    fired_t fired = {0};
+    start_wheel(0);
+    timer_wheel_start(&timer, 3, 10, record_fired, &fired);
+
+    run_until(3);
+    CHECK(fired.count == 1 && fired.last_tick == 3);
+    run_until(1003);
+    CHECK(fired.count == 101 && fired.last_tick == 1003);
+    CHECK(timer.is_running);
+    CHECK(timer.deadline == 1013);
+
+    timer_wheel_start(&timer, 1, 7, record_fired, &fired);   // Restarting a running timer replaces its schedule
+    run_until(1004);
+    CHECK(fired.count == 102 && fired.last_tick == 1004);
+    run_until(1013);
+    CHECK(fired.count == 103 && fired.last_tick == 1011);     // And not on the old one's 1013
+
+    timer_wheel_stop(&timer);
+    run_until(1100);
+    CHECK(fired.count == 103);
+    CHECK(!timer.is_running);
+}
+
+static void test_falling_behind(void) {
+    timer_wheel_timer_t periodic = {0};
+    timer_wheel_timer_t one_shot = {0};
+    fired_t periodic_fired = {0};
+    fired_t one_shot_fired = {0};
+    start_wheel(0);
+    timer_wheel_start(&periodic, 10, 10, record_fired, &periodic_fired);
+    timer_wheel_start(&one_shot, 20, 0, record_fired, &one_shot_fired);
+
+    // Less than a lap late: called once each, and the periodic timer skips the periods it missed but keeps its phase
+    now_ticks = 35;
+    timer_wheel_update();
+    CHECK(periodic_fired.count == 1 && one_shot_fired.count == 1);
+    CHECK(periodic.deadline == 40);
+    run_until(40);
+    CHECK(periodic_fired.count == 2 && periodic_fired.last_tick == 40);
+
+    // More than a lap late, such as a stall: still once each, whichever slot they're in
+    timer_wheel_start(&one_shot, 90, 0, record_fired, &one_shot_fired);
+    now_ticks = 40 + 5 * WHEEL_SLOTS + 3;
+    timer_wheel_update();
+    CHECK(periodic_fired.count == 3);
+    CHECK(one_shot_fired.count == 2);
+    CHECK(periodic.deadline == 40 + 5 * WHEEL_SLOTS + 10);
+    CHECK(periodic.deadline % 10 == 0);
+
+    // Nothing fires early after catching up
+    run_until(periodic.deadline - 1);
+    CHECK(periodic_fired.count == 3);
+}
+
+static timer_wheel_timer_t chain_timers[3];
+static fired_t chain_fired[3];
+
+// First in the slot: stops the second one, which is due on the same tick, and starts the third one for right away, which is moved
+// to the next tick rather than the slot being gone through
+static void chain_callback(void* context) {
+    record_fired(context);
+    timer_wheel_stop(&chain_timers[1]);
+    timer_wheel_start(&chain_timers[2], 0, 0, record_fired, &chain_fired[2]);
+}
+
+static void test_callbacks_changing_timers(void) {
+    memset(chain_timers, 0, sizeof(chain_timers));
+    memset(chain_fired, 0, sizeof(chain_fired));
+    start_wheel(0);
+    timer_wheel_start(&chain_timers[1], 4, 0, record_fired, &chain_fired[1]);
+    timer_wheel_start(&chain_timers[0], 4, 0, chain_callback, &chain_fired[0]);   // Linked in front, so it's found first
+
+    run_until(4);
+    CHECK(chain_fired[0].count == 1);
+    CHECK(chain_fired[1].count == 0);
+    CHECK(chain_fired[2].count == 0 && chain_timers[2].deadline == 5);
+    run_until(5);
+    CHECK(chain_fired[2].count == 1 && chain_fired[2].last_tick == 5);
+
+    // Started after this tick's update, a timer due right away is moved to the next tick rather than waiting a lap in this one's slot
+    timer_wheel_start(&chain_timers[2], 0, 0, record_fired, &chain_fired[2]);
+    CHECK(chain_timers[2].deadline == 6);
+    run_until(6);
+    CHECK(chain_fired[2].count == 2 && chain_fired[2].last_tick == 6);
+    run_until(100);
+    CHECK(chain_fired[1].count == 0);
+}
+
+#define RESTART_LIMIT   (1000)  // Far more calls than the test can expect. Past it, the update would never have returned
+
+static timer_wheel_timer_t restarting_timer;
+static fired_t restarting_fired;
+
+// Starts its own timer again, due right away
+static void restart_callback(void* context) {
+    record_fired(context);
+    if(restarting_fired.count < RESTART_LIMIT) {
+        timer_wheel_start(&restarting_timer, 0, 0, restart_callback, context);
+    }
+}
+
+static void test_restart_from_own_callback(void) {
+    memset(&restarting_timer, 0, sizeof(restarting_timer));
+    memset(&restarting_fired, 0, sizeof(restarting_fired));
+    start_wheel(0);
+    timer_wheel_start(&restarting_timer, 2, 0, restart_callback, &restarting_fired);
+
+    // Once per update, on the next tick each time, instead of over and over in the slot being gone through
+    run_until(2);
+    CHECK(restarting_fired.count == 1 && restarting_fired.last_tick == 2);
+    CHECK(restarting_timer.is_running && restarting_timer.deadline == 3);
+    run_until(10);
+    CHECK(restarting_fired.count == 9 && restarting_fired.last_tick == 10);
+
+    // The same after falling behind: one call, and due on the tick after
+    now_ticks = 10 + 2 * WHEEL_SLOTS;
+    timer_wheel_update();
+    CHECK(restarting_fired.count == 10);
+    CHECK(restarting_timer.deadline == now_ticks + 1);
+    timer_wheel_stop(&restarting_timer);
+}
+
+/**
+ * @brief Timers with random delays and periods, and a main loop that sometimes falls behind by up to two laps. Each call has to come
+ *        on the first update at or after the deadline, and a periodic timer's next deadline has to be the first one on its phase
+ *        that's still ahead
+ */
+static void test_random_timers(void) {
+    static timer_wheel_timer_t timers[RANDOM_TIMERS];
+    static fired_t fired[RANDOM_TIMERS];
+    static uint64_t expected[RANDOM_TIMERS];    // Next deadline. Zero once a one-shot timer has fired
+    static uint32_t periods[RANDOM_TIMERS];
+
+    memset(timers, 0, sizeof(timers));
+    memset(fired, 0, sizeof(fired));
+    start_wheel(rand() % 1000);
+    for(uint32_t i = 0; i < RANDOM_TIMERS; i++) {
+        const uint32_t delay = rand() % (3 * WHEEL_SLOTS);
+        periods[i] = (rand() % 2) ? 1 + (rand() % (2 * WHEEL_SLOTS)) : 0;
+        expected[i] = now_ticks + delay;
+        timer_wheel_start(&timers[i], delay, periods[i], record_fired, &fired[i]);
+    }
+
+    const uint64_t end = now_ticks + RANDOM_TICKS;
+    while(now_ticks < end) {
+        const uint64_t previous = now_ticks;
+        now_ticks += (rand() % 10 == 0) ? 1 + (rand() % (2 * WHEEL_SLOTS)) : 1;
+        uint32_t counts[RANDOM_TIMERS];
+        for(uint32_t i = 0; i < RANDOM_TIMERS; i++) { counts[i] = fired[i].count; }
+        timer_wheel_update();
+
+        for(uint32_t i = 0; i < RANDOM_TIMERS; i++) {
+            const bool is_due = expected[i] != 0 && expected[i] <= now_ticks;
+            if(!CHECK((fired[i].count - counts[i]) == (is_due ? 1U : 0U))) {
+                printf("  timer %u, period %u, due %llu, update from %llu to %llu\n", i, periods[i],
+                       (unsigned long long)expected[i], (unsigned long long)previous, (unsigned long long)now_ticks);
+                return;
+            }
+            if(is_due) {
+                if(periods[i] == 0) {
+                    expected[i] = 0;
+                } else {
+                    while(expected[i] <= now_ticks) { expected[i] += periods[i]; }
+                    if(!CHECK(timers[i].deadline == expected[i])) { return; }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = 1;
+    if(argc == 3 && strcmp(argv[1], "--seed") == 0) {
+        seed = strtoul(argv[2], NULL, 0);
+    }
+    srand(seed);
+
+    test_one_shot();
+    test_slot_wrap();
+    test_periodic();
+    test_falling_behind();
+    test_callbacks_changing_timers();
+    test_restart_from_own_callback();
+    test_random_timers();
+    return check_report("timer-wheel-test");
+}
@@ -0,0 +1,24 @@
+#ifndef INC_BL_FLASH_H
+#define INC_BL_FLASH_H
+#include "common-defines.h"
+
+// Counted since boot. See BL_PACKET_STATS_REQ_DATA0
+typedef struct bl_flash_stats_t {
+    uint32_t erase_micros;          // Inside bl_flash_erase_sector()
+    uint32_t program_micros;        // Inside bl_flash_write() and bl_flash_flush(), staging included
+    uint32_t words_programmed;
+} bl_flash_stats_t;
+
+bool bl_flash_sector_for_address(const uint32_t address, uint8_t* sector);
+uint32_t bl_flash_sector_start_address(const uint8_t sector);
+uint32_t bl_flash_sector_end_address(const uint8_t sector);        // First address after the end of the sector
+uint32_t bl_flash_sector_max_erase_time(const uint8_t sector);     // msec
+void bl_flash_begin(void);                                         // Unlocks the flash for a whole update, instead of per write
+bool bl_flash_erase_sector(const uint8_t sector);                  // Blocks until the erase is done. false on a flash error
+void bl_flash_write(const uint32_t address, const uint8_t* data, const uint32_t length);   // Staged, programmed a word at a time
+void bl_flash_flush(void);                                         // Programs a staged partial word, padded with 0xff
+void bl_flash_end(void);                                           // Flushes and locks the flash
+const bl_flash_stats_t* bl_flash_get_stats(void);
+
+
+#endif // INC_BL_FLASH_H
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef INC_BL_UPDATE_H
+#define INC_BL_UPDATE_H
+#include "common-defines.h"
+
+// The firmware update state machine: sync with the host, check the device id and length, and receive the image into a slot.
+// Shared by the bootloader and the application's update agent, so the same host side updater talks to both
+
+typedef enum bl_update_result_t {
+    BL_Update_InProgress,
+    BL_Update_Succeeded,    // The whole image was received and written. Not validated yet
+    BL_Update_Failed,       // A NACK was sent to the host
+} bl_update_result_t;
+
+#define BL_UPDATE_WAIT_FOREVER (0)  // Sync window for when the host may show up at any time
+
+// The pages of counters a BL_PACKET_STATS_REQ_DATA0 can ask for, three little-endian uint32_t's each. All counted since boot
+#define BL_STATS_PAGE_LINK      (0)     // Packets received, crc failures, retransmit requests from the host. See comms_stats_t
+#define BL_STATS_PAGE_UART      (1)     // Bytes received, ring buffer drops, overruns. See uart_stats_t
+#define BL_STATS_PAGE_FLASH     (2)     // Erase usec, program usec, words programmed. See bl_flash_stats_t
+#define BL_STATS_PAGE_UPDATE    (3)     // MAC usec (validating images, bootloader only), acks that timed out, longest wake up latency in cpu cycles
+#define BL_STATS_PAGE_BENCHMARK (4)     // Cycles per AES block, crc8 packet and crc32 KiB, when built with RAMFUNC_BENCHMARK (bootloader only). Zeros otherwise
+#define BL_STATS_PAGE_COUNT     (5)
+
+void bl_update_setup(const uint32_t slot_start_address, const uint32_t sync_window);   // Doxygen style comment block in bl-update.c
+bl_update_result_t bl_update_run(void);                                                 // Call from the main loop until it's no longer in progress
+bool bl_update_can_sleep(void);                                                         // Nothing to do until the next interrupt. See system_wait_for_events()
+void bl_update_linger(const uint32_t milliseconds);                                     // Doxygen style comment block in bl-update.c
+void bl_update_add_mac_micros(const uint32_t micros);                                   // Time spent computing MACs, for the stats
+void bl_update_set_benchmark(const uint32_t aes_cycles, const uint32_t crc8_cycles, const uint32_t crc32_cycles);  // For the stats
+
+#endif // INC_BL_UPDATE_H
@@ -0,0 +1,12 @@
+#ifndef INC_BOOT_MAILBOX_H
+#define INC_BOOT_MAILBOX_H
+#include "common-defines.h"
+
+// A few bytes of ram at the very start of ram, reserved in both the bootloader's and the application's linkerscripts, so they're
+// at the same address in both and neither of them initializes or clears them. A reset leaves ram as it is, so the application
+// can leave the bootloader a note there before it resets. After a power-up, it holds whatever garbage ram came up with
+
+void boot_mailbox_request_update(void);         // Ask the bootloader to wait for the host after the next reset
+bool boot_mailbox_take_update_request(void);    // Whether an update was requested. Clears the request either way
+
+#endif // INC_BOOT_MAILBOX_H
@@ -0,0 +1,34 @@
+#ifndef INC_COMMS_H
+#define INC_COMMS_H
+
+#include "common-defines.h"
+
+// The packet sizes, and the link layer and bootloader packets (PACKET_ and BL_PACKET_), are defined in shared/protocol.json along with
+// what each packet carries. make generates generated.protocol.h from it, for us and for the host tools alike
+#include "generated.protocol.h"
+
+// Counted since boot, to see how well the link is doing. See BL_PACKET_STATS_REQ_DATA0
+typedef struct comms_stats_t {
+    uint32_t packets_received;      // With a valid crc, acks and retransmit requests included
+    uint32_t crc_failures;          // Each one answered with a retransmit request
+    uint32_t retx_requests;         // The other side asking us to retransmit
+} comms_stats_t;
+
+typedef struct comms_packet_t {     
+    uint8_t length;     
+    uint8_t data[PACKET_DATA_LENGTH];               // 16 bytes of data
+    uint8_t crc;        
+} comms_packet_t;       
+
+void comms_setup(void);                                // Setting up the packet state machine
+bool comms_packets_available(void);   
+void comms_write(comms_packet_t* packet);              // Sending a packet
+void comms_read(comms_packet_t* packet);               // Assumption: we used comms_packets_available() to make sure there's a packet to read
+void comms_update(void);                               // Communications related workload in the main while(1) loop
+bool comms_is_last_packet_acked(void);                 // Has the other side acknowledged the last packet we wrote
+uint8_t comms_compute_crc (comms_packet_t* packet);    // Compute the CRC for a packet that has its length and its data set up
+bool comms_is_single_byte_packet(const comms_packet_t* packet, uint8_t byte);    // Doxygen style comment block in comms.c
+void comms_create_single_byte_packet(comms_packet_t* packet, uint8_t byte);      // As name suggests
+const comms_stats_t* comms_get_stats(void);
+
+#endif  // INC_COMMS_H
\ No newline at end of file
@@ -3,7 +3,8 @@
 #include "common-defines.h"
 
 // In this project, the CRC8 algorithm is treated as a blackbox machine. We put some data in and get some CRC out.
-uint8_t crc8(uint8_t* data, uint32_t length);
-uint32_t crc32(const uint8_t* data, const uint32_t length);
+// Both run from ram: crc8 for every packet, crc32 over whole sectors for the digests
+RAMFUNC uint8_t crc8(uint8_t* data, uint32_t length);
+RAMFUNC uint32_t crc32(const uint8_t* data, const uint32_t length);
 
 #endif // INC_CRC_H
\ No newline at end of file
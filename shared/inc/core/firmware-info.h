@@ -4,13 +4,18 @@
 #include <libopencm3/stm32/flash.h>
 #include <libopencm3/cm3/vector.h>
 #include "common-defines.h"
+#include "generated.protocol.h"     // BOOTLOADER_SIZE, SLOT_SIZE, DEVICE_ID, IMAGE_MAC_SIZE, SECTOR_MAC_COUNT and FWINFO_SENTINEL, from shared/protocol.json
 
 #define ALIGNED(address, alignment) (((address) - 1U + (alignment)) & -(alignment)) // Same calculation as the linkerscript is doing when specifing .ALIGN(alignment)
 
-#define BOOTLOADER_SIZE                         (0x8000U)                           // 32KiB, reserved at the beginning of flash memory for our bootloader
 #define MAIN_APP_START_ADDRESS                  (FLASH_BASE + BOOTLOADER_SIZE)      // First address of our bootloader's main application
-#define MAX_FW_LENGTH                           ((1024U * 512U) - BOOTLOADER_SIZE)  // 512Kb flash (stm32f446xx)
-#define DEVICE_ID  (0x42)                       // Arbitrary value. One byte - allows the system to support 256 different devices.
+
+// The rest of flash is split into two slots. The application runs from the active slot (sectors 2-5, 224KiB). Updates are received
+// into the staging slot (sectors 6-7, 256KiB) while the application keeps running, and the bootloader copies a verified staged image
+// into the active slot on the next reset. Images are linked to run from the active slot, so the staging slot can't be booted in place
+#define ACTIVE_SLOT_ADDRESS                     (MAIN_APP_START_ADDRESS)
+#define STAGING_SLOT_ADDRESS                    (ACTIVE_SLOT_ADDRESS + SLOT_SIZE)
+#define MAX_FW_LENGTH                           (SLOT_SIZE)                         // Has to fit in the active slot
 
 #define FWINFO_ADDRESS                          (ALIGNED((MAIN_APP_START_ADDRESS + sizeof(vector_table_t)), 16))
 // The size of the vector table can also be evaluated looking at vector_table_t definition at from vector.h
@@ -24,11 +29,23 @@
                                                                                                                 // execpt those 2 parts
 
 #define SIGNATURE_ADDRESS                       (FWINFO_ADDRESS + sizeof(firmware_info_t))
+
+// Rather than a single MAC over the whole image, the image is MACed per active slot sector (16K, 16K, 64K and 128K, from the start
+// of the slot), and the signature is the MAC of the firmware info followed by this table of sector MACs. The bootloader can check
+// the signature against the table without reading the image, and then only read the sectors it needs to trust. The table sits
+// right after the signature, and like the firmware info and signature, it's left out of the MAC of the sector it's in
+#define SECTOR_MACS_ADDRESS                     (SIGNATURE_ADDRESS + IMAGE_MAC_SIZE)
+#define IMAGE_HEADER_END_ADDRESS                (SECTOR_MACS_ADDRESS + SECTOR_MAC_COUNT * IMAGE_MAC_SIZE)
+
+// Where the firmware info and signature are, relative to the start of a slot. The same in both slots, since the staging slot holds an exact copy of the image.
+// The host tools get FWINFO_OFFSET from firmware.elf instead, see shared/scripts/gen-protocol.py
+#define FWINFO_OFFSET                           (FWINFO_ADDRESS - MAIN_APP_START_ADDRESS)
+#define SIGNATURE_OFFSET                        (SIGNATURE_ADDRESS - MAIN_APP_START_ADDRESS)
+#define SECTOR_MACS_OFFSET                      (SECTOR_MACS_ADDRESS - MAIN_APP_START_ADDRESS)
+#define IMAGE_HEADER_END_OFFSET                 (IMAGE_HEADER_END_ADDRESS - MAIN_APP_START_ADDRESS)
 // We don't need the crc anymore in firmware_info_t, the AES-CBC-MAC is effectively going to function as a hash for us, and we will compare
 // it. If it doesn't match then we're not going to jump to the firmware. If there was an integrity problem, we would catch that in the CBC-MAC as well.
 
-#define FWINFO_SENTINEL                         (0xDEADC0DE)
-
 // This struct will be placed in memory directly after the interrupt vector table.
 // We want to make sure that the size of the struct is a multiple of 16 bytes - will ease the calculations when implementing AES.
 typedef struct firmware_info_t {
@@ -40,4 +57,13 @@ typedef struct firmware_info_t {
     //uint32_t crc32;       // Not used
 }firmware_info_t;
 
+// The first block MACed for every sector. Binding the sector's place and length into its MAC means a sector's data can't be passed off
+// as another sector's, and a CBC-MAC over a length prefixed message can't be extended
+typedef struct sector_mac_header_t {
+    uint32_t sentinel;  // FWINFO_SENTINEL
+    uint32_t index;     // Which entry of the table
+    uint32_t offset;    // Where the sector starts, relative to the start of the slot
+    uint32_t length;    // How many bytes of the image are in it. The last sector of an image is usually partial
+}sector_mac_header_t;
+
 #endif  // INC_FIRMWARE_INFO_H
\ No newline at end of file
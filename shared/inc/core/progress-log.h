@@ -0,0 +1,17 @@
+#ifndef INC_PROGRESS_LOG_H
+#define INC_PROGRESS_LOG_H
+#include <libopencm3/stm32/memorymap.h>
+#include "common-defines.h"
+
+// Flash sector 1 is kept for a log of how far the transfer of an image got, so an interrupted update can be resumed.
+// The bootloader itself fits in sector 0
+#define PROGRESS_LOG_SECTOR     (1)
+#define PROGRESS_LOG_ADDRESS    (FLASH_BASE + 0x4000U)
+#define PROGRESS_LOG_SIZE       (0x4000U)   // 16KiB
+
+bool progress_log_find(const uint32_t image_id, const uint32_t length, uint32_t* offset);
+void progress_log_append(const uint32_t image_id, const uint32_t length, const uint32_t offset);  // Only inside a bl_flash_begin() session
+void progress_log_request_install(const uint32_t image_id, const uint32_t length);                // Only inside a bl_flash_begin() session
+bool progress_log_take_install_request(void);                                                       // Only inside a bl_flash_begin() session
+
+#endif // INC_PROGRESS_LOG_H
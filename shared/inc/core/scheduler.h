@@ -0,0 +1,41 @@
+#ifndef INC_SCHEDULER_H
+#define INC_SCHEDULER_H
+#include "common-defines.h"
+#include "core/timer-wheel.h"
+
+// A cooperative, run-to-completion scheduler. The application lists its tasks in a static table, each one periodic, triggered by
+// events (SYSTEM_EVENT_ flags, see core/system.h), or both. A task runs until it returns, so keep each run short; a task with more
+// work than fits in one run says so and is run again on the next pass. Tasks earlier in the table run first.
+// The scheduler times every run, so we can see which task is taking up the CPU, and which ones are finishing late.
+// When no task is ready, the CPU sleeps until the next interrupt
+
+typedef bool (*scheduler_task_function_t)(void);   // Returns true if it has more work to do right away
+
+typedef struct scheduler_task_stats_t {
+    uint32_t runs;
+    uint32_t last_run_micros;       // Execution time of the last run
+    uint32_t max_run_micros;
+    uint64_t total_run_micros;      // Against scheduler_get_idle_micros(), how much of the CPU this task takes up
+    uint32_t deadline_misses;       // Runs that finished later than the deadline after the task became ready
+} scheduler_task_stats_t;
+
+typedef struct scheduler_task_t {
+    // Filled in by the application's task table
+    const char* name;
+    scheduler_task_function_t function;
+    uint32_t period;                // Milliseconds between runs. Zero for a task that only runs on events
+    uint32_t events;                // Any of these SYSTEM_EVENT_ flags makes the task ready. Zero for a task that only runs periodically
+    uint32_t deadline;              // Microseconds from becoming ready to finishing the run. Zero to use the period (no deadline if that's zero too)
+
+    // Kept by the scheduler
+    timer_wheel_timer_t timer;      // Makes a periodic task ready
+    bool is_ready;
+    uint64_t ready_time;            // Microseconds, when it became ready
+    scheduler_task_stats_t stats;
+} scheduler_task_t;
+
+void scheduler_setup(scheduler_task_t* task_table, const uint32_t count);  // Doxygen style comment block in scheduler.c
+void scheduler_run(void);                       // The main loop. Doesn't return
+uint64_t scheduler_get_idle_micros(void);       // Time spent asleep, with no task ready
+
+#endif // INC_SCHEDULER_H
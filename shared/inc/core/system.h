@@ -3,12 +3,28 @@
 
 #include "common-defines.h"
 
-#define CPU_FREQ     (84000000)
+#define CPU_FREQ     (84000000)     // In the default clock profile
 #define SYSTICK_FREQ (1000)
 
+// Events that interrupts flag for the main loop, so it can sleep until one of them happens
+#define SYSTEM_EVENT_TICK       (1U << 0)   // The systick. Every millisecond
+#define SYSTEM_EVENT_UART_RX    (1U << 1)   // A byte was received
+
+typedef enum system_clock_profile_t {
+    System_Clock_Default,   // 84 MHz (CPU_FREQ). What system_setup() starts with
+    System_Clock_Max,       // 180 MHz. For CPU bound work, such as validating an image
+} system_clock_profile_t;
+
 void system_setup(void);
 void system_teardown(void);
-uint64_t system_get_ticks(void);
+void system_set_clock_profile(const system_clock_profile_t profile);  // Doxygen style comment block in system.c
+uint64_t system_get_ticks(void);          // Milliseconds
+uint64_t system_get_micros(void);         // Microseconds. For timing hot paths and tuning the protocol
 void system_delay(uint64_t milliseconds);
+void system_delay_micros(uint32_t microseconds);
+void system_set_events(const uint32_t events);   // From interrupts
+uint32_t system_wait_for_events(void);           // Sleeps until there's at least one event. Doxygen style comment block in system.c
+uint32_t system_take_events(void);               // Like system_wait_for_events(), without sleeping. Zero if there are none
+uint32_t system_get_max_wake_latency(void);      // cpu cycles
 
 #endif  //  INC_SYSTEM_H
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef INC_TIMER_WHEEL_H
+#define INC_TIMER_WHEEL_H
+#include "common-defines.h"
+
+// Many software timers, checked with a single call from the main loop instead of each one being polled on its own. Timers are kept
+// in a ring of per-millisecond slots by their deadline, so starting or stopping one doesn't depend on how many others are running.
+// Callbacks run from timer_wheel_update(), in the main loop, never from an interrupt
+
+typedef void (*timer_wheel_callback_t)(void* context);
+
+typedef struct timer_wheel_timer_t {
+    struct timer_wheel_timer_t* next;   // The other timers in the same slot
+    struct timer_wheel_timer_t* prev;
+    uint64_t deadline;                  // In system ticks
+    uint32_t period;                    // Zero for a one-shot timer
+    timer_wheel_callback_t callback;
+    void* context;                      // Handed to the callback
+    bool is_running;
+} timer_wheel_timer_t;
+
+void timer_wheel_setup(void);
+void timer_wheel_start(timer_wheel_timer_t* timer, const uint32_t delay, const uint32_t period, const timer_wheel_callback_t callback, void* context);
+void timer_wheel_stop(timer_wheel_timer_t* timer);
+void timer_wheel_update(void);      // Call from the main loop. Runs the callbacks of every timer that's due
+
+#endif // INC_TIMER_WHEEL_H
@@ -0,0 +1,52 @@
+#ifndef INC_TRACE_H
+#define INC_TRACE_H
+#include "common-defines.h"
+
+// A ring of timestamped events in ram, to see where the time goes on real transfers: the uart interrupt, parsing packets, flash
+// erases and programming, MACs. Each record is an event, the cpu cycle count when it happened, and an argument that depends on the event.
+// The cycle counter is kept running while the cpu sleeps (see trace_setup()), so gaps spent waiting for the next byte count as well.
+// Built in with `make TRACE=1` (which defines TRACE_ENABLED). Otherwise TRACE() compiles to nothing, the ring takes no ram, and reads as empty.
+// The host reads the ring with BL_PACKET_TRACE_REQ_DATA0 (fw-updater --trace), and fw-updater/trace-decode.ts turns it into a timeline
+
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS (512)     // Power of 2. The oldest records are overwritten once it's full
+#endif
+
+#ifdef TRACE_ENABLED
+#define TRACE(event, argument)  trace_record((event), (argument))
+#else
+#define TRACE(event, argument)  ((void)sizeof(event), (void)sizeof(argument))   // Not evaluated, but what's only there for the trace still counts as used
+#endif
+
+// Keep in sync with fw-updater/trace-decode.ts
+typedef enum trace_event_t {
+    Trace_Event_None,
+    Trace_Event_ClockChange,        // Argument: old cpu frequency in MHz << 16 | new cpu frequency in MHz
+    Trace_Event_Freeze,             // The host started reading the ring. Argument: cpu frequency in MHz
+    Trace_Event_UartRx,             // Receive interrupt. Argument: the byte, | TRACE_UART_DROPPED | TRACE_UART_OVERRUN
+    Trace_Event_PacketStart,        // comms_update() took the first byte of a packet
+    Trace_Event_PacketDone,         // comms_update() handled a whole packet. Argument: its first data byte, or TRACE_PACKET_CRC_FAILURE
+    Trace_Event_FlashWriteStart,    // bl_flash_write(). Argument: bytes
+    Trace_Event_FlashWriteEnd,
+    Trace_Event_EraseStart,         // Argument: sector
+    Trace_Event_EraseEnd,           // Argument: 1 if the erase failed
+    Trace_Event_MacStart,           // cbc_mac_update(). Argument: bytes
+    Trace_Event_MacEnd,
+} trace_event_t;
+
+#define TRACE_UART_DROPPED          (1U << 8)   // The ring buffer was full
+#define TRACE_UART_OVERRUN          (1U << 9)   // The peripheral lost a byte before this one
+#define TRACE_PACKET_CRC_FAILURE    (0x100)
+
+typedef struct trace_record_t {
+    uint32_t cycles;                // DWT cycle counter, also counting through sleep. Wraps every 23 seconds at 180 MHz
+    uint32_t argument;
+    uint8_t event;                  // trace_event_t
+} trace_record_t;
+
+void trace_setup(void);                                                     // Doxygen style comment block in trace.c
+void trace_record(const trace_event_t event, const uint32_t argument);     // From interrupts too. Use TRACE() instead
+void trace_freeze(const bool is_frozen);                                   // Doxygen style comment block in trace.c
+bool trace_read(const uint32_t index, trace_record_t* record);             // Index 0 is the oldest record. False past the newest
+
+#endif // INC_TRACE_H
@@ -3,6 +3,13 @@
 
 #include "common-defines.h"
 
+// Counted since boot by the receive interrupt. See BL_PACKET_STATS_REQ_DATA0
+typedef struct uart_stats_t {
+    uint32_t bytes_received;
+    uint32_t ring_buffer_drops;     // Received, but the ring buffer was full. We didn't read it out fast enough
+    uint32_t overruns;              // A byte came in before the interrupt got to the one before it. The peripheral lost one
+} uart_stats_t;
+
 void uart_setup(void);
 void uart_teardown(void);
 void uart_write(uint8_t* data, const uint32_t length);
@@ -10,5 +17,6 @@ void uart_write_byte(uint8_t data);
 uint32_t uart_read(uint8_t* data, const uint32_t length);
 uint8_t uart_read_byte(void);
 bool uart_data_available(void);
+uart_stats_t uart_get_stats(void);
 
 #endif  //  INC_UART_H
\ No newline at end of file
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+# Generates the packet protocol and image layout definitions from shared/protocol.json, as a C header, a TypeScript module or a
+# Python module, so the firmware, fw-updater and the signer can't disagree on them. Given the application's firmware.elf, it also
+# defines FWINFO_OFFSET, where firmware_info ended up relative to the vector table, and fails if the signature and the table of
+# sector MACs are missing or aren't laid out after it the way the schema says. The firmware itself doesn't need it, it knows its
+# vector table's size.
+#
+# usage: gen-protocol.py <c|ts|python> [firmware.elf] > <output>
+
+import sys
+import os
+import json
+import struct
+import textwrap
+
+SCHEMA_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "protocol.json")
+COMMENT_WIDTH = 130
+
+def fail(message):
+    print("gen-protocol.py: " + message, file = sys.stderr)
+    exit(1)
+
+def evaluate(value, known):
+    if isinstance(value, int):
+        return value
+    if value.lower().startswith("0x"):
+        return int(value, 16)
+    try:
+        return eval(value, {"__builtins__": {}}, dict(known)) # Expressions of names defined earlier in the schema
+    except Exception:
+        fail("can't evaluate '%s'" % value)
+
+def spell(value, known):
+    # Hex stays hex, so the generated files read like the schema
+    if isinstance(value, str) and value.lower().startswith("0x"):
+        return value
+    return str(evaluate(value, known))
+
+def read_symbols(elf_file):
+    # Just enough ELF32 to read the symbol table, so any toolchain's (or none's) binutils will do
+    with open(elf_file, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 1:
+        fail("%s isn't a little-endian 32-bit ELF" % elf_file)
+    section_offset, = struct.unpack_from("<I", elf, 0x20)
+    section_size, section_count = struct.unpack_from("<HH", elf, 0x2E)
+    sections = [struct.unpack_from("<IIIIIIIIII", elf, section_offset + i * section_size) for i in range(section_count)]
+
+    symbols = {}
+    for section in sections:
+        if section[1] != 2: # SHT_SYMTAB
+            continue
+        strings = sections[section[6]]  # sh_link
+        for offset in range(section[4], section[4] + section[5], 16):
+            name_offset, value, size = struct.unpack_from("<III", elf, offset)
+            name_start = strings[4] + name_offset
+            name = elf[name_start:elf.index(b"\0", name_start)].decode()
+            if name:
+                symbols[name] = (value, size)
+    return symbols
+
+def elf_entries(elf_file, known):
+    symbols = read_symbols(elf_file)
+    for required in ["vector_table", "firmware_info", "firmware_signature", "firmware_sector_macs"]:
+        if required not in symbols:
+            fail("%s has no %s symbol" % (elf_file, required))
+
+    vector_table, _ = symbols["vector_table"]
+    fwinfo, fwinfo_size = symbols["firmware_info"]
+    if fwinfo_size != known["FWINFO_SIZE"]:
+        fail("firmware_info is %d bytes in %s, FWINFO_SIZE is %d" % (fwinfo_size, elf_file, known["FWINFO_SIZE"]))
+    if (fwinfo - vector_table) % known["IMAGE_MAC_SIZE"] != 0:
+        fail("firmware_info isn't aligned to an AES block in %s" % elf_file)
+
+    expected = [("firmware_signature", fwinfo + known["FWINFO_SIZE"], known["IMAGE_MAC_SIZE"]),
+                ("firmware_sector_macs", fwinfo + known["FWINFO_SIZE"] + known["IMAGE_MAC_SIZE"], known["SECTOR_MAC_COUNT"] * known["IMAGE_MAC_SIZE"])]
+    for name, address, size in expected:
+        if symbols[name] != (address, size):
+            fail("%s is %d bytes at 0x%08x in %s, expected %d bytes at 0x%08x" % (name, symbols[name][1], symbols[name][0], elf_file, size, address))
+
+    return {
+        "name": "Where firmware_info is, from the symbols of " + os.path.basename(elf_file),
+        "unsigned": True,
+        "entries": [{ "name": "FWINFO_OFFSET", "value": "0x%04X" % (fwinfo - vector_table), "doc": "firmware_info's distance from the vector table, the start of the image" }],
+    }
+
+def c_lines(group, known):
+    suffix = "U" if group.get("unsigned", False) else ""
+    lines = []
+    for entry in group["entries"]:
+        for line in textwrap.wrap(entry.get("doc", ""), COMMENT_WIDTH):
+            lines.append("// " + line)
+        name, value = entry["name"], entry["value"]
+        if isinstance(value, list):
+            if "count" in entry:
+                lines.append("#define %-40s (%d%s)" % (entry["count"], len(value), suffix))
+            for i, element in enumerate(value):
+                lines.append("#define %-40s (%s%s)" % ("%s_%d" % (name, i), spell(element, known), suffix))
+            lines.append("#define %-40s { %s }" % (name, ", ".join(spell(element, known) + suffix for element in value)))
+        else:
+            lines.append("#define %-40s (%s%s)" % (name, spell(value, known), suffix))
+    return lines
+
+def ts_lines(group, known):
+    lines = []
+    for entry in group["entries"]:
+        for line in textwrap.wrap(entry.get("doc", ""), COMMENT_WIDTH):
+            lines.append("// " + line)
+        name, value = entry["name"], entry["value"]
+        if isinstance(value, list):
+            if "count" in entry:
+                lines.append("export const %s = %d;" % (entry["count"], len(value)))
+            lines.append("export const %s = [%s];" % (name, ", ".join(spell(element, known) for element in value)))
+        else:
+            lines.append("export const %s = %s;" % (name, spell(value, known)))
+    return lines
+
+def python_lines(group, known):
+    lines = []
+    for entry in group["entries"]:
+        for line in textwrap.wrap(entry.get("doc", ""), COMMENT_WIDTH):
+            lines.append("# " + line)
+        name, value = entry["name"], entry["value"]
+        if isinstance(value, list):
+            if "count" in entry:
+                lines.append("%s = %d" % (entry["count"], len(value)))
+            lines.append("%s = [%s]" % (name, ", ".join(spell(element, known) for element in value)))
+        else:
+            lines.append("%s = %s" % (name, spell(value, known)))
+    return lines
+
+LANGUAGES = {
+    "c":      { "comment": "//", "lines": c_lines },
+    "ts":     { "comment": "//", "lines": ts_lines },
+    "python": { "comment": "#",  "lines": python_lines },
+}
+
+if len(sys.argv) < 2 or sys.argv[1] not in LANGUAGES:
+    print("usage: gen-protocol.py <c|ts|python> [firmware.elf]", file = sys.stderr)
+    exit(1)
+
+language = LANGUAGES[sys.argv[1]]
+elf_file = sys.argv[2] if len(sys.argv) > 2 else None
+
+with open(SCHEMA_FILE) as f:
+    schema = json.load(f)
+
+# Every scalar value, and the count of every list, by name, for expressions and the firmware.elf checks
+known = {}
+lists = {}
+groups = schema["groups"]
+for group in groups:
+    for entry in group["entries"]:
+        if isinstance(entry["value"], list):
+            if "count" in entry:
+                known[entry["count"]] = len(entry["value"])
+            lists[entry["name"]] = [evaluate(element, known) for element in entry["value"]]
+        else:
+            known[entry["name"]] = evaluate(entry["value"], known)
+
+# The image is MACed by the active slot's sectors, so they have to add up to the slot
+if sum(lists["IMAGE_SECTOR_SIZES"]) != known["SLOT_SIZE"]:
+    fail("IMAGE_SECTOR_SIZES add up to 0x%X, SLOT_SIZE is 0x%X" % (sum(lists["IMAGE_SECTOR_SIZES"]), known["SLOT_SIZE"]))
+if elf_file is not None:
+    groups = groups + [elf_entries(elf_file, known)]
+
+sources = "shared/protocol.json" + ("" if elf_file is None else " and " + os.path.basename(elf_file))
+out = ["%s Generated by shared/scripts/gen-protocol.py from %s. Don't edit, it's rewritten by make" % (language["comment"], sources)]
+if sys.argv[1] == "c":
+    out += ["#ifndef INC_GENERATED_PROTOCOL_H", "#define INC_GENERATED_PROTOCOL_H"]
+for group in groups:
+    out += ["", "%s %s" % (language["comment"], group["name"])]
+    out += language["lines"](group, known)
+if sys.argv[1] == "c":
+    out += ["", "#endif  // INC_GENERATED_PROTOCOL_H"]
+print("\n".join(out))
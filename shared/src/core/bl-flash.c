@@ -0,0 +1,188 @@
+#include <libopencm3/stm32/flash.h>
+#include <string.h>
+#include "core/bl-flash.h"
+#include "core/system.h"
+#include "core/trace.h"
+
+#define MAIN_APP_SECTOR_START (2)   // Sectors 0,1 reserved for our bootloader code portion
+#define MAIN_APP_SECTOR_END (7)
+
+#define FLASH_SR_ERRORS (FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR | FLASH_SR_OPERR)
+
+#define WORD_SIZE (4)           // We program with x32 parallelism, so a word at a time
+#define WORD_OFFSET_MASK (WORD_SIZE - 1)
+
+typedef struct bl_flash_sector_t {
+    uint32_t address;
+    uint32_t size;
+    uint32_t max_erase_time;    // msec. The datasheet's maximum sector erase time for x32 parallelism
+} bl_flash_sector_t;
+
+// STM32F446xx flash organization, taken from the "Flash module organization" table in the reference manual.
+// The sectors aren't the same size, so we can't compute a sector from an address with a simple division.
+// Erase times are from the "Flash memory programming" table in the datasheet
+static const bl_flash_sector_t sectors[] = {
+    { .address = 0x08000000, .size =  16 * 1024, .max_erase_time =  500 },  // Sector 0 - bootloader
+    { .address = 0x08004000, .size =  16 * 1024, .max_erase_time =  500 },  // Sector 1 - bootloader
+    { .address = 0x08008000, .size =  16 * 1024, .max_erase_time =  500 },  // Sector 2 - main application starts here
+    { .address = 0x0800C000, .size =  16 * 1024, .max_erase_time =  500 },  // Sector 3
+    { .address = 0x08010000, .size =  64 * 1024, .max_erase_time = 1100 },  // Sector 4
+    { .address = 0x08020000, .size = 128 * 1024, .max_erase_time = 2000 },  // Sector 5
+    { .address = 0x08040000, .size = 128 * 1024, .max_erase_time = 2000 },  // Sector 6
+    { .address = 0x08060000, .size = 128 * 1024, .max_erase_time = 2000 },  // Sector 7
+};
+
+// Write combining. Incoming data is gathered here until a whole word is ready, and only then programmed
+static uint8_t staged_word[WORD_SIZE];
+static uint32_t staged_address = 0;     // Word aligned address that staged_word goes into
+static bool has_staged_word = false;
+
+static bl_flash_stats_t stats = {0};
+static uint32_t caches_enabled = 0;     // FLASH_ACR_ICEN and FLASH_ACR_DCEN, as they were before caches_pause()
+
+/**
+ * @brief The ART accelerator's instruction and data caches keep lines of flash as they were when read. Once we erase or program,
+ *        the flash underneath them changes, and validating or digesting what we wrote could read the old contents out of a cache.
+ *        So they're switched off around every erase and program, and reset before they're switched back on, the way ST's HAL does it
+ *        (FLASH_FlushCaches()). A cache can only be reset while it's off
+ */
+static void caches_pause(void) {
+    caches_enabled = FLASH_ACR & (FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+    flash_icache_disable();
+    flash_dcache_disable();
+}
+
+static void caches_resume(void) {
+    flash_icache_reset();
+    flash_dcache_reset();
+    if(caches_enabled & FLASH_ACR_ICEN) { flash_icache_enable(); }
+    if(caches_enabled & FLASH_ACR_DCEN) { flash_dcache_enable(); }
+}
+
+/**
+ * @brief Find the main application sector that contains the given address
+ * @return false if the address isn't inside the main application's portion of flash
+ */
+bool bl_flash_sector_for_address(const uint32_t address, uint8_t* sector) {
+    for(uint8_t i = MAIN_APP_SECTOR_START; i <= MAIN_APP_SECTOR_END; i++) {
+        if(address >= sectors[i].address && address < sectors[i].address + sectors[i].size) {
+            *sector = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t bl_flash_sector_start_address(const uint8_t sector) {
+    return sectors[sector].address;
+}
+
+uint32_t bl_flash_sector_end_address(const uint8_t sector) {
+    return sectors[sector].address + sectors[sector].size;
+}
+
+uint32_t bl_flash_sector_max_erase_time(const uint8_t sector) {
+    return sectors[sector].max_erase_time;
+}
+
+/**
+ * @brief Start a programming session. The flash stays unlocked until bl_flash_end(), instead of being unlocked and locked
+ *        again for every single packet we write
+ */
+void bl_flash_begin(void) {
+    flash_unlock();                 // Writing the right KEY values into the flash key register. Values from reference manual
+    has_staged_word = false;
+}
+
+/**
+ * @brief Erase a single sector, and wait for it. The bootloader and the application both run from the one flash bank, so the core
+ *        stalls on its next instruction fetch from flash until the erase is over anyway. Only valid inside a bl_flash_begin() session
+ * @return false if the flash reported an error
+ */
+bool bl_flash_erase_sector(const uint8_t sector) {
+    flash_wait_for_last_operation();
+    flash_clear_status_flags();     // So a leftover error flag from a previous operation isn't blamed on this erase
+
+    const uint64_t start = system_get_micros();
+    TRACE(Trace_Event_EraseStart, sector);
+    caches_pause();
+    flash_erase_sector(sector, FLASH_CR_PROGRAM_X32);   // Given table 6 in the reference manual and that we don't have
+                                                        // an external voltage source, we can only do 32 bits at a time. 32-bit parallelism
+                                                        // This libopencm3 function does exactly what the RM specifies
+    caches_resume();
+    const bool has_error = (FLASH_SR & FLASH_SR_ERRORS) != 0;
+    TRACE(Trace_Event_EraseEnd, has_error);
+    stats.erase_micros += (uint32_t)(system_get_micros() - start);
+
+    flash_clear_status_flags();
+    return !has_error;
+}
+
+static void program_staged_word(void) {
+    if(!has_staged_word) { return; }
+
+    uint32_t word;
+    memcpy(&word, staged_word, WORD_SIZE);  // Little endian, so the byte at the lowest address lands in the lowest byte of the word
+    flash_program_word(staged_address, word);   // x32 parallelism: one program operation for 4 bytes, instead of flash_program()'s one per byte
+    has_staged_word = false;
+    stats.words_programmed++;
+}
+
+/**
+ * @brief Program the staged word, if there is one. Bytes of it that were never written are left as 0xff, which is what
+ *        erased flash reads as anyway
+ */
+void bl_flash_flush(void) {
+    if(!has_staged_word) { return; }
+
+    const uint64_t start = system_get_micros();
+    caches_pause();
+    program_staged_word();
+    caches_resume();
+    stats.program_micros += (uint32_t)(system_get_micros() - start);
+}
+
+/**
+ * @brief Write data into flash, a whole word at a time. Bytes are staged until their word is complete, so writes don't need
+ *        to be word aligned or a multiple of 4 bytes long. The last partial word only reaches flash on bl_flash_flush() or
+ *        bl_flash_end(). Writes are expected to move forward through flash, since a word can only be programmed once
+ *        between erases
+ */
+void bl_flash_write(const uint32_t address, const uint8_t* data, const uint32_t length) {
+    const uint64_t start = system_get_micros();     // Timed per call rather than per word, to keep the timing itself cheap
+    TRACE(Trace_Event_FlashWriteStart, length);
+    caches_pause();     // Once per write rather than per word, a packet at a time is a handful of words
+    for(uint32_t i = 0; i < length; i++) {
+        const uint32_t byte_address = address + i;
+        const uint32_t word_address = byte_address & ~WORD_OFFSET_MASK;
+
+        if(has_staged_word && staged_address != word_address) {
+            program_staged_word();  // Jumped to another word before filling this one
+        }
+        if(!has_staged_word) {
+            memset(staged_word, 0xff, WORD_SIZE);
+            staged_address = word_address;
+            has_staged_word = true;
+        }
+
+        staged_word[byte_address & WORD_OFFSET_MASK] = data[i];
+        if((byte_address & WORD_OFFSET_MASK) == WORD_OFFSET_MASK) {
+            program_staged_word();  // Word is complete
+        }
+    }
+    caches_resume();
+    stats.program_micros += (uint32_t)(system_get_micros() - start);
+    TRACE(Trace_Event_FlashWriteEnd, 0);
+}
+
+/**
+ * @brief Flush whatever is still staged and lock the flash again. Safe to call when no session was started
+ */
+void bl_flash_end(void) {
+    bl_flash_flush();
+    flash_lock();                   // Setting the bit in the Flash Control Register
+}
+
+const bl_flash_stats_t* bl_flash_get_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,858 @@
+#include <string.h>
+#include "core/bl-update.h"
+#include "core/comms.h"
+#include "core/bl-flash.h"
+#include "core/uart.h"
+#include "core/system.h"
+#include "core/simple-timer.h"
+#include "core/firmware-info.h"
+#include "core/crc.h"
+#include "core/progress-log.h"
+#include "core/trace.h"
+
+#define DEFAULT_TIMEOUT (60000)  // 60 secs
+#define ACK_TIMEOUT (100)        // msec. How long to wait for the host to ack a packet, when we can't move on before it's acked
+#define ACK_RETRIES (3)          // How many times such a packet is sent again for want of an ack, before the update is given up on
+#define ERASE_TIMEOUT_FACTOR (2) // The host allows an erase up to twice the datasheet's maximum before giving up on us
+#define CHECKPOINT_INTERVAL (1024) // Bytes. How often the transfer's progress is recorded, so an interrupted transfer can be resumed
+
+typedef enum bl_state_t {
+    BL_State_Sync,
+    BL_State_WaitForUpdateReq, // Req for request
+    BL_State_DevideIDReq,       // Req for request
+    BL_State_DevideIDRes,       // Res for response
+    BL_State_FWLengthReq,       // Req for request
+    BL_State_FWLengthRes,       // Res for response
+    BL_State_ImageIdRes,        // Res for response. Which image the host is sending, to know if we can resume an earlier transfer of it
+    BL_State_SectorMapRes,      // Res for response. Which of the sectors we sent digests of have to be written
+    BL_State_ReceiveFirmware,
+    BL_State_Done,
+    BL_State_Failed,
+} bl_state_t;
+
+static bl_state_t state = BL_State_Sync;
+static uint32_t slot_address = ACTIVE_SLOT_ADDRESS;   // Where the incoming image is written
+static uint32_t sync_timeout = BL_UPDATE_WAIT_FOREVER;
+static uint32_t fw_length = 0;
+static uint32_t image_id = 0;
+static uint32_t resume_offset = 0;                  // Where an earlier, interrupted transfer of this image got to
+static uint32_t checkpoint_offset = 0;              // Last recorded progress
+static uint32_t bytes_written = 0; // Number of firmware update bytes the had been written to flash. To know where our next write goes
+static uint32_t erased_end_address = ACTIVE_SLOT_ADDRESS;  // Everything from the start of the slot up to here has been erased
+static uint8_t pending_data[PACKET_DATA_LENGTH];    // A received data packet, waiting for its sector to be erased before it can be written
+static uint8_t pending_length = 0;
+static uint8_t erasing_sector = 0;
+static uint8_t sectors_erased = 0;
+static uint8_t image_sectors = 0;                   // How many of the image's sectors (the active slot's, see first_image_sector()) it spans
+static uint8_t sector_map = 0;                      // Bit n set: sector n of the image changed and has to be sent. Others are copied or skipped
+static uint8_t sectors_total = 0;                   // How many sectors we're going to erase. For progress reporting
+static uint8_t sync_seq[4] = {0};  // 4 bytes, initiated at 0
+static simple_timer_t timer;
+static simple_timer_t sync_timer;  // How long we listen for the host before giving up. Separate, so it can be shorter than DEFAULT_TIMEOUT
+static comms_packet_t temp_packet;  // Will be used both to send and receive. We only do 1 of them at a time
+static uint32_t ack_timeouts = 0;   // For the stats, since boot
+static uint32_t mac_micros = 0;     // For the stats, since boot
+static uint32_t benchmark_cycles[3] = {0};  // AES block, crc8 packet, crc32 KiB. See bl_update_set_benchmark()
+
+static void bootloading_fail(void) {
+    comms_create_single_byte_packet(&temp_packet, BL_PACKET_NACK_DATA0);
+    comms_write(&temp_packet);
+    if(state == BL_State_ReceiveFirmware && bytes_written > checkpoint_offset) {
+        // The link probably dropped. Record exactly how far we got, so the next attempt doesn't redo any of it
+        progress_log_append(image_id, fw_length, bytes_written);
+    }
+    bl_flash_end();         // In case we bailed out in the middle of an update, don't leave the flash unlocked
+    state = BL_State_Failed;
+}
+
+static void check_for_timeout(void) {
+    if(simple_timer_has_elapsed(&timer)) {
+        bootloading_fail();
+    }
+}
+
+static bool is_device_id_packet(const comms_packet_t* packet) {
+    if(packet->length != 2) { return false; }   // We expect two bytes - the first one specifies that the next one is a device id
+    if(packet->data[0] != BL_PACKET_DEVICE_ID_RES_DATA0) { return false; }
+    for(uint8_t i = 2; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_fw_length_packet(const comms_packet_t* packet) {
+    if(packet->length != 5) { return false; }   // 5 bytes: the first identifies it as a fw_length packet, the other 4 are a uint32_t length
+    if(packet->data[0] != BL_PACKET_FW_LENGTH_RES_DATA0) { return false; }
+    for(uint8_t i = 5; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void write_u32_le(uint8_t* dest, const uint32_t value) {
+    // Little endian, like the fw length packet we're receiving
+    dest[0] = (value)       & 0xff;
+    dest[1] = (value >> 8)  & 0xff;
+    dest[2] = (value >> 16) & 0xff;
+    dest[3] = (value >> 24) & 0xff;
+}
+
+static void create_erase_busy_packet(comms_packet_t* packet, const uint8_t sector, const uint32_t timeout) {
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 6;     // 6 bytes: packet type, the sector being erased, and a uint32_t of how long the host should allow for it in msec
+    packet->data[0] = BL_PACKET_ERASE_BUSY_DATA0;
+    packet->data[1] = sector;
+    write_u32_le(&packet->data[2], timeout);
+    packet->crc = comms_compute_crc(packet);
+}
+
+static void create_erase_complete_packet(comms_packet_t* packet, const uint32_t erase_duration) {
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 8;     // 8 bytes: packet type, a uint32_t erase duration in msec, the sector, sectors erased so far, and sectors in total
+    packet->data[0] = BL_PACKET_ERASE_COMPLETE_DATA0;
+    write_u32_le(&packet->data[1], erase_duration);
+    packet->data[5] = erasing_sector;
+    packet->data[6] = sectors_erased;
+    packet->data[7] = sectors_total;
+    packet->crc = comms_compute_crc(packet);
+}
+
+static bool is_image_id_packet(const comms_packet_t* packet) {
+    if(packet->length != 5) { return false; }   // 5 bytes: the first identifies it as an image id packet, the other 4 are a uint32_t id
+    if(packet->data[0] != BL_PACKET_IMAGE_ID_RES_DATA0) { return false; }
+    for(uint8_t i = 5; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void create_resume_packet(comms_packet_t* packet, const uint32_t offset) {
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 5;     // 5 bytes: packet type, and a uint32_t of the offset in the image the transfer resumes from
+    packet->data[0] = BL_PACKET_RESUME_DATA0;
+    write_u32_le(&packet->data[1], offset);
+    packet->crc = comms_compute_crc(packet);
+}
+
+static bool is_sector_map_packet(const comms_packet_t* packet) {
+    if(packet->length != 2) { return false; }   // We expect two bytes - the first one specifies that the next one is a sector bitmap
+    if(packet->data[0] != BL_PACKET_SECTOR_MAP_RES_DATA0) { return false; }
+    for(uint8_t i = 2; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void create_sector_digest_packet(comms_packet_t* packet, const uint8_t index, const uint32_t offset, const uint32_t size, const uint32_t digest) {
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 14;    // 14 bytes: packet type, the sector's index in the image, and uint32_t's of its offset, size and crc32
+    packet->data[0] = BL_PACKET_SECTOR_DIGEST_DATA0;
+    packet->data[1] = index;
+    write_u32_le(&packet->data[2], offset);
+    write_u32_le(&packet->data[6], size);
+    write_u32_le(&packet->data[10], digest);
+    packet->crc = comms_compute_crc(packet);
+}
+
+// The image is split into the active slot's sectors (16K, 16K, 64K and 128K), like its sector MACs, whichever slot it's written
+// to. Offsets in the image are the same in both slots. The staging slot's own sectors are 128K each, so they'd be too coarse to
+// tell what changed by
+static uint8_t first_image_sector(void) {
+    uint8_t sector = 0;
+    bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS, &sector);
+    return sector;
+}
+
+static uint8_t count_sectors(const uint32_t length) {
+    uint8_t first_sector = 0;
+    uint8_t last_sector = 0;
+    if(length == 0) { return 0; }
+    if(!bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS, &first_sector)) { return 0; }
+    if(!bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS + length - 1, &last_sector)) { return 0; }
+    return last_sector - first_sector + 1;  // The main application's sectors are numbered contiguously
+}
+
+/**
+ * @brief Wait for the host to ack the packet we just wrote, for packets we can't move on from before they're acked. Only the last
+ *        packet written can be retransmitted, so going on without the ack would leave a late retransmit request nothing but the
+ *        wrong packet to send. The packet is sent again after every ACK_TIMEOUT without an ack, up to ACK_RETRIES times
+ * @return false if it never got acked. The caller fails the update
+ */
+static bool wait_for_ack(comms_packet_t* packet) {
+    for(uint8_t attempt = 0; attempt <= ACK_RETRIES; attempt++) {
+        if(attempt > 0) {
+            ack_timeouts++;
+            comms_write(packet);
+        }
+
+        simple_timer_t ack_timer;
+        simple_timer_setup(&ack_timer, ACK_TIMEOUT, false);
+        while(!comms_is_last_packet_acked() && !simple_timer_has_elapsed(&ack_timer)) {
+            comms_update();
+        }
+        if(comms_is_last_packet_acked()) {
+            return true;
+        }
+    }
+    ack_timeouts++;
+    return false;
+}
+
+static bool is_stats_request_packet(const comms_packet_t* packet) {
+    if(packet->length != 2) { return false; }   // We expect two bytes - the first one specifies that the next one is a page number
+    if(packet->data[0] != BL_PACKET_STATS_REQ_DATA0) { return false; }
+    for(uint8_t i = 2; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void create_stats_packet(comms_packet_t* packet, const uint8_t page) {
+    uint32_t counters[3] = {0};
+    uint8_t counter_count = 3;
+
+    switch(page) {
+        case BL_STATS_PAGE_LINK: {
+            const comms_stats_t* link = comms_get_stats();
+            counters[0] = link->packets_received;
+            counters[1] = link->crc_failures;
+            counters[2] = link->retx_requests;
+        } break;
+
+        case BL_STATS_PAGE_UART: {
+            const uart_stats_t uart = uart_get_stats();
+            counters[0] = uart.bytes_received;
+            counters[1] = uart.ring_buffer_drops;
+            counters[2] = uart.overruns;
+        } break;
+
+        case BL_STATS_PAGE_FLASH: {
+            const bl_flash_stats_t* flash = bl_flash_get_stats();
+            counters[0] = flash->erase_micros;
+            counters[1] = flash->program_micros;
+            counters[2] = flash->words_programmed;
+        } break;
+
+        case BL_STATS_PAGE_UPDATE: {
+            counters[0] = mac_micros;
+            counters[1] = ack_timeouts;
+            counters[2] = system_get_max_wake_latency();
+        } break;
+
+        case BL_STATS_PAGE_BENCHMARK: {
+            memcpy(counters, benchmark_cycles, sizeof(counters));
+        } break;
+
+        default: {
+            counter_count = 0;  // Past the last page. Tells the host there's nothing more to ask for
+        }
+    }
+
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 2 + (counter_count * 4);   // Packet type, page number, and the uint32_t counters
+    packet->data[0] = BL_PACKET_STATS_RES_DATA0;
+    packet->data[1] = page;
+    for(uint8_t i = 0; i < counter_count; i++) {
+        write_u32_le(&packet->data[2 + (i * 4)], counters[i]);
+    }
+    packet->crc = comms_compute_crc(packet);
+}
+
+static bool is_trace_request_packet(const comms_packet_t* packet) {
+    if(packet->length != 3) { return false; }   // 3 bytes: the first identifies it as a trace request, the other 2 are a uint16_t index
+    if(packet->data[0] != BL_PACKET_TRACE_REQ_DATA0) { return false; }
+    for(uint8_t i = 3; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief The host reads the trace ring one record at a time, starting from the oldest. The ring stays frozen until it asks for
+ *        a record past the newest one
+ */
+static void create_trace_packet(comms_packet_t* packet, const uint16_t index) {
+    trace_record_t record;
+    if(index == 0) {
+        trace_freeze(true);
+    }
+    const bool has_record = trace_read(index, &record);
+    if(!has_record) {
+        trace_freeze(false);
+    }
+
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = has_record ? 12 : 3;   // Packet type, a uint16_t index, and for a record: the event, and uint32_t's of its cycles and argument
+    packet->data[0] = BL_PACKET_TRACE_RES_DATA0;
+    packet->data[1] = index & 0xff;
+    packet->data[2] = (index >> 8) & 0xff;
+    if(has_record) {
+        packet->data[3] = record.event;
+        write_u32_le(&packet->data[4], record.cycles);
+        write_u32_le(&packet->data[8], record.argument);
+    }
+    packet->crc = comms_compute_crc(packet);
+}
+
+static bool is_digest_request_packet(const comms_packet_t* packet) {
+    if(packet->length != 9) { return false; }   // 9 bytes: the first identifies it as a digest request, the other 8 are uint32_t's offset and length
+    if(packet->data[0] != BL_PACKET_DIGEST_REQ_DATA0) { return false; }
+    for(uint8_t i = 9; i < PACKET_DATA_LENGTH; i++) {
+        if(packet->data[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t read_u32_le(const uint8_t* source) {
+    return source[0] | (source[1] << 8) | (source[2] << 16) | ((uint32_t)source[3] << 24);
+}
+
+/**
+ * @brief A crc32 of a range of the slot, as it is in flash right now. Reading flash back over the uart would take longer than the
+ *        update itself, so after an update the host checks what landed with a few of these, and narrows down any range that differs
+ */
+static void create_digest_packet(comms_packet_t* packet, uint32_t offset, uint32_t length) {
+    if(offset > SLOT_SIZE) { offset = SLOT_SIZE; }
+    if(length > SLOT_SIZE - offset) { length = SLOT_SIZE - offset; }
+    const uint32_t digest = crc32((const uint8_t*)(slot_address + offset), length);
+
+    memset(packet, 0xff, sizeof(comms_packet_t));
+    packet->length = 13;    // 13 bytes: packet type, and uint32_t's of the offset, length and crc32
+    packet->data[0] = BL_PACKET_DIGEST_RES_DATA0;
+    write_u32_le(&packet->data[1], offset);
+    write_u32_le(&packet->data[5], length);
+    write_u32_le(&packet->data[9], digest);
+    packet->crc = comms_compute_crc(packet);
+}
+
+/**
+ * @brief Read the next packet meant for the state machine, if there is one. The host may ask for stats, the trace or a digest of
+ *        some flash at any point after sync, so those requests are answered right here, and none of the states has to expect them
+ */
+static bool read_packet(comms_packet_t* packet) {
+    while(comms_packets_available()) {
+        comms_read(packet);
+        if(is_stats_request_packet(packet)) {
+            create_stats_packet(packet, packet->data[1]);
+        } else if(is_trace_request_packet(packet)) {
+            create_trace_packet(packet, packet->data[1] | (packet->data[2] << 8));
+        } else if(is_digest_request_packet(packet)) {
+            create_digest_packet(packet, read_u32_le(&packet->data[1]), read_u32_le(&packet->data[5]));
+        } else {
+            return true;
+        }
+        comms_write(packet);
+    }
+    return false;
+}
+
+/**
+ * @brief Send the host a crc32 of each sector of the image we're running, out of the ones the new image spans, covering only the
+ *        part of the sector the new image will occupy. The host compares them against the new image, and answers with the
+ *        sectors that changed. The others don't have to go over the uart, see copy_unchanged_sectors()
+ * @return false if the host didn't ack one of them
+ */
+static bool send_sector_digests(void) {
+    const uint8_t first_sector = first_image_sector();
+    for(uint8_t i = 0; i < image_sectors; i++) {
+        const uint32_t offset = bl_flash_sector_start_address(first_sector + i) - ACTIVE_SLOT_ADDRESS;
+        uint32_t end = bl_flash_sector_end_address(first_sector + i) - ACTIVE_SLOT_ADDRESS;
+        if(end > fw_length) { end = fw_length; }   // The last sector is only partly used by the image
+
+        const uint32_t digest = crc32((const uint8_t*)(ACTIVE_SLOT_ADDRESS + offset), end - offset);
+        create_sector_digest_packet(&temp_packet, i, offset, end - offset, digest);
+        comms_write(&temp_packet);
+        if(!wait_for_ack(&temp_packet)) {   // Only the last packet we sent can be retransmitted, so each digest has to make it across before the next one
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_erased(const uint32_t start_address, const uint32_t end_address) {
+    for(uint32_t address = start_address; address < end_address; address += sizeof(uint32_t)) {
+        if(*(const uint32_t*)address != 0xffffffff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Pick up from where an interrupted transfer of the same image got to. Everything before resume_offset is already
+ *        written. The rest of its sector should still be erased, unless we lost power after writing past the last checkpoint.
+ *        In that case the sector is started over
+ */
+static void resume_transfer(void) {
+    uint8_t sector = 0;
+    bytes_written = resume_offset;
+    erased_end_address = slot_address + bytes_written;    // Erasing resumes from here, the next sector we write into gets erased first
+
+    if(bytes_written >= fw_length) { return; }
+    if(!bl_flash_sector_for_address(slot_address + bytes_written, &sector)) { return; }
+
+    const uint32_t sector_start = bl_flash_sector_start_address(sector);
+    const uint32_t sector_end = bl_flash_sector_end_address(sector);
+    if(erased_end_address == sector_start) { return; }  // Stopped right at the end of a sector
+
+    if(is_erased(erased_end_address, sector_end)) {
+        erased_end_address = sector_end;
+    } else {
+        bytes_written = sector_start - slot_address;
+        erased_end_address = sector_start;
+        resume_offset = bytes_written;
+    }
+}
+
+static void save_checkpoint(void) {
+    progress_log_append(image_id, fw_length, bytes_written);
+    checkpoint_offset = bytes_written;
+}
+
+static bool copy_unchanged_sectors(void);
+
+static void request_next_data(void) {
+    state = BL_State_ReceiveFirmware;
+
+    // If we're done, send the message
+    if(bytes_written >= fw_length) {
+        // A repeated transfer of the same image completes right away. Either way the image is whole, so the bootloader may install it
+        progress_log_request_install(image_id, fw_length);
+        bl_flash_end();     // The image's last few bytes may still be staged, waiting for the rest of their word
+        comms_create_single_byte_packet(&temp_packet, BL_PACKET_UPDATE_SUCCESSFUL_DATA0);
+        comms_write(&temp_packet);
+        state = BL_State_Done;
+    } else{
+        // If we're not done, send that we're ready for some more data
+        comms_create_single_byte_packet(&temp_packet, BL_PACKET_READY_FOR_DATA_DATA0);
+        comms_write(&temp_packet);
+    }
+}
+
+static void write_pending_data(void) {
+    bl_flash_write(slot_address + bytes_written, pending_data, pending_length);
+    bytes_written += pending_length;
+    if(!copy_unchanged_sectors()) {
+        return;     // The update has failed
+    }
+    if(bytes_written - checkpoint_offset >= CHECKPOINT_INTERVAL && bytes_written < fw_length) {
+        save_checkpoint();  // Always on a packet boundary, so there's no partial word staged that the record's write would flush
+    }
+    simple_timer_reset(&timer); // Every time we get a fresh packet we'll reset the timer
+    request_next_data();
+}
+
+/**
+ * @brief Just-in-time erase. Sectors are erased one at a time, the first time a write crosses into them. For each one we tell the
+ *        host that we're busy, and how long it should allow for it, then erase. The erase blocks: we run from the same flash bank,
+ *        so the core would stall on its next instruction fetch until the erase is over anyway, and there's nothing to poll in the
+ *        meantime
+ * @return false if the update failed: an erase did, or the host didn't ack
+ */
+static bool erase_up_to(const uint32_t end_address) {
+    while(end_address > erased_end_address) {
+        if(!bl_flash_sector_for_address(erased_end_address, &erasing_sector)) {
+            bootloading_fail();     // Outside of the application's portion of flash
+            return false;
+        }
+
+        const uint32_t erase_timeout = bl_flash_sector_max_erase_time(erasing_sector) * ERASE_TIMEOUT_FACTOR;
+        create_erase_busy_packet(&temp_packet, erasing_sector, erase_timeout);
+        comms_write(&temp_packet);
+
+        // Let the host's ack arrive before erasing. While the flash is busy erasing, the CPU stalls on any flash access,
+        // so bytes arriving over uart during the erase could overrun the peripheral and get lost
+        if(!wait_for_ack(&temp_packet)) {
+            bootloading_fail();
+            return false;
+        }
+
+        const uint64_t erase_start_time = system_get_ticks();
+        if(!bl_flash_erase_sector(erasing_sector)) {
+            bootloading_fail();
+            return false;
+        }
+
+        sectors_erased++;
+        create_erase_complete_packet(&temp_packet, (uint32_t)(system_get_ticks() - erase_start_time));
+        comms_write(&temp_packet);
+        // Acked before READY_FOR_DATA goes out, like the busy packet. Otherwise a retransmit request for a corrupted completion
+        // would get READY_FOR_DATA instead, and the host would still be waiting for the erase to finish
+        if(!wait_for_ack(&temp_packet)) {
+            bootloading_fail();
+            return false;
+        }
+        erased_end_address = bl_flash_sector_end_address(erasing_sector);
+        simple_timer_reset(&timer);
+    }
+    return true;
+}
+
+/**
+ * @brief Move bytes_written past the image's sectors that didn't change, so the host doesn't send their data. In the staging slot
+ *        they're copied from the image we're running, which is what the host compared them against. They can't be left as they
+ *        are: a staging sector holds several of the image's sectors, and erasing it for a changed one takes the others along
+ * @return false if the update failed on the way
+ */
+static bool copy_unchanged_sectors(void) {
+    const uint8_t first_sector = first_image_sector();
+    uint8_t sector = 0;
+    while(bytes_written < fw_length && bl_flash_sector_for_address(ACTIVE_SLOT_ADDRESS + bytes_written, &sector)) {
+        if(sector_map & (1 << (sector - first_sector))) {
+            return true;    // This one is sent
+        }
+        uint32_t end = bl_flash_sector_end_address(sector) - ACTIVE_SLOT_ADDRESS;
+        if(end > fw_length) { end = fw_length; }
+
+        if(slot_address == ACTIVE_SLOT_ADDRESS) {
+            erased_end_address = slot_address + end;    // Already in place. So the next sector we write into gets erased first
+        } else {
+            if(!erase_up_to(slot_address + end)) {
+                return false;
+            }
+            bl_flash_write(slot_address + bytes_written, (const uint8_t*)(ACTIVE_SLOT_ADDRESS + bytes_written), end - bytes_written);
+        }
+        bytes_written = end;
+    }
+    return true;
+}
+
+/**
+ * @brief How many of the slot's sectors are left to erase, for the host's progress reports. In the staging slot that's every one the
+ *        rest of the image goes into, since the unchanged parts are copied into it
+ */
+static uint8_t count_sectors_to_erase(void) {
+    const uint8_t first_sector = first_image_sector();
+    uint8_t count = 0;
+    uint8_t sector = 0;
+    for(uint32_t address = erased_end_address; address < slot_address + fw_length && bl_flash_sector_for_address(address, &sector);
+        address = bl_flash_sector_end_address(sector)) {
+        if(slot_address != ACTIVE_SLOT_ADDRESS || (sector_map & (1 << (sector - first_sector)))) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Write the pending data, once the sectors it goes into are erased
+ */
+static void erase_or_write_pending_data(void) {
+    if(erase_up_to(slot_address + bytes_written + pending_length)) {
+        write_pending_data();
+    }
+}
+
+/**
+ * @brief Get ready for a new update, written into the slot starting at slot_address. Also sets up comms.
+ * @param sync_window msec. The update fails if the host doesn't sync within it, unless it's BL_UPDATE_WAIT_FOREVER. Once synced,
+ *        every step of the update has to happen within DEFAULT_TIMEOUT either way
+ */
+void bl_update_setup(const uint32_t slot_start_address, const uint32_t sync_window) {
+    comms_setup();
+
+    slot_address = slot_start_address;
+    sync_timeout = sync_window;
+    state = BL_State_Sync;
+    fw_length = 0;
+    image_id = 0;
+    resume_offset = 0;
+    checkpoint_offset = 0;
+    bytes_written = 0;
+    erased_end_address = slot_address;
+    pending_length = 0;
+    sectors_erased = 0;
+    sectors_total = 0;
+    image_sectors = 0;
+    sector_map = 0;
+    memset(sync_seq, 0, sizeof(sync_seq));
+    trace_freeze(false);    // In case the last host stopped half way through reading the trace
+    simple_timer_setup(&timer, DEFAULT_TIMEOUT, false);
+    simple_timer_setup(&sync_timer, sync_timeout, false);
+}
+
+static bl_update_result_t get_result(void) {
+    if(state == BL_State_Done) { return BL_Update_Succeeded; }
+    if(state == BL_State_Failed) { return BL_Update_Failed; }
+    return BL_Update_InProgress;
+}
+
+/**
+ * @brief Whether bl_update_run() has nothing to do until an interrupt comes: every received byte has been handled. Received bytes and
+ *        the systick (for the timeouts) both wake the main loop up, so it can sleep whenever this is true
+ */
+bool bl_update_can_sleep(void) {
+    return !uart_data_available() && !comms_packets_available();
+}
+
+/**
+ * @brief Keep serving the host once the update is over, whichever way it went: acking, retransmitting our last packet, and
+ *        answering stats and trace requests. Also gives our last packet time to make it out before the caller tears down the uart
+ *        or resets. Returns once the host has been quiet for the given time, so reading out the whole trace isn't cut short
+ */
+void bl_update_linger(const uint32_t milliseconds) {
+    simple_timer_t linger_timer;
+    simple_timer_setup(&linger_timer, milliseconds, false);
+    uint32_t packets_received = comms_get_stats()->packets_received;
+    while(!simple_timer_has_elapsed(&linger_timer)) {
+        bl_update_run();
+        if(comms_get_stats()->packets_received != packets_received) {
+            packets_received = comms_get_stats()->packets_received;
+            simple_timer_reset(&linger_timer);
+        }
+        if(bl_update_can_sleep()) {
+            system_wait_for_events();
+        }
+    }
+}
+
+void bl_update_add_mac_micros(const uint32_t micros) {
+    mac_micros += micros;
+}
+
+/**
+ * @brief Hand over the cycle counts the bootloader's RAMFUNC_BENCHMARK build measures at boot, so fw-updater can print them along
+ *        with the other stats instead of someone reading them out with a debugger. Other builds never call this, and answer zeros
+ */
+void bl_update_set_benchmark(const uint32_t aes_cycles, const uint32_t crc8_cycles, const uint32_t crc32_cycles) {
+    benchmark_cycles[0] = aes_cycles;
+    benchmark_cycles[1] = crc8_cycles;
+    benchmark_cycles[2] = crc32_cycles;
+}
+
+static void check_for_sync_timeout(void) {
+    if(sync_timeout != BL_UPDATE_WAIT_FOREVER && simple_timer_has_elapsed(&sync_timer)) {
+        bootloading_fail();
+    }
+}
+
+/**
+ * @brief Run the update state machine. Doesn't block, call it for as long as it returns BL_Update_InProgress
+ */
+bl_update_result_t bl_update_run(void) {
+    if(state == BL_State_Sync) {
+        if(uart_data_available()) {
+            sync_seq[0] = sync_seq[1];
+            sync_seq[1] = sync_seq[2];
+            sync_seq[2] = sync_seq[3];
+            sync_seq[3] = uart_read_byte();
+
+            bool is_match = sync_seq[0] == SYNC_SEQ_0;
+            is_match = is_match && (sync_seq[1] == SYNC_SEQ_1);
+            is_match = is_match && (sync_seq[2] == SYNC_SEQ_2);
+            is_match = is_match && (sync_seq[3] == SYNC_SEQ_3);
+
+            if (is_match) {
+                // Sync is observed
+                comms_create_single_byte_packet(&temp_packet, BL_PACKET_SYNC_OBSERVED_DATA0);
+                // Notify the other side
+                comms_write(&temp_packet);
+                // In case we didn't timeout, we also want to reset the timer for the next go-around.
+                // We don't want to have only some amount of secs for the whole process, it might take more
+                simple_timer_reset(&timer);
+                state = BL_State_WaitForUpdateReq;
+            } else {
+                    check_for_sync_timeout();
+            }
+        } else {
+            check_for_sync_timeout();
+        }
+        return get_result();    // To ensure we never get to the next line (state machine) if we haven't already syncd
+    }
+    // We are assured to have already syncd
+    comms_update(); // Takes control of our UART data stream
+
+    switch (state) {
+        // BL_State_Sync: addressed above
+
+        case BL_State_WaitForUpdateReq: {
+
+            if(read_packet(&temp_packet)) {
+                if(comms_is_single_byte_packet(&temp_packet, BL_PACKET_FW_UPDATE_REQ_DATA0)) {
+                    simple_timer_reset(&timer);
+                    // Desired situation, we can send our response
+                    comms_create_single_byte_packet(&temp_packet, BL_PACKET_FW_UPDATE_RES_DATA0);
+                    comms_write(&temp_packet);
+                    state = BL_State_DevideIDReq;
+                } else {
+                    bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
+                }
+            } else {
+                check_for_timeout();
+            }
+
+        } break;
+
+        case BL_State_DevideIDReq: {
+            
+            simple_timer_reset(&timer);
+            comms_create_single_byte_packet(&temp_packet, BL_PACKET_DEVICE_ID_REQ_DATA0);
+            comms_write(&temp_packet);
+            state = BL_State_DevideIDRes;
+            
+        } break;
+
+        case BL_State_DevideIDRes: {
+
+            if(read_packet(&temp_packet)) {
+                if(is_device_id_packet(&temp_packet) && temp_packet.data[1] == DEVICE_ID) {
+                    simple_timer_reset(&timer);
+                    // device id matched
+                    state = BL_State_FWLengthReq;
+                } else {
+                    bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
+                }
+            } else {
+                check_for_timeout();
+            }
+
+            
+        } break;
+
+        case BL_State_FWLengthReq: {
+
+            simple_timer_reset(&timer);
+            comms_create_single_byte_packet(&temp_packet, BL_PACKET_FW_LENGTH_REQ_DATA0);
+            comms_write(&temp_packet);
+            state = BL_State_FWLengthRes;
+
+        } break;
+
+        case BL_State_FWLengthRes: {
+
+            if(read_packet(&temp_packet)) {
+
+                // Length data arrives in little endian
+                fw_length = (
+                    (temp_packet.data[1])       |
+                    (temp_packet.data[2] << 8)  |
+                    (temp_packet.data[3] << 16) |
+                    (temp_packet.data[4] << 24) 
+                );
+
+                if(is_fw_length_packet(&temp_packet) && fw_length <= MAX_FW_LENGTH) {
+                    // Valid fw length is accepted. Nothing is erased yet, first we find out if we've seen this image before
+                    comms_create_single_byte_packet(&temp_packet, BL_PACKET_IMAGE_ID_REQ_DATA0);
+                    comms_write(&temp_packet);
+                    simple_timer_reset(&timer);
+                    state = BL_State_ImageIdRes;
+                } else {
+                    bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
+                }
+            } else {
+                check_for_timeout();
+            }
+            
+        } break;
+
+        case BL_State_ImageIdRes: {
+
+            if(read_packet(&temp_packet)) {
+
+                if(is_image_id_packet(&temp_packet)) {
+                    image_id = (
+                        (temp_packet.data[1])       |
+                        (temp_packet.data[2] << 8)  |
+                        (temp_packet.data[3] << 16) |
+                        (temp_packet.data[4] << 24)
+                    );
+                    if(!progress_log_find(image_id, fw_length, &resume_offset)) {
+                        resume_offset = 0;
+                    }
+                    checkpoint_offset = resume_offset;
+
+                    // Then the host finds out which sectors actually changed
+                    image_sectors = count_sectors(fw_length);
+                    if(!send_sector_digests()) {
+                        bootloading_fail();
+                        break;
+                    }
+                    comms_create_single_byte_packet(&temp_packet, BL_PACKET_SECTOR_MAP_REQ_DATA0);
+                    comms_write(&temp_packet);
+                    simple_timer_reset(&timer);
+                    state = BL_State_SectorMapRes;
+                } else {
+                    bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
+                }
+            } else {
+                check_for_timeout();
+            }
+
+        } break;
+
+        case BL_State_SectorMapRes: {
+
+            if(read_packet(&temp_packet)) {
+
+                if(is_sector_map_packet(&temp_packet)) {
+                    // Sectors are erased as the data that goes into them arrives. Unchanged ones are never sent
+                    sector_map = temp_packet.data[1] & ((1U << image_sectors) - 1);
+                    bl_flash_begin();
+                    resume_transfer();
+                    sectors_total = count_sectors_to_erase();
+                    save_checkpoint();  // Before anything in the slot changes. Takes back the install request of the image staged before
+
+                    // Let the host know where to continue from. Acked before anything else is sent, since only the last packet can be retransmitted
+                    create_resume_packet(&temp_packet, resume_offset);
+                    comms_write(&temp_packet);
+                    if(!wait_for_ack(&temp_packet)) {
+                        bootloading_fail();
+                        break;
+                    }
+                    if(!copy_unchanged_sectors()) {     // Any ahead of the first changed one. May erase, so only once the resume packet is acked
+                        break;
+                    }
+                    simple_timer_reset(&timer);
+                    request_next_data();    // Straight to done, if nothing changed at all
+                } else {
+                    bootloading_fail(); // The packet we got isn't the one we're looking for at this stage
+                }
+            } else {
+                check_for_timeout();
+            }
+
+        } break;
+
+        case BL_State_ReceiveFirmware: {
+            
+            if(read_packet(&temp_packet)) {
+
+                // Writing the single packet of data into flash, once the sector it goes into has been erased
+                pending_length = (temp_packet.length & 0x0f) + 1;  // We represnt the length of the packet by a full byte, though 4 bits are enough
+                memcpy(pending_data, temp_packet.data, pending_length);  // temp_packet is also used for sending, so the data is copied out
+                erase_or_write_pending_data();
+            } else {
+                check_for_timeout();
+            }
+
+        } break;
+
+        case BL_State_Done:
+        case BL_State_Failed: {
+            // Nothing left to do. The caller stops running us, or sets us up again for the next update. Until then, the host can
+            // still ask for stats (answered by read_packet()). Anything else is too late
+            while(read_packet(&temp_packet)) {}
+        } break;
+
+        default: {
+            state = BL_State_Sync;  // In an unlikely invalid state
+        }
+
+    }
+
+    return get_result();
+}
@@ -0,0 +1,24 @@
+#include "core/boot-mailbox.h"
+
+#define UPDATE_REQUEST_MAGIC    (0x55504454)    // "UPDT". Arbitrary
+
+// The magic and its complement both have to be there, so random ram contents after a power-up are very unlikely to pass as a request
+typedef struct boot_mailbox_t {
+    uint32_t magic;
+    uint32_t magic_complement;
+} boot_mailbox_t;
+
+__attribute__ ((section(".boot_mailbox")))     // Make sure to KEEP in the linkerscript. Not part of .bss, so it isn't zeroed on startup
+static volatile boot_mailbox_t mailbox;         // volatile: written right before a reset, which the compiler doesn't know about
+
+void boot_mailbox_request_update(void) {
+    mailbox.magic = UPDATE_REQUEST_MAGIC;
+    mailbox.magic_complement = ~UPDATE_REQUEST_MAGIC;
+}
+
+bool boot_mailbox_take_update_request(void) {
+    const bool is_requested = (mailbox.magic == UPDATE_REQUEST_MAGIC) && (mailbox.magic_complement == (uint32_t)~UPDATE_REQUEST_MAGIC);
+    mailbox.magic = 0;  // A request is only good for a single reset
+    mailbox.magic_complement = 0;
+    return is_requested;
+}
@@ -1,7 +1,8 @@
 #include <string.h>
-#include "comms.h"
+#include "core/comms.h"
 #include "core/uart.h"
 #include "core/crc.h"
+#include "core/trace.h"
 
 #define PACKET_BUFFER_LENGTH (8)    // 8 is arbitrarily chosen. Doesn't have to be too large
 
@@ -19,6 +20,8 @@ static comms_packet_t temporary_packet = { .length = 0, .data = {0}, .crc = 0};
 static comms_packet_t retx_packet = { .length = 0, .data = {0}, .crc = 0};              // Re-transmit packet
 static comms_packet_t ack_packet = { .length = 0, .data = {0}, .crc = 0};               // ACK packet
 static comms_packet_t last_transmitted_packet = { .length = 0, .data = {0}, .crc = 0};  // In case we have to retransmit
+static bool last_packet_acked = true;                                                   // Has the other side acknowledged last_transmitted_packet
+static comms_stats_t stats = {0};                                                       // Not reset by comms_setup(), they're counted since boot
 
 // Declarations for an additional ring buffer. This one stores packets.
 // Not using the ring buffer data structure that we've already implemented is that this time, the data we're buffering
@@ -74,6 +77,13 @@ void comms_create_single_byte_packet(comms_packet_t* packet, uint8_t byte) {
 void comms_setup(void) {
     comms_create_single_byte_packet(&retx_packet, PACKET_RETX_DATA0); // Setting up a request retransmit packet
     comms_create_single_byte_packet(&ack_packet, PACKET_ACK_DATA0);   // Setting up an ack packet
+
+    // Also start over from a clean slate, in case we're set up again after an update was abandoned half way through a packet
+    state = CommsState_Length;
+    data_byte_count = 0;
+    packet_read_index = 0;
+    packet_write_index = 0;
+    last_packet_acked = true;
 }
 
 bool comms_packets_available(void) {
@@ -82,6 +92,9 @@ bool comms_packets_available(void) {
 
 void comms_write(comms_packet_t* packet) {
     uart_write((uint8_t*)packet, PACKET_LENGTH);
+    if(!comms_is_single_byte_packet(packet, PACKET_ACK_DATA0) && !comms_is_single_byte_packet(packet, PACKET_RETX_DATA0)) {
+        last_packet_acked = false;  // The other side doesn't ack acks and retransmit requests, only "real" packets
+    }
     memcpy(&last_transmitted_packet, packet, sizeof(comms_packet_t));
     //comms_packet_copy(packet, &last_transmitted_packet);  // Old implementation
 }
@@ -96,6 +109,7 @@ void comms_update(void) {
     while(uart_data_available()) {
         switch(state) {
             case CommsState_Length: {
+                TRACE(Trace_Event_PacketStart, 0);
                 temporary_packet.length = uart_read_byte();
                 state = CommsState_Data;
             } break;
@@ -112,13 +126,18 @@ void comms_update(void) {
                 temporary_packet.crc = uart_read_byte();                          
                 if(temporary_packet.crc != comms_compute_crc(&temporary_packet)) {
                     // Request packet retransmittion
+                    stats.crc_failures++;
+                    TRACE(Trace_Event_PacketDone, TRACE_PACKET_CRC_FAILURE);
                     comms_write(&retx_packet);
                     state = CommsState_Length;
                     break;
                 }
                 
                 // If we reached this point, we had a valid CRC
+                stats.packets_received++;
+                TRACE(Trace_Event_PacketDone, temporary_packet.data[0]);
                 if(comms_is_single_byte_packet(&temporary_packet, PACKET_RETX_DATA0)) {
+                    stats.retx_requests++;
                     comms_write(&last_transmitted_packet);
                     state = CommsState_Length;
                     break;
@@ -127,13 +146,14 @@ void comms_update(void) {
                 // If we reached this point, we check if the receiced packet is an acknowledgment packet.
                 // If so, we don't want to store it in a buffer. If it isn't, we'll transmit an ACK and store it
                 if(comms_is_single_byte_packet(&temporary_packet, PACKET_ACK_DATA0)) {
+                    last_packet_acked = true;
                     state = CommsState_Length;
                     break;
                 }
 
                 uint32_t next_write_index = (packet_write_index + 1) & packet_buffer_mask;  // Increment write index with wrap-around
                 if (next_write_index == packet_read_index) {
-                    __asm__("BKPT #0");
+                    BREAKPOINT();
                 }                                                                           // For debugging purposes
 
                 memcpy(&packet_buffer[packet_write_index], &temporary_packet, sizeof(comms_packet_t));  // Writing packet into the ring buffer
@@ -151,6 +171,14 @@ void comms_update(void) {
     }
 }
 
+const comms_stats_t* comms_get_stats(void) {
+    return &stats;
+}
+
+bool comms_is_last_packet_acked(void) {
+    return last_packet_acked;
+}
+
 uint8_t comms_compute_crc (comms_packet_t* packet) {
     // Casting the structure to a uint8_t pointer, interperting it as a series of bytes in memory.
     // Note: when structs have different data types in them, the compiler will insert padding between different fields,
@@ -6,7 +6,7 @@
 
 //volatile int x = 0;
 
-uint8_t crc8(uint8_t* data, uint32_t length) {
+RAMFUNC uint8_t crc8(uint8_t* data, uint32_t length) {
     uint8_t crc = 0;
     for(uint32_t i = 0; i <length; i++) {
         crc ^= data[i];
@@ -22,7 +22,7 @@ uint8_t crc8(uint8_t* data, uint32_t length) {
     return crc;
 }
 
-uint32_t crc32(const uint8_t* data, const uint32_t length) {
+RAMFUNC uint32_t crc32(const uint8_t* data, const uint32_t length) {
    uint8_t byte;
    uint32_t crc = 0xffffffff;
    uint32_t mask;
@@ -0,0 +1,111 @@
+#include "core/progress-log.h"
+#include <stddef.h>
+#include "core/bl-flash.h"
+
+#define PROGRESS_RECORD_MAGIC   (0x50524F47)    // "PROG". Arbitrary, just has to differ from erased flash
+#define INSTALL_REQUEST_MAGIC   (0x494E5354)    // "INST". The transfer is complete, and the bootloader should install the image
+#define INSTALL_TAKEN_MAGIC     (0x444F4E45)    // "DONE". The bootloader has acted on the install request before it
+#define PROGRESS_RECORD_COUNT   (PROGRESS_LOG_SIZE / sizeof(progress_record_t))
+
+// The log is append-only. Every checkpoint is a new record after the last one, so we only erase the sector once it's full,
+// instead of for every checkpoint. The last record is the current one.
+// The magic is the last field, so it's the last word to be programmed. A record torn by a power loss has no magic, and is ignored.
+// The magic also says what kind of record it is. A transfer into the staging slot that completes ends with an install request
+// rather than a plain checkpoint, and the bootloader only replaces the active image when the latest record is one. That way an
+// image flashed straight into the active slot (over SWD, say) isn't overwritten by an older one that's still staged
+typedef struct progress_record_t {
+    uint32_t image_id;  // Given by the host. Tells one image apart from another
+    uint32_t length;
+    uint32_t offset;    // Everything in the slot up to here has been written
+    uint32_t magic;
+} progress_record_t;
+
+static const progress_record_t* const records = (const progress_record_t*)PROGRESS_LOG_ADDRESS;
+
+static bool is_record_erased(const progress_record_t* record) {
+    return record->image_id == 0xffffffff && record->length == 0xffffffff && record->offset == 0xffffffff && record->magic == 0xffffffff;
+}
+
+static bool is_record_complete(const progress_record_t* record) {
+    return record->magic == PROGRESS_RECORD_MAGIC || record->magic == INSTALL_REQUEST_MAGIC || record->magic == INSTALL_TAKEN_MAGIC;
+}
+
+/**
+ * @brief Index of the first erased record, where the next one goes. PROGRESS_RECORD_COUNT if the log is full
+ */
+static uint32_t find_free_index(void) {
+    uint32_t index = 0;
+    while(index < PROGRESS_RECORD_COUNT && !is_record_erased(&records[index])) {
+        index++;
+    }
+    return index;
+}
+
+/**
+ * @brief The latest record that isn't torn, or NULL if there isn't one
+ */
+static const progress_record_t* find_latest_record(void) {
+    for(uint32_t index = find_free_index(); index > 0; index--) {
+        if(is_record_complete(&records[index - 1])) {
+            return &records[index - 1];
+        }
+        // Torn record, the one before it is the latest complete one
+    }
+    return NULL;
+}
+
+/**
+ * @brief Look up how far the transfer of an image got
+ * @return false if the latest checkpoint is for some other image, or there isn't one
+ */
+bool progress_log_find(const uint32_t image_id, const uint32_t length, uint32_t* offset) {
+    const progress_record_t* record = find_latest_record();
+    if(record == NULL || record->image_id != image_id || record->length != length || record->offset > length) {
+        return false;
+    }
+    *offset = record->offset;
+    return true;
+}
+
+static void append_record(const uint32_t image_id, const uint32_t length, const uint32_t offset, const uint32_t magic) {
+    uint32_t index = find_free_index();
+    if(index == PROGRESS_RECORD_COUNT) {
+        // Full. Only happens every thousand or so checkpoints, so the erase's stall doesn't add up to much
+        bl_flash_erase_sector(PROGRESS_LOG_SECTOR);
+        index = 0;
+    }
+
+    const progress_record_t record = {
+        .image_id = image_id,
+        .length = length,
+        .offset = offset,
+        .magic = magic,
+    };
+    bl_flash_write((uint32_t)&records[index], (const uint8_t*)&record, sizeof(record));
+    bl_flash_flush();
+}
+
+void progress_log_append(const uint32_t image_id, const uint32_t length, const uint32_t offset) {
+    append_record(image_id, length, offset, PROGRESS_RECORD_MAGIC);
+}
+
+/**
+ * @brief Record that the transfer of an image is complete, and ask the bootloader to install it on the next reset. The next
+ *        transfer takes the request back with a checkpoint before it changes anything in the slot
+ */
+void progress_log_request_install(const uint32_t image_id, const uint32_t length) {
+    append_record(image_id, length, length, INSTALL_REQUEST_MAGIC);
+}
+
+/**
+ * @brief Whether the latest transfer asked for its image to be installed and nothing has acted on it yet. Takes the request
+ *        either way, so it's only acted on once. A transfer of the same image resumes as complete all the same
+ */
+bool progress_log_take_install_request(void) {
+    const progress_record_t* record = find_latest_record();
+    if(record == NULL || record->magic != INSTALL_REQUEST_MAGIC) {
+        return false;
+    }
+    append_record(record->image_id, record->length, record->offset, INSTALL_TAKEN_MAGIC);
+    return true;
+}
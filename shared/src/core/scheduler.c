@@ -0,0 +1,124 @@
+#include "core/scheduler.h"
+#include <stddef.h>
+#include "core/system.h"
+
+static scheduler_task_t* tasks = NULL;
+static uint32_t task_count = 0;
+static uint64_t idle_micros = 0;
+
+static void make_ready(scheduler_task_t* task, const uint64_t now) {
+    if(!task->is_ready) {
+        task->is_ready = true;
+        task->ready_time = now;     // A task that's already waiting to run keeps the time it first became ready
+    }
+}
+
+/**
+ * @brief Timer wheel callback of a periodic task. The wheel has already moved the timer's deadline on by a period, so the deadline
+ *        that just came is a period before it. That's when the task became ready, however late the wheel got around to calling us
+ */
+static void make_periodic_task_ready(void* context) {
+    scheduler_task_t* task = (scheduler_task_t*)context;
+    make_ready(task, (task->timer.deadline - task->period) * 1000);
+}
+
+static uint32_t get_deadline(const scheduler_task_t* task) {
+    if(task->deadline != 0) {
+        return task->deadline;
+    }
+    return task->period * 1000;
+}
+
+static void update_stats(scheduler_task_t* task, const uint64_t start, const uint64_t end) {
+    scheduler_task_stats_t* stats = &task->stats;
+    const uint32_t run_micros = (uint32_t)(end - start);
+
+    stats->runs++;
+    stats->last_run_micros = run_micros;
+    if(run_micros > stats->max_run_micros) {
+        stats->max_run_micros = run_micros;
+    }
+    stats->total_run_micros += run_micros;
+
+    const uint32_t deadline = get_deadline(task);
+    if(deadline != 0 && (end - task->ready_time) > deadline) {
+        stats->deadline_misses++;
+    }
+}
+
+/**
+ * @brief Run every task that's ready once, in the order of the table. Returns true if any of them has more work to do right away
+ */
+static bool run_ready_tasks(const uint32_t events) {
+    const uint64_t now = system_get_micros();
+    for(uint32_t i = 0; i < task_count; i++) {
+        if(tasks[i].events & events) {
+            make_ready(&tasks[i], now);
+        }
+    }
+
+    bool has_more_work = false;
+    for(uint32_t i = 0; i < task_count; i++) {
+        scheduler_task_t* task = &tasks[i];
+        if(!task->is_ready) {
+            continue;
+        }
+
+        task->is_ready = false;
+        const uint64_t start = system_get_micros();
+        const bool task_has_more_work = task->function();
+        const uint64_t end = system_get_micros();
+        update_stats(task, start, end);
+
+        if(task_has_more_work) {
+            make_ready(task, end);
+            has_more_work = true;
+        }
+    }
+    return has_more_work;
+}
+
+/**
+ * @brief Take over a static table of tasks. Sets up the timer wheel as well, which the periodic tasks run on. Timers of our own can
+ *        still be started on the wheel after this; scheduler_run() keeps it going
+ */
+void scheduler_setup(scheduler_task_t* task_table, const uint32_t count) {
+    tasks = task_table;
+    task_count = count;
+    idle_micros = 0;
+
+    timer_wheel_setup();
+    for(uint32_t i = 0; i < task_count; i++) {
+        scheduler_task_t* task = &tasks[i];
+        task->is_ready = false;
+        task->stats = (scheduler_task_stats_t){ 0 };
+        if(task->period != 0) {
+            timer_wheel_start(&task->timer, task->period, task->period, make_periodic_task_ready, task);
+        }
+    }
+}
+
+/**
+ * @brief Run the tasks as they become ready. When none is, sleep until the next interrupt: the systick wakes us every millisecond,
+ *        which is when periodic tasks become ready, and other interrupts flag the events that event triggered tasks wait for
+ */
+void scheduler_run(void) {
+    uint32_t events = 0;
+    while(1) {
+        timer_wheel_update();
+        events |= system_take_events();
+
+        const bool has_more_work = run_ready_tasks(events);
+        events = 0;
+
+        if(!has_more_work) {
+            const uint64_t sleep_start = system_get_micros();
+            events = system_wait_for_events();
+            idle_micros += system_get_micros() - sleep_start;
+        }
+    }
+}
+
+uint64_t scheduler_get_idle_micros(void) {
+    return idle_micros;
+}
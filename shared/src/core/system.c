@@ -1,7 +1,12 @@
 #include "core/system.h"
+#include "core/trace.h"
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/vector.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/scb.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/pwr.h>
 
 
 static volatile uint64_t ticks = 0;    // volatile - since we're using an interrupt, the compiler dones't have a way of knowing that our code will ever call into the handler function.
@@ -12,43 +17,134 @@ static volatile uint64_t ticks = 0;    // volatile - since we're using an interr
                                         // But, this is a 32-bit MCU. So any addition, such as the one below, can't take single assembly instruction.
                                         // We can't preform atomic operations on a 64-bit value in this 32-bit MCU.
                                         // Between those two assembly instruction, another interrupt can occur.
-                                        // We need to mask off other interrupts.
+                                        // We need to mask off other interrupts, or read it in a way that notices an interrupt came in between. See system_get_ticks()
 void sys_tick_handler(void) {
     ticks++;
+    system_set_events(SYSTEM_EVENT_TICK);
 }
 
+static volatile uint32_t pending_events = 0;        // SYSTEM_EVENT_ flags set by interrupts, not yet taken by the main loop
+static volatile uint32_t max_wake_latency = 0;      // cpu cycles
 
+// Both from the HSI, so switching between them doesn't depend on an external crystal. libopencm3's configs carry the flash wait
+// states (2 at 84 MHz, 5 at 180 MHz) and the voltage scaling each frequency needs. Over-drive, which 180 MHz also needs, isn't
+// part of them, see set_overdrive()
+static const struct rcc_clock_scale* const clock_profiles[] = {
+    [System_Clock_Default] = &rcc_hsi_configs[RCC_CLOCK_3V3_84MHZ],
+    [System_Clock_Max]     = &rcc_hsi_configs[RCC_CLOCK_3V3_180MHZ],
+};
+static system_clock_profile_t clock_profile = System_Clock_Default;
+
+/**
+ * @brief Over-drive lets the regulator supply the core above 168 MHz. rcc_clock_setup_pll() doesn't handle it, so it's switched here,
+ *        while we run from the HSI, following "Entering Over-drive mode" and "Exiting from Over-drive mode" in the reference manual.
+ *        It's switched off again for the default profile: at 84 MHz it only costs power, and the application's own setup expects to
+ *        find the regulator the way a reset leaves it
+ */
+static void set_overdrive(const bool is_enabled) {
+    rcc_periph_clock_enable(RCC_PWR);
+    if(is_enabled) {
+        PWR_CR |= PWR_CR_ODEN;
+        while(!(PWR_CSR & PWR_CSR_ODRDY)) {}
+        PWR_CR |= PWR_CR_ODSWEN;                // Switches the regulator over
+        while(!(PWR_CSR & PWR_CSR_ODSWRDY)) {}
+    } else {
+        PWR_CR &= ~PWR_CR_ODSWEN;               // Switches the regulator back first
+        while(PWR_CSR & PWR_CSR_ODSWRDY) {}
+        PWR_CR &= ~PWR_CR_ODEN;
+    }
+}
 
 /**
  * @brief static means it will be available only in the current tranlation unit. One can think of the latter as the .c file and the .h files it includes
  *        In this function, we set the CPU clock and frequency
  */
 static void rcc_setup(void) {
-    rcc_clock_setup_pll(&rcc_hsi_configs[RCC_CLOCK_3V3_84MHZ]);
+    const uint32_t old_frequency = rcc_ahb_frequency;
+
+    // Over to the HSI before touching over-drive. rcc_clock_setup_pll() goes through the HSI as well, but does all of its own
+    // switching in one go
+    rcc_osc_on(RCC_HSI);
+    rcc_wait_for_osc_ready(RCC_HSI);
+    rcc_set_sysclk_source(RCC_CFGR_SW_HSI);
+    rcc_wait_for_sysclk_status(RCC_HSI);
+    set_overdrive(clock_profile == System_Clock_Max);
+
+    rcc_clock_setup_pll(clock_profiles[clock_profile]);
+    TRACE(Trace_Event_ClockChange, ((old_frequency / 1000000) << 16) | (rcc_ahb_frequency / 1000000));
+
+    // The ART accelerator: instruction prefetch, and the instruction and data caches in front of flash. Hides most of the flash
+    // wait states, which matters more the faster the CPU runs
+    flash_prefetch_enable();
+    flash_icache_enable();
+    flash_dcache_enable();
 }
 
 /**
  * @brief Establish the systick frequency, enable the interrupt
  */
 static void systick_setup(void) {
-    systick_set_frequency(SYSTICK_FREQ, CPU_FREQ);
+    systick_set_frequency(SYSTICK_FREQ, rcc_ahb_frequency);   // The systick counts cpu clock cycles, so it follows the clock profile
     systick_counter_enable();
     systick_interrupt_enable();
 }
 
+/**
+ * @brief The ticks are a 64-bit value, read as two 32-bit halves. If the systick interrupt comes in between the two, we'd get the
+ *        low half of one value and the high half of another (e.g. 0x1_ffffffff read as 0x2_ffffffff). Rather than masking interrupts,
+ *        read until two reads in a row agree. Only the interrupt writes ticks, and it can't come twice in a few instructions
+ */
 uint64_t system_get_ticks(void) {
-    return ticks;
+    uint64_t now = ticks;
+    while(now != ticks) {
+        now = ticks;
+    }
+    return now;
+}
+
+/**
+ * @brief Microseconds since system_setup(). The milliseconds come from the ticks, the rest from how far the systick has counted down
+ *        since its last reload. If the systick interrupt comes while we read the two, we read them again. Called with interrupts
+ *        masked, the count may already have reloaded before the interrupt ran, and we come up a millisecond short
+ */
+uint64_t system_get_micros(void) {
+    uint64_t milliseconds = 0;
+    uint32_t elapsed_cycles = 0;
+
+    do {
+        milliseconds = system_get_ticks();
+        elapsed_cycles = systick_get_reload() - systick_get_value();   // The systick counts down
+    } while(milliseconds != system_get_ticks());
+
+    return (milliseconds * 1000) + (elapsed_cycles / (rcc_ahb_frequency / 1000000));
 }
 
 void system_setup(void) {
+    trace_setup();
     rcc_setup();
     systick_setup();
 }
 
+/**
+ * @brief Run the CPU at the frequency of the given profile. rcc_clock_setup_pll() runs from the HSI while it reprograms the PLL, so the
+ *        flash wait states are always changed at a low frequency, whichever way we're going. The systick is adjusted to keep counting
+ *        milliseconds (the tick being switched in may come a little late). Peripheral clocks change too (APB1 goes from 42 to 45 MHz),
+ *        so only switch while nothing that was set up against them, such as the uart's baud rate, is in use
+ */
+void system_set_clock_profile(const system_clock_profile_t profile) {
+    if(profile == clock_profile) { return; }
+
+    clock_profile = profile;
+    rcc_setup();
+    systick_set_frequency(SYSTICK_FREQ, rcc_ahb_frequency);
+}
+
 /***
- * @brief Need to do a teardown (a reverse process to setup) when the bootloader code finishes, cause it interferes with main app setup
+ * @brief Need to do a teardown (a reverse process to setup) when the bootloader code finishes, cause it interferes with main app setup.
+ *        The clock goes back to the default profile, which is what the application's own setup expects to find
  */
 void system_teardown(void) {
+    system_set_clock_profile(System_Clock_Default);
     systick_interrupt_disable();
     systick_counter_disable();
     systick_clear();
@@ -56,11 +152,88 @@ void system_teardown(void) {
 
 
 /**
- * @brief Spin for a specified amount of milliseconds
+ * @brief Flag events for the main loop. Safe to call from any interrupt, even one that preempts another one that's setting events
+ */
+void system_set_events(const uint32_t events) {
+    const uint32_t was_masked = cm_mask_interrupts(1);
+    pending_events |= events;
+    cm_mask_interrupts(was_masked);
+}
+
+/**
+ * @brief Sleep until an interrupt flags an event, unless one is pending already. Returns (and clears) all the pending events.
+ *
+ *        Interrupts are masked while we check for events and go to sleep, or an event flagged right after we checked would leave us
+ *        asleep with work to do. WFI still wakes up for a masked interrupt, which then runs once we unmask. It has to run for its
+ *        event to be flagged, so interrupts are unmasked after every wake up even if the caller had them masked; the caller's mask
+ *        is put back on return.
+ *        We only ever use sleep mode (SLEEPDEEP is left clear): just the cpu clock stops, while flash, the systick and the peripherals
+ *        keep running, so waking up takes a few cycles. The systick wakes us every millisecond at the latest.
+ *        Waking up for the systick, we know when its interrupt was raised (when the count reloaded), which is how the wake-up latency
+ *        is measured. Only when the systick wasn't pending yet as we went to sleep, though: if it was, WFI doesn't sleep at all, and
+ *        the count says how long ago the tick came while we were still busy. See system_get_max_wake_latency()
+ */
+uint32_t system_wait_for_events(void) {
+    const uint32_t was_masked = cm_mask_interrupts(1);
+    while(pending_events == 0) {
+        const bool was_tick_pending = (SCB_ICSR & SCB_ICSR_PENDSTSET) != 0;
+        __asm__ volatile ("wfi");
+
+        if(!was_tick_pending && (SCB_ICSR & SCB_ICSR_PENDSTSET)) {
+            const uint32_t latency = systick_get_reload() - systick_get_value();   // Cycles since the systick reloaded and woke us
+            if(latency > max_wake_latency) {
+                max_wake_latency = latency;
+            }
+        }
+
+        cm_enable_interrupts();     // Whatever woke us up runs here
+        cm_disable_interrupts();
+    }
+    const uint32_t events = pending_events;
+    pending_events = 0;
+    cm_mask_interrupts(was_masked);
+    return events;
+}
+
+/**
+ * @brief Returns (and clears) the pending events, without waiting for any
+ */
+uint32_t system_take_events(void) {
+    const uint32_t was_masked = cm_mask_interrupts(1);
+    const uint32_t events = pending_events;
+    pending_events = 0;
+    cm_mask_interrupts(was_masked);
+    return events;
+}
+
+/**
+ * @brief The longest it took from the systick raising its interrupt to the cpu running again, in cpu cycles, over every wait so far
+ *        that the systick woke us from. Each sample counts from the reload to the first instruction after WFI, so it's never less than
+ *        the real latency. It's more by at most the few instructions between checking PENDSTSET and WFI, if the tick comes in there,
+ *        or by the instructions after waking up, if another interrupt woke us and the tick came right after. Waits that didn't sleep
+ *        because the tick was already pending aren't counted
+ */
+uint32_t system_get_max_wake_latency(void) {
+    return max_wake_latency;
+}
+
+/**
+ * @brief Spin for a specified amount of microseconds. For short waits that a millisecond tick is too coarse for
+ */
+void system_delay_micros(uint32_t microseconds) {
+    uint64_t end_time = system_get_micros() + microseconds;
+    while(system_get_micros() < end_time) {
+        // Spin
+    }
+}
+
+/**
+ * @brief Sleep for a specified amount of milliseconds. Woken up every tick (or by any other interrupt) to check the time. Events that
+ *        come in meanwhile are dropped, so only use it when nothing else needs to run
  */
 void system_delay(uint64_t milliseconds) {
     uint64_t end_time = system_get_ticks() + milliseconds;
     while(system_get_ticks() < end_time) {
-        // Spin. Note: The tick varialbe is volatile, so the compiler doesn't optimize this away
+        system_wait_for_events();
     }
 }
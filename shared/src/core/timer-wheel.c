@@ -0,0 +1,120 @@
+#include "core/timer-wheel.h"
+#include <stddef.h>
+#include "core/system.h"
+
+#define WHEEL_SLOTS     (64)    // Has to be a power of 2. A timer further away than this many ticks waits in its slot for another lap
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+
+static timer_wheel_timer_t* slots[WHEEL_SLOTS];
+static uint64_t next_tick = 0;  // The first tick whose slot timer_wheel_update() hasn't gone through yet, or won't in this update
+
+static void link_timer(timer_wheel_timer_t* timer) {
+    timer_wheel_timer_t** slot = &slots[timer->deadline & WHEEL_MASK];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if(*slot != NULL) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->is_running = true;
+}
+
+static void unlink_timer(timer_wheel_timer_t* timer) {
+    if(timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        slots[timer->deadline & WHEEL_MASK] = timer->next;
+    }
+    if(timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->is_running = false;
+}
+
+/**
+ * @brief Put the timer in the slot of its deadline. A deadline in a slot we've already gone through this lap (it's due already) is
+ *        moved up to the next tick we'll go through, or it would wait a whole lap. From a callback, that's the tick after the one
+ *        being gone through, so a timer restarted with no delay doesn't land back in the slot and keep the update from ending
+ */
+static void schedule_timer(timer_wheel_timer_t* timer, uint64_t deadline) {
+    if(deadline < next_tick) {
+        deadline = next_tick;
+    }
+    timer->deadline = deadline;
+    link_timer(timer);
+}
+
+static timer_wheel_timer_t* find_due_timer(timer_wheel_timer_t* slot, const uint64_t now) {
+    for(timer_wheel_timer_t* timer = slot; timer != NULL; timer = timer->next) {
+        if(timer->deadline <= now) {
+            return timer;
+        }
+    }
+    return NULL;
+}
+
+void timer_wheel_setup(void) {
+    for(uint32_t i = 0; i < WHEEL_SLOTS; i++) {
+        slots[i] = NULL;
+    }
+    next_tick = system_get_ticks();
+}
+
+/**
+ * @param delay Ticks until the first call of the callback
+ * @param period Ticks between the calls that follow. Zero to only call it once
+ */
+void timer_wheel_start(timer_wheel_timer_t* timer, const uint32_t delay, const uint32_t period, const timer_wheel_callback_t callback, void* context) {
+    if(timer->is_running) {
+        unlink_timer(timer);    // Restarting a running timer
+    }
+    timer->period = period;
+    timer->callback = callback;
+    timer->context = context;
+    schedule_timer(timer, system_get_ticks() + delay);
+}
+
+void timer_wheel_stop(timer_wheel_timer_t* timer) {
+    if(timer->is_running) {
+        unlink_timer(timer);
+    }
+}
+
+/**
+ * @brief Go through the slots of every tick since the last call. If we fell behind by a whole lap or more (e.g. the CPU was stalled
+ *        by a flash erase), each slot is gone through once, and everything that's due by now gets called. A periodic timer is called
+ *        once for all the periods it missed, and keeps its phase
+ */
+void timer_wheel_update(void) {
+    const uint64_t now = system_get_ticks();
+    if(now < next_tick) {
+        return;
+    }
+
+    const uint64_t first_tick = next_tick;
+    uint64_t ticks_to_visit = now - first_tick + 1;
+    if(ticks_to_visit > WHEEL_SLOTS) {
+        ticks_to_visit = WHEEL_SLOTS;
+    }
+    next_tick = now + 1;    // Before any callback runs, so whatever they start is due on the next tick at the earliest
+
+    for(uint64_t tick = first_tick; tick < first_tick + ticks_to_visit; tick++) {
+        timer_wheel_timer_t* timer = NULL;
+        // A callback may start or stop any timer, including ones in this slot. So look for the next due timer from the start of the
+        // slot every time, instead of holding on to a pointer into the list
+        while((timer = find_due_timer(slots[tick & WHEEL_MASK], now)) != NULL) {
+            unlink_timer(timer);
+            if(timer->period != 0) {
+                uint64_t deadline = timer->deadline + timer->period;
+                if(deadline <= now) {
+                    deadline += ((now - deadline) / timer->period + 1) * timer->period;    // Skipping the periods we missed
+                }
+                timer->deadline = deadline;
+                link_timer(timer);  // Always in the future, so never found again in this update
+            }
+            timer->callback(timer->context);
+        }
+    }
+}
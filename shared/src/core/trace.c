@@ -0,0 +1,82 @@
+#include "core/trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/dbgmcu.h>
+
+static trace_record_t records[TRACE_RECORDS];
+static uint32_t record_count = 0;   // Ever recorded. The ring holds the last TRACE_RECORDS of them
+static bool is_ring_frozen = false;
+
+/**
+ * @brief Start the cycle counter, and keep it counting while the cpu sleeps. In sleep mode the core's clock (HCLK) normally stops, and
+ *        the cycle counter with it, which would take the time spent in system_wait_for_events() out of the timeline. DBG_SLEEP keeps
+ *        HCLK running through sleep instead, at the cost of some power while asleep. DBGMCU_CR is only cleared by a power-on reset,
+ *        so whatever runs after a traced bootloader keeps it too
+ */
+void trace_setup(void) {
+    DBGMCU_CR |= DBGMCU_CR_SLEEP;
+    dwt_enable_cycle_counter();
+}
+
+/**
+ * @brief Append a record, overwriting the oldest one if the ring is full. Interrupts are masked for the few instructions it takes,
+ *        so an interrupt recording an event of its own can't land in the middle of ours
+ */
+void trace_record(const trace_event_t event, const uint32_t argument) {
+    const uint32_t was_masked = cm_mask_interrupts(1);
+    if(!is_ring_frozen) {
+        trace_record_t* record = &records[record_count & (TRACE_RECORDS - 1)];
+        record->cycles = dwt_read_cycle_counter();
+        record->argument = argument;
+        record->event = (uint8_t)event;
+        record_count++;
+    }
+    cm_mask_interrupts(was_masked);
+}
+
+/**
+ * @brief While the host reads the ring out, a packet at a time, the traffic it causes would otherwise overwrite the records it's
+ *        reading. Nothing is recorded while frozen. Freezing records one last event, with the frequency the cycles are counted at
+ */
+void trace_freeze(const bool is_frozen) {
+    if(is_frozen && !is_ring_frozen) {
+        trace_record(Trace_Event_Freeze, rcc_ahb_frequency / 1000000);
+    }
+    is_ring_frozen = is_frozen;
+}
+
+bool trace_read(const uint32_t index, trace_record_t* record) {
+    const uint32_t available = (record_count < TRACE_RECORDS) ? record_count : TRACE_RECORDS;
+    if(index >= available) {
+        return false;
+    }
+    *record = records[(record_count - available + index) & (TRACE_RECORDS - 1)];
+    return true;
+}
+
+#else
+
+// Built without tracing: nothing is recorded, and the ring reads as empty
+
+void trace_setup(void) {}
+
+void trace_record(const trace_event_t event, const uint32_t argument) {
+    (void)event;
+    (void)argument;
+}
+
+void trace_freeze(const bool is_frozen) {
+    (void)is_frozen;
+}
+
+bool trace_read(const uint32_t index, trace_record_t* record) {
+    (void)index;
+    (void)record;
+    return false;
+}
+
+#endif // TRACE_ENABLED
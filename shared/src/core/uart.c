@@ -3,6 +3,8 @@
 #include <libopencm3/cm3/nvic.h>
 #include "core/uart.h"
 #include "core/ring-buffer.h"
+#include "core/system.h"
+#include "core/trace.h"
 
 #define BAUD_RATE        (115200)
 #define RING_BUFFER_SIZE (128)          // For maximum of ~10ms of "latency" (time we can't read from the buffer for), at 115200 baud
@@ -23,7 +25,7 @@
 
 static ring_buffer_t rb = {0U};
 static uint8_t data_buffer[RING_BUFFER_SIZE] = {0U};
-volatile int x = 0;
+static volatile uart_stats_t stats = {0};     // Written by the isr
 
 // We need to implement the irq handler. The function that we need to implement is from vector.c --> IRQ_HANDLERS --> NVIC_USART2_IRQ --> usart2_isr()
 // When we received that inteuupt is when we received a byte. We can either have just received a single normally, or we could have received a byte
@@ -31,9 +33,11 @@ volatile int x = 0;
 // get data out of the pripheral fast enough, then it can have its own buffer overflow situation. In order for us to tell which of each of these two
 // occured, we need to read the flags from the UART peripheral.
 void usart2_isr(void) {
-    //x++;
     const bool overrun_occured = usart_get_flag(USART2, USART_FLAG_ORE) == 1;  // Overrun happened or not
     const bool received_data = usart_get_flag(USART2, USART_FLAG_RXNE) == 1;   // Received data or not
+    if(overrun_occured) {
+        stats.overruns++;
+    }
     if(received_data || overrun_occured) {
         // First, poor solution
         //data_buffer = (uint8_t)usart_recv(USART2);  // Non sophisticated, will not stand up to possible problems that we'll encounter
@@ -41,11 +45,16 @@ void usart2_isr(void) {
 
         // Using our ring buffer
         //uint32_t temp = (uint32_t)usart_recv(USART2);
-        uint16_t temp = usart_recv(USART2);
-        if(!ring_buffer_write(&rb, temp)) {
-            // Handle failure. Not so much that we can do at the moment, we probably need to increase buffer size. We can communite it to the program
-            //x++;
+        const uint8_t byte = (uint8_t)usart_recv(USART2);
+        stats.bytes_received++;
+        const bool is_stored = ring_buffer_write(&rb, byte);
+        if(!is_stored) {
+            // Handle failure. Not so much that we can do at the moment, we probably need to increase buffer size. We communicate it
+            // to the program, and through it to the host. See uart_get_stats()
+            stats.ring_buffer_drops++;
         }
+        TRACE(Trace_Event_UartRx, byte | (is_stored ? 0 : TRACE_UART_DROPPED) | (overrun_occured ? TRACE_UART_OVERRUN : 0));
+        system_set_events(SYSTEM_EVENT_UART_RX);    // Wakes the main loop up, if it's asleep
     }
     
 }
@@ -145,4 +154,16 @@ bool uart_data_available(void) {
 
     // Implementation with our ring buffer
     return !ring_buffer_empty(&rb);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief A copy of the receive counters. Each one is only ever written by the isr, a whole word at a time, so reading them needs
+ *        no masking. The copy may mix counts from just before and just after a byte came in
+ */
+uart_stats_t uart_get_stats(void) {
+    return (uart_stats_t){
+        .bytes_received    = stats.bytes_received,
+        .ring_buffer_drops = stats.ring_buffer_drops,
+        .overruns          = stats.overruns,
+    };
+}